@@ -82,6 +82,16 @@ void debug_message(const char *msg, ...)
     va_end(args);
 }
 
+int stats_enabled(void)
+{
+    static int g_stats_enabled = -1;
+    if (g_stats_enabled < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_STATS", &g_stats_enabled) < 0)
+            g_stats_enabled = 0;
+    }
+    return g_stats_enabled;
+}
+
 static int g_trace_is_new_line  = 1;
 static int g_trace_indent       = 0;
 
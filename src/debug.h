@@ -37,6 +37,10 @@ void debug_message(const char *msg, ...)
 # define D(x)
 #endif
 
+// Returns TRUE if statistics reporting is enabled
+int stats_enabled(void)
+    attribute_hidden;
+
 // Returns TRUE if debug trace is enabled
 int trace_enabled(void)
     attribute_hidden;
@@ -0,0 +1,763 @@
+/*
+ *  image_convert.c - Pixel copy and format conversion
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#include "sysdeps.h"
+#include "image_convert.h"
+#include "utils.h"
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define DEBUG 1
+#include "debug.h"
+
+// Assumed last-level cache size, if the system does not report it
+#define LLC_SIZE_DEFAULT (8 << 20)
+
+// RGB to YCbCr coefficients, 8-bit fixed point
+typedef struct {
+    int y[3];
+    int cb[3];
+    int cr[3];
+} rgb_to_yuv_coeffs_t;
+
+static const rgb_to_yuv_coeffs_t rgb_to_yuv_coeffs[] = {
+    [IMAGE_COLORSPACE_BT601] = {
+        {  66, 129,  25 }, { -38, -74, 112 }, { 112, -94, -18 }
+    },
+    [IMAGE_COLORSPACE_BT709] = {
+        {  47, 157,  16 }, { -26, -87, 112 }, { 112, -102, -10 }
+    },
+};
+
+// A plane copy or conversion, processed in bands of rows
+typedef struct copy_job copy_job_t;
+struct copy_job {
+    void          (*run)(const copy_job_t *job, unsigned int y0, unsigned int y1);
+    unsigned int    height;
+    unsigned int    row_align;      // band height granularity (power of two)
+    int             stream;         // use non-temporal stores
+    ImageConvert    convert;
+    unsigned int    plane;
+    uint8_t        *dst;
+    unsigned int    dst_stride;
+    const uint8_t  *src;
+    unsigned int    src_stride;
+    unsigned int    width;
+    uint8_t        *dst_cb;
+    uint8_t        *dst_cr;
+    unsigned int    dst_c_stride;
+    unsigned int    chroma_step;
+    const uint8_t  *rgb_offsets;
+    const rgb_to_yuv_coeffs_t *coeffs;
+};
+
+struct image_copy_pool {
+    pthread_mutex_t     lock;
+    pthread_cond_t      work_cond;      // workers wait for bands
+    pthread_cond_t      done_cond;      // caller waits for the last band
+    pthread_mutex_t     run_lock;       // one job at a time
+    pthread_t          *threads;
+    unsigned int        num_threads;
+    unsigned int        max_threads;    // started on the first large copy
+    int                 started;
+    unsigned int        min_size;
+    uint64_t            llc_size;
+    const copy_job_t   *job;
+    unsigned int        band_rows;
+    unsigned int        num_bands;
+    unsigned int        next_band;
+    unsigned int        bands_done;
+    int                 exit;
+    uint64_t            num_calls;
+    uint64_t            num_threaded_calls;
+    uint64_t            num_bytes;
+    uint64_t            copy_time;      // nsec
+};
+
+// Returns the size of the last-level cache, in bytes
+static uint64_t get_llc_size(void)
+{
+    long size = -1;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    if (size <= 0)
+        size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    return size > 0 ? size : LLC_SIZE_DEFAULT;
+}
+
+// Copies SIZE bytes, bypassing the caches if STREAM is set
+static void
+copy_row(uint8_t *dst, const uint8_t *src, unsigned int size, int stream)
+{
+#ifdef __SSE2__
+    if (stream && size >= 64) {
+        const unsigned int head = -(uintptr_t)dst & 15;
+
+        memcpy(dst, src, head);
+        dst  += head;
+        src  += head;
+        size -= head;
+        for (; size >= 64; size -= 64, dst += 64, src += 64) {
+            const __m128i v0 = _mm_loadu_si128((const __m128i *)src);
+            const __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 16));
+            const __m128i v2 = _mm_loadu_si128((const __m128i *)(src + 32));
+            const __m128i v3 = _mm_loadu_si128((const __m128i *)(src + 48));
+            _mm_stream_si128((__m128i *)dst, v0);
+            _mm_stream_si128((__m128i *)(dst + 16), v1);
+            _mm_stream_si128((__m128i *)(dst + 32), v2);
+            _mm_stream_si128((__m128i *)(dst + 48), v3);
+        }
+        for (; size >= 16; size -= 16, dst += 16, src += 16)
+            _mm_stream_si128((__m128i *)dst,
+                             _mm_loadu_si128((const __m128i *)src));
+    }
+#endif
+    memcpy(dst, src, size);
+}
+
+// Orders non-temporal stores before the band is reported as done
+static inline void copy_fence(int stream)
+{
+#ifdef __SSE2__
+    if (stream)
+        _mm_sfence();
+#endif
+}
+
+// Runs the bands of JOB on the worker threads and the calling thread.
+static void copy_pool_start(ImageCopyPool *pool);
+
+// SIZE is the number of bytes written
+static void
+copy_job_execute(ImageCopyPool *pool, copy_job_t *job, uint64_t size)
+{
+    uint64_t ticks, elapsed;
+    unsigned int n, band, band_rows = 0, num_bands = 1;
+
+    if (job->height == 0)
+        return;
+
+    if (!pool) {
+        job->run(job, 0, job->height);
+        return;
+    }
+
+    job->stream = size > pool->llc_size;
+    ticks = get_ticks_nsec();
+
+    if (size >= pool->min_size && pool->max_threads > 0 &&
+        !__atomic_load_n(&pool->started, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&pool->run_lock);
+        if (!pool->started)
+            copy_pool_start(pool);
+        pthread_mutex_unlock(&pool->run_lock);
+    }
+
+    if (pool->num_threads > 0 && size >= pool->min_size) {
+        n = pool->num_threads + 1;
+        band_rows = (job->height + n - 1) / n;
+        band_rows = (band_rows + job->row_align - 1) & -job->row_align;
+        num_bands = (job->height + band_rows - 1) / band_rows;
+    }
+
+    if (num_bands < 2)
+        job->run(job, 0, job->height);
+    else {
+        pthread_mutex_lock(&pool->run_lock);
+        pthread_mutex_lock(&pool->lock);
+        pool->job        = job;
+        pool->band_rows  = band_rows;
+        pool->num_bands  = num_bands;
+        pool->next_band  = 0;
+        pool->bands_done = 0;
+        pthread_cond_broadcast(&pool->work_cond);
+
+        /* The caller processes bands too, then waits for the workers */
+        while (pool->next_band < pool->num_bands) {
+            band = pool->next_band++;
+            pthread_mutex_unlock(&pool->lock);
+            job->run(job, band * band_rows,
+                     MIN(job->height, (band + 1) * band_rows));
+            pthread_mutex_lock(&pool->lock);
+            pool->bands_done++;
+        }
+        while (pool->bands_done < pool->num_bands)
+            pthread_cond_wait(&pool->done_cond, &pool->lock);
+        pool->job = NULL;
+        pthread_mutex_unlock(&pool->lock);
+        pthread_mutex_unlock(&pool->run_lock);
+    }
+
+    elapsed = get_ticks_nsec() - ticks;
+    __atomic_add_fetch(&pool->num_calls, 1, __ATOMIC_RELAXED);
+    if (num_bands > 1)
+        __atomic_add_fetch(&pool->num_threaded_calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->num_bytes, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->copy_time, elapsed, __ATOMIC_RELAXED);
+
+    D(bug("copy: %llu bytes in %llu usec (%.1f MB/s), %u band(s)%s\n",
+          (unsigned long long)size, (unsigned long long)(elapsed / 1000),
+          elapsed ? 1000.0 * size / elapsed : 0.0, num_bands,
+          job->stream ? ", streaming" : ""));
+}
+
+// Worker thread of the copy engine
+static void *copy_pool_thread(void *arg)
+{
+    ImageCopyPool * const pool = arg;
+    const copy_job_t *job;
+    unsigned int band, band_rows;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->exit && pool->next_band >= pool->num_bands)
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        if (pool->exit)
+            break;
+
+        job       = pool->job;
+        band_rows = pool->band_rows;
+        band      = pool->next_band++;
+        pthread_mutex_unlock(&pool->lock);
+        job->run(job, band * band_rows,
+                 MIN(job->height, (band + 1) * band_rows));
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->bands_done == pool->num_bands)
+            pthread_cond_signal(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Starts the workers, on the first copy large enough to use them
+// (run_lock held)
+static void
+copy_pool_start(ImageCopyPool *pool)
+{
+    unsigned int i = 0;
+
+    pool->threads = calloc(pool->max_threads, sizeof(pool->threads[0]));
+    if (pool->threads) {
+        /* Keep the workers that could be started, if any */
+        for (i = 0; i < pool->max_threads; i++) {
+            if (pthread_create(&pool->threads[i], NULL,
+                               copy_pool_thread, pool) != 0)
+                break;
+        }
+    }
+    pool->num_threads = i;
+    __atomic_store_n(&pool->started, 1, __ATOMIC_RELEASE);
+
+    D(bug("copy engine: %u worker(s), %u bytes threshold, %llu KB LLC\n",
+          pool->num_threads, pool->min_size,
+          (unsigned long long)(pool->llc_size >> 10)));
+}
+
+// Creates a copy engine with up to NUM_THREADS workers
+ImageCopyPool *
+image_copy_pool_new(unsigned int num_threads, unsigned int min_size)
+{
+    ImageCopyPool *pool;
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    pool->min_size    = min_size;
+    pool->llc_size    = get_llc_size();
+    pool->max_threads = num_threads;
+    return pool;
+}
+
+// Stops the workers and destroys the copy engine
+void
+image_copy_pool_free(ImageCopyPool *pool)
+{
+    unsigned int i;
+
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->exit = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->num_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    if (stats_enabled() && pool->num_calls > 0)
+        vdpau_information_message(
+            "copy engine: %llu calls (%llu threaded), %.1f MB at %.1f MB/s\n",
+            (unsigned long long)pool->num_calls,
+            (unsigned long long)pool->num_threaded_calls,
+            pool->num_bytes / (1024.0 * 1024.0),
+            pool->copy_time ? 1000.0 * pool->num_bytes / pool->copy_time : 0.0);
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->run_lock);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+// Copies rows [Y0, Y1) of a plane
+static void
+copy_plane_band(const copy_job_t *job, unsigned int y0, unsigned int y1)
+{
+    uint8_t *dst = job->dst + y0 * job->dst_stride;
+    const uint8_t *src = job->src + y0 * job->src_stride;
+    unsigned int y;
+
+    if (job->dst_stride == job->src_stride && job->width == job->src_stride)
+        copy_row(dst, src, job->width * (y1 - y0), job->stream);
+    else {
+        for (y = y0; y < y1; y++) {
+            copy_row(dst, src, job->width, job->stream);
+            dst += job->dst_stride;
+            src += job->src_stride;
+        }
+    }
+    copy_fence(job->stream);
+}
+
+// Copies HEIGHT rows of ROW_SIZE bytes
+void
+image_copy_plane(
+    ImageCopyPool  *pool,
+    uint8_t        *dst,
+    unsigned int    dst_stride,
+    const uint8_t  *src,
+    unsigned int    src_stride,
+    unsigned int    row_size,
+    unsigned int    height
+)
+{
+    copy_job_t job;
+
+    memset(&job, 0, sizeof(job));
+    job.run        = copy_plane_band;
+    job.height     = height;
+    job.row_align  = 1;
+    job.dst        = dst;
+    job.dst_stride = dst_stride;
+    job.src        = src;
+    job.src_stride = src_stride;
+    job.width      = row_size;
+    copy_job_execute(pool, &job, (uint64_t)row_size * height);
+}
+
+// Swaps the bytes of WIDTH / 2 byte pairs (Cb/Cr <-> Cr/Cb)
+static void
+swap_pairs_row(uint8_t *dst, const uint8_t *src, unsigned int width)
+{
+    unsigned int x = 0;
+
+#ifdef __SSE2__
+    for (; x + 16 <= width; x += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+        _mm_storeu_si128((__m128i *)(dst + x),
+                         _mm_or_si128(_mm_slli_epi16(v, 8),
+                                      _mm_srli_epi16(v, 8)));
+    }
+#endif
+    for (; x + 1 < width; x += 2) {
+        const uint8_t c = src[x];
+        dst[x]     = src[x + 1];
+        dst[x + 1] = c;
+    }
+}
+
+// Widens WIDTH 8-bit samples to little-endian 16-bit samples, keeping
+// the MASK bits
+static void
+widen_row(uint8_t *dst, const uint8_t *src, unsigned int width, uint16_t mask)
+{
+    unsigned int x = 0;
+
+#ifdef __SSE2__
+    const __m128i vmask = _mm_set1_epi16(mask);
+    for (; x + 16 <= width; x += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+        _mm_storeu_si128((__m128i *)(dst + 2 * x),
+                         _mm_and_si128(_mm_unpacklo_epi8(v, v), vmask));
+        _mm_storeu_si128((__m128i *)(dst + 2 * x + 16),
+                         _mm_and_si128(_mm_unpackhi_epi8(v, v), vmask));
+    }
+#endif
+    for (; x < width; x++) {
+        const uint16_t v = ((src[x] << 8) | src[x]) & mask;
+        dst[2 * x]     = v;
+        dst[2 * x + 1] = v >> 8;
+    }
+}
+
+// Narrows WIDTH little-endian 16-bit samples to 8-bit samples
+static void
+narrow_row(uint8_t *dst, const uint8_t *src, unsigned int width)
+{
+    unsigned int x = 0;
+
+#ifdef __SSE2__
+    for (; x + 16 <= width; x += 16) {
+        const __m128i v0 = _mm_loadu_si128((const __m128i *)(src + 2 * x));
+        const __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 2 * x + 16));
+        _mm_storeu_si128((__m128i *)(dst + x),
+                         _mm_packus_epi16(_mm_srli_epi16(v0, 8),
+                                          _mm_srli_epi16(v1, 8)));
+    }
+#endif
+    for (; x < width; x++)
+        dst[x] = src[2 * x + 1];
+}
+
+// Converts rows [Y0, Y1) of an NV12 plane to the image format
+static void
+convert_from_nv12_band(const copy_job_t *job, unsigned int y0, unsigned int y1)
+{
+    uint8_t *dst = job->dst + y0 * job->dst_stride;
+    const uint8_t *src = job->src + y0 * job->src_stride;
+    unsigned int y;
+
+    for (y = y0; y < y1; y++, dst += job->dst_stride, src += job->src_stride) {
+        switch (job->convert) {
+        case IMAGE_CONVERT_NV21:
+            if (job->plane > 0)
+                swap_pairs_row(dst, src, job->width);
+            else
+                copy_row(dst, src, job->width, job->stream);
+            break;
+        case IMAGE_CONVERT_P010:
+            widen_row(dst, src, job->width, 0xffc0);
+            break;
+        case IMAGE_CONVERT_P016:
+            widen_row(dst, src, job->width, 0xffff);
+            break;
+        default:
+            copy_row(dst, src, job->width, job->stream);
+            break;
+        }
+    }
+    copy_fence(job->stream);
+}
+
+// Converts HEIGHT rows of an NV12 plane, WIDTH bytes each, to the image format
+void
+image_convert_from_nv12(
+    ImageCopyPool  *pool,
+    ImageConvert    convert,
+    unsigned int    plane,
+    uint8_t        *dst,
+    unsigned int    dst_stride,
+    const uint8_t  *src,
+    unsigned int    src_stride,
+    unsigned int    width,
+    unsigned int    height
+)
+{
+    copy_job_t job;
+
+    memset(&job, 0, sizeof(job));
+    job.run        = convert_from_nv12_band;
+    job.height     = height;
+    job.row_align  = 1;
+    job.convert    = convert;
+    job.plane      = plane;
+    job.dst        = dst;
+    job.dst_stride = dst_stride;
+    job.src        = src;
+    job.src_stride = src_stride;
+    job.width      = width;
+    copy_job_execute(pool, &job,
+                     (uint64_t)width * image_convert_scale(convert) * height);
+}
+
+// Converts rows [Y0, Y1) of an image plane to NV12
+static void
+convert_to_nv12_band(const copy_job_t *job, unsigned int y0, unsigned int y1)
+{
+    uint8_t *dst = job->dst + y0 * job->dst_stride;
+    const uint8_t *src = job->src + y0 * job->src_stride;
+    unsigned int y;
+
+    for (y = y0; y < y1; y++, dst += job->dst_stride, src += job->src_stride) {
+        switch (job->convert) {
+        case IMAGE_CONVERT_NV21:
+            if (job->plane > 0)
+                swap_pairs_row(dst, src, job->width);
+            else
+                copy_row(dst, src, job->width, job->stream);
+            break;
+        case IMAGE_CONVERT_P010:
+        case IMAGE_CONVERT_P016:
+            narrow_row(dst, src, job->width);
+            break;
+        default:
+            copy_row(dst, src, job->width, job->stream);
+            break;
+        }
+    }
+    copy_fence(job->stream);
+}
+
+// Converts HEIGHT rows of an image plane to NV12, WIDTH bytes each
+void
+image_convert_to_nv12(
+    ImageCopyPool  *pool,
+    ImageConvert    convert,
+    unsigned int    plane,
+    uint8_t        *dst,
+    unsigned int    dst_stride,
+    const uint8_t  *src,
+    unsigned int    src_stride,
+    unsigned int    width,
+    unsigned int    height
+)
+{
+    copy_job_t job;
+
+    memset(&job, 0, sizeof(job));
+    job.run        = convert_to_nv12_band;
+    job.height     = height;
+    job.row_align  = 1;
+    job.convert    = convert;
+    job.plane      = plane;
+    job.dst        = dst;
+    job.dst_stride = dst_stride;
+    job.src        = src;
+    job.src_stride = src_stride;
+    job.width      = width;
+    copy_job_execute(pool, &job, (uint64_t)width * height);
+}
+
+#ifdef __SSE2__
+// Returns the coefficients C[] at the R, G and B byte offsets of two pixels
+static inline __m128i
+get_rgb_weights(const uint8_t rgb_offsets[3], const int c[3])
+{
+    int16_t w[4] = { 0, 0, 0, 0 };
+    unsigned int i;
+
+    for (i = 0; i < 3; i++)
+        w[rgb_offsets[i]] = c[i];
+    return _mm_set_epi16(w[3], w[2], w[1], w[0], w[3], w[2], w[1], w[0]);
+}
+
+// Adds adjacent 32-bit pairs: [a0+a1, a2+a3, b0+b1, b2+b3]
+static inline __m128i
+add_pairs_epi32(__m128i a, __m128i b)
+{
+    const __m128i t0 = _mm_unpacklo_epi32(a, b);
+    const __m128i t1 = _mm_unpackhi_epi32(a, b);
+    return _mm_add_epi32(_mm_unpacklo_epi32(t0, t1),
+                         _mm_unpackhi_epi32(t0, t1));
+}
+#endif
+
+// Converts a row of pixels to luma
+static void
+rgb32_to_y_row(
+    uint8_t                    *dst,
+    const uint8_t              *src,
+    const uint8_t               rgb_offsets[3],
+    unsigned int                width,
+    const rgb_to_yuv_coeffs_t  *c
+)
+{
+    const unsigned int r = rgb_offsets[0];
+    const unsigned int g = rgb_offsets[1];
+    const unsigned int b = rgb_offsets[2];
+    unsigned int x = 0;
+
+#ifdef __SSE2__
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i wy    = get_rgb_weights(rgb_offsets, c->y);
+    const __m128i round = _mm_set1_epi32(128);
+    for (; x + 8 <= width; x += 8, src += 32) {
+        const __m128i v0 = _mm_loadu_si128((const __m128i *)src);
+        const __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 16));
+        __m128i y0 = add_pairs_epi32(
+            _mm_madd_epi16(_mm_unpacklo_epi8(v0, zero), wy),
+            _mm_madd_epi16(_mm_unpackhi_epi8(v0, zero), wy));
+        __m128i y1 = add_pairs_epi32(
+            _mm_madd_epi16(_mm_unpacklo_epi8(v1, zero), wy),
+            _mm_madd_epi16(_mm_unpackhi_epi8(v1, zero), wy));
+        y0 = _mm_srai_epi32(_mm_add_epi32(y0, round), 8);
+        y1 = _mm_srai_epi32(_mm_add_epi32(y1, round), 8);
+        const __m128i y = _mm_add_epi16(_mm_packs_epi32(y0, y1),
+                                        _mm_set1_epi16(16));
+        _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(y, y));
+    }
+#endif
+    for (; x < width; x++, src += 4)
+        dst[x] = ((c->y[0] * src[r] + c->y[1] * src[g] + c->y[2] * src[b] +
+                   128) >> 8) + 16;
+}
+
+// Converts two rows of pixels to chroma, from the average of each 2x2
+// block. An odd last column is replicated
+static void
+rgb32_to_cbcr_row(
+    uint8_t                    *cb,
+    uint8_t                    *cr,
+    unsigned int                chroma_step,
+    const uint8_t              *row0,
+    const uint8_t              *row1,
+    const uint8_t               rgb_offsets[3],
+    unsigned int                width,
+    const rgb_to_yuv_coeffs_t  *c
+)
+{
+    unsigned int x = 0, i, k;
+
+#ifdef __SSE2__
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i wcb   = get_rgb_weights(rgb_offsets, c->cb);
+    const __m128i wcr   = get_rgb_weights(rgb_offsets, c->cr);
+    const __m128i round = _mm_set1_epi32(128);
+    for (; x + 8 <= width; x += 8) {
+        __m128i avg[2];
+
+        /* Average of 2x2 blocks, two blocks per vector */
+        for (i = 0; i < 2; i++) {
+            const __m128i v0 = _mm_loadu_si128((const __m128i *)(row0 + 4 * x + 16 * i));
+            const __m128i v1 = _mm_loadu_si128((const __m128i *)(row1 + 4 * x + 16 * i));
+            const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(v0, zero),
+                                             _mm_unpacklo_epi8(v1, zero));
+            const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(v0, zero),
+                                             _mm_unpackhi_epi8(v1, zero));
+            const __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi),
+                                              _mm_unpackhi_epi64(lo, hi));
+            avg[i] = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+        }
+
+        __m128i vcb = add_pairs_epi32(_mm_madd_epi16(avg[0], wcb),
+                                      _mm_madd_epi16(avg[1], wcb));
+        __m128i vcr = add_pairs_epi32(_mm_madd_epi16(avg[0], wcr),
+                                      _mm_madd_epi16(avg[1], wcr));
+        vcb = _mm_srai_epi32(_mm_add_epi32(vcb, round), 8);
+        vcr = _mm_srai_epi32(_mm_add_epi32(vcr, round), 8);
+        const __m128i cbcr = _mm_add_epi16(_mm_packs_epi32(vcb, vcr),
+                                           _mm_set1_epi16(128));
+
+        if (chroma_step == 2 && cr == cb + 1) {
+            const __m128i v = _mm_unpacklo_epi16(cbcr, _mm_srli_si128(cbcr, 8));
+            _mm_storel_epi64((__m128i *)(cb + x), _mm_packus_epi16(v, v));
+        }
+        else {
+            uint8_t bytes[16];
+            _mm_storeu_si128((__m128i *)bytes, _mm_packus_epi16(cbcr, cbcr));
+            for (i = 0; i < 4; i++) {
+                cb[(x / 2 + i) * chroma_step] = bytes[i];
+                cr[(x / 2 + i) * chroma_step] = bytes[4 + i];
+            }
+        }
+    }
+#endif
+    for (; x < width; x += 2) {
+        const unsigned int x1 = x + 1 < width ? x + 1 : x;
+        int rgb[3];
+
+        for (i = 0; i < 3; i++) {
+            k = rgb_offsets[i];
+            rgb[i] = (row0[4 * x + k] + row0[4 * x1 + k] +
+                      row1[4 * x + k] + row1[4 * x1 + k] + 2) >> 2;
+        }
+        cb[(x / 2) * chroma_step] =
+            ((c->cb[0] * rgb[0] + c->cb[1] * rgb[1] + c->cb[2] * rgb[2] +
+              128) >> 8) + 128;
+        cr[(x / 2) * chroma_step] =
+            ((c->cr[0] * rgb[0] + c->cr[1] * rgb[1] + c->cr[2] * rgb[2] +
+              128) >> 8) + 128;
+    }
+}
+
+// Converts rows [Y0, Y1) of RGB pixels to 4:2:0 YCbCr, Y0 being even
+static void
+rgb32_to_yuv420_band(const copy_job_t *job, unsigned int y0, unsigned int y1)
+{
+    unsigned int y;
+
+    for (y = y0; y < y1; y++)
+        rgb32_to_y_row(job->dst + y * job->dst_stride,
+                       job->src + y * job->src_stride,
+                       job->rgb_offsets, job->width, job->coeffs);
+
+    /* Odd edges replicate the last row */
+    for (y = y0; y < y1; y += 2) {
+        const uint8_t * const row0 = job->src + y * job->src_stride;
+        const uint8_t * const row1 =
+            y + 1 < job->height ? row0 + job->src_stride : row0;
+
+        rgb32_to_cbcr_row(job->dst_cb + (y / 2) * job->dst_c_stride,
+                          job->dst_cr + (y / 2) * job->dst_c_stride,
+                          job->chroma_step, row0, row1,
+                          job->rgb_offsets, job->width, job->coeffs);
+    }
+}
+
+// Converts WIDTH x HEIGHT 32-bit RGB pixels to 4:2:0 YCbCr (studio range)
+void
+image_rgb32_to_yuv420(
+    ImageCopyPool  *pool,
+    uint8_t        *dst_y,
+    unsigned int    dst_y_stride,
+    uint8_t        *dst_cb,
+    uint8_t        *dst_cr,
+    unsigned int    dst_c_stride,
+    unsigned int    chroma_step,
+    const uint8_t  *src,
+    unsigned int    src_stride,
+    const uint8_t   rgb_offsets[3],
+    unsigned int    width,
+    unsigned int    height,
+    ImageColorspace colorspace
+)
+{
+    copy_job_t job;
+
+    memset(&job, 0, sizeof(job));
+    job.run          = rgb32_to_yuv420_band;
+    job.height       = height;
+    job.row_align    = 2;
+    job.dst          = dst_y;
+    job.dst_stride   = dst_y_stride;
+    job.src          = src;
+    job.src_stride   = src_stride;
+    job.width        = width;
+    job.dst_cb       = dst_cb;
+    job.dst_cr       = dst_cr;
+    job.dst_c_stride = dst_c_stride;
+    job.chroma_step  = chroma_step;
+    job.rgb_offsets  = rgb_offsets;
+    job.coeffs       = &rgb_to_yuv_coeffs[colorspace];
+    copy_job_execute(pool, &job, (uint64_t)width * height * 3 / 2);
+}
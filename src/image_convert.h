@@ -0,0 +1,122 @@
+/*
+ *  image_convert.h - Pixel copy and format conversion
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#ifndef IMAGE_CONVERT_H
+#define IMAGE_CONVERT_H
+
+typedef enum {
+    IMAGE_COLORSPACE_BT601 = 0,
+    IMAGE_COLORSPACE_BT709
+} ImageColorspace;
+
+// Conversions between NV12 and image formats VDPAU does not handle
+typedef enum {
+    IMAGE_CONVERT_NONE = 0,
+    IMAGE_CONVERT_NV21,         // Cr/Cb swapped
+    IMAGE_CONVERT_P010,         // 16-bit samples, 10 significant bits
+    IMAGE_CONVERT_P016          // 16-bit samples
+} ImageConvert;
+
+// Returns the number of image bytes per NV12 byte
+static inline unsigned int
+image_convert_scale(ImageConvert convert)
+{
+    return (convert == IMAGE_CONVERT_P010 ||
+            convert == IMAGE_CONVERT_P016) ? 2 : 1;
+}
+
+// Copy engine: large copies and conversions are split into bands of rows
+// processed by a fixed set of worker threads. A NULL pool runs everything
+// on the calling thread
+typedef struct image_copy_pool ImageCopyPool;
+
+// Creates a copy engine with NUM_THREADS workers, used for copies of at
+// least MIN_SIZE bytes. The workers are started on the first such copy
+ImageCopyPool *
+image_copy_pool_new(unsigned int num_threads, unsigned int min_size)
+    attribute_hidden;
+
+// Stops the workers and destroys the copy engine
+void
+image_copy_pool_free(ImageCopyPool *pool)
+    attribute_hidden;
+
+// Copies HEIGHT rows of ROW_SIZE bytes
+void
+image_copy_plane(
+    ImageCopyPool  *pool,
+    uint8_t        *dst,
+    unsigned int    dst_stride,
+    const uint8_t  *src,
+    unsigned int    src_stride,
+    unsigned int    row_size,
+    unsigned int    height
+) attribute_hidden;
+
+// Converts HEIGHT rows of an NV12 plane, WIDTH bytes each, to the image
+// format. PLANE is 0 for luma and 1 for interleaved chroma
+void
+image_convert_from_nv12(
+    ImageCopyPool  *pool,
+    ImageConvert    convert,
+    unsigned int    plane,
+    uint8_t        *dst,
+    unsigned int    dst_stride,
+    const uint8_t  *src,
+    unsigned int    src_stride,
+    unsigned int    width,
+    unsigned int    height
+) attribute_hidden;
+
+// Converts HEIGHT rows of an image plane to NV12, WIDTH bytes each
+void
+image_convert_to_nv12(
+    ImageCopyPool  *pool,
+    ImageConvert    convert,
+    unsigned int    plane,
+    uint8_t        *dst,
+    unsigned int    dst_stride,
+    const uint8_t  *src,
+    unsigned int    src_stride,
+    unsigned int    width,
+    unsigned int    height
+) attribute_hidden;
+
+// Converts WIDTH x HEIGHT 32-bit RGB pixels to 4:2:0 YCbCr (studio range).
+// RGB_OFFSETS are the byte offsets of R, G and B within a pixel. Chroma
+// samples are CHROMA_STEP bytes apart (2 for interleaved Cb/Cr)
+void
+image_rgb32_to_yuv420(
+    ImageCopyPool  *pool,
+    uint8_t        *dst_y,
+    unsigned int    dst_y_stride,
+    uint8_t        *dst_cb,
+    uint8_t        *dst_cr,
+    unsigned int    dst_c_stride,
+    unsigned int    chroma_step,
+    const uint8_t  *src,
+    unsigned int    src_stride,
+    const uint8_t   rgb_offsets[3],
+    unsigned int    width,
+    unsigned int    height,
+    ImageColorspace colorspace
+) attribute_hidden;
+
+#endif /* IMAGE_CONVERT_H */
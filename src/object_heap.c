@@ -49,6 +49,20 @@
 #define LAST_FREE   -1
 #define ALLOCATED   -2
 
+/*
+ * Bucket K holds (heap_increment << K) objects, so that the heap grows
+ * geometrically and the bucket array never needs to be reallocated
+ */
+static inline object_base_p
+object_heap_get_object(object_heap_p heap, void * const *bucket, int index)
+{
+    const int n = index / heap->heap_increment + 1;
+    const int bucket_index = 31 - __builtin_clz(n);
+    const int obj_index = index - heap->heap_increment * ((1 << bucket_index) - 1);
+
+    return (object_base_p)(bucket[bucket_index] + obj_index * heap->object_size);
+}
+
 /*
  * Expands the heap
  * Return 0 on success, -1 on error
@@ -59,37 +73,35 @@ object_heap_expand(object_heap_p heap)
     int i;
     void *new_heap_index;
     int next_free;
-    int new_heap_size = heap->heap_size + heap->heap_increment;
-    int bucket_index = new_heap_size / heap->heap_increment - 1;
-
-    if (bucket_index >= heap->num_buckets) {
-        int new_num_buckets = heap->num_buckets + 8;
-        void **new_bucket;
+    int bucket_index = heap->num_buckets;
+    int bucket_size = heap->heap_increment << bucket_index;
+    int new_heap_size = heap->heap_size + bucket_size;
 
-        new_bucket = realloc(heap->bucket, new_num_buckets * sizeof(void *));
-        if (NULL == new_bucket) {
-            return -1;
-        }
-
-        heap->num_buckets = new_num_buckets;
-        heap->bucket = new_bucket;
+    if (bucket_index >= OBJECT_HEAP_MAX_BUCKETS ||
+        new_heap_size > OBJECT_HEAP_INDEX_MASK + 1) {
+        return -1; /* Out of object IDs */
     }
 
-    new_heap_index = (void *) malloc(heap->heap_increment * heap->object_size);
+    new_heap_index = (void *) malloc(bucket_size * heap->object_size);
     if (NULL == new_heap_index) {
         return -1; /* Out of memory */
     }
 
     heap->bucket[bucket_index] = new_heap_index;
+    heap->num_buckets++;
     next_free = heap->next_free;
     for (i = new_heap_size; i-- > heap->heap_size;) {
         object_base_p obj = (object_base_p)(new_heap_index + (i - heap->heap_size) * heap->object_size);
         obj->id = i + heap->id_offset;
         obj->next_free = next_free;
+        obj->prev_live = NULL;
+        obj->next_live = NULL;
         next_free = i;
     }
     heap->next_free = next_free;
-    heap->heap_size = new_heap_size;
+
+    /* Publish the new objects to lock-free readers last */
+    __atomic_store_n(&heap->heap_size, new_heap_size, __ATOMIC_RELEASE);
     return 0; /* Success */
 }
 
@@ -106,7 +118,8 @@ object_heap_init(object_heap_p heap, int object_size, int id_offset)
     heap->heap_increment = 16;
     heap->next_free = LAST_FREE;
     heap->num_buckets = 0;
-    heap->bucket = NULL;
+    memset(heap->bucket, 0, sizeof(heap->bucket));
+    heap->live_objects = NULL;
     return object_heap_expand(heap);
 }
 
@@ -118,7 +131,6 @@ static int
 object_heap_allocate_unlocked(object_heap_p heap)
 {
     object_base_p obj;
-    int bucket_index, obj_index;
 
     if (LAST_FREE == heap->next_free) {
         if (-1 == object_heap_expand(heap)) {
@@ -127,12 +139,18 @@ object_heap_allocate_unlocked(object_heap_p heap)
     }
     ASSERT(heap->next_free >= 0);
 
-    bucket_index = heap->next_free / heap->heap_increment;
-    obj_index = heap->next_free % heap->heap_increment;
-
-    obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
+    obj = object_heap_get_object(heap, heap->bucket, heap->next_free);
     heap->next_free = obj->next_free;
-    obj->next_free = ALLOCATED;
+
+    /* Link into the live objects list */
+    obj->prev_live = NULL;
+    obj->next_live = heap->live_objects;
+    if (heap->live_objects) {
+        heap->live_objects->prev_live = obj;
+    }
+    heap->live_objects = obj;
+
+    __atomic_store_n(&obj->next_free, ALLOCATED, __ATOMIC_RELEASE);
     return obj->id;
 }
 
@@ -150,36 +168,30 @@ object_heap_allocate(object_heap_p heap)
 /*
  * Lookup an object by object ID
  * Returns a pointer to the object on success, returns NULL on error
+ * This is lock-free: buckets are filled in before the heap size is
+ * published, and are never moved
  */
-static object_base_p
-object_heap_lookup_unlocked(object_heap_p heap, int id)
+object_base_p
+object_heap_lookup(object_heap_p heap, int id)
 {
     object_base_p obj;
-    int bucket_index, obj_index;
+    int heap_size;
 
-    if ((id < heap->id_offset) || (id > (heap->heap_size + heap->id_offset))) {
+    heap_size = __atomic_load_n(&heap->heap_size, __ATOMIC_ACQUIRE);
+    if ((id & OBJECT_HEAP_OFFSET_MASK) != heap->id_offset ||
+        (id & OBJECT_HEAP_INDEX_MASK) >= heap_size) {
         return NULL;
     }
-    id &= OBJECT_HEAP_ID_MASK;
-    bucket_index = id / heap->heap_increment;
-    obj_index = id % heap->heap_increment;
-    obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
+    obj = object_heap_get_object(heap, heap->bucket, id & OBJECT_HEAP_INDEX_MASK);
 
-    /* Check if the object has in fact been allocated */
-    if (obj->next_free != ALLOCATED) {
+    /* Check if the object has in fact been allocated. The ID is loaded
+       last: a slot reallocated meanwhile has a new generation */
+    if (__atomic_load_n(&obj->next_free, __ATOMIC_ACQUIRE) != ALLOCATED) {
         return NULL;
     }
-    return obj;
-}
-
-object_base_p
-object_heap_lookup(object_heap_p heap, int id)
-{
-    object_base_p obj;
-
-    pthread_mutex_lock(&heap->mutex);
-    obj = object_heap_lookup_unlocked(heap, id);
-    pthread_mutex_unlock(&heap->mutex);
+    if (__atomic_load_n(&obj->id, __ATOMIC_ACQUIRE) != id) {
+        return NULL; /* Stale ID */
+    }
     return obj;
 }
 
@@ -190,44 +202,32 @@ object_heap_lookup(object_heap_p heap, int id)
 object_base_p
 object_heap_first(object_heap_p heap, object_heap_iterator *iter)
 {
-    *iter = -1;
-    return object_heap_next(heap, iter);
+    object_base_p obj;
+
+    pthread_mutex_lock(&heap->mutex);
+    obj = heap->live_objects;
+    pthread_mutex_unlock(&heap->mutex);
+    *iter = obj;
+    return obj;
 }
 
 /*
  * Iterate over all objects in the heap.
  * Returns a pointer to the next object on the heap, returns NULL if heap is empty.
+ * NOTE: freed objects keep their link to the next object, so the object
+ * last returned may be freed before this function is called
  */
-static object_base_p
-object_heap_next_unlocked(object_heap_p heap, object_heap_iterator *iter)
-{
-    object_base_p obj;
-    int bucket_index, obj_index;
-    int i = *iter + 1;
-
-    while (i < heap->heap_size) {
-        bucket_index = i / heap->heap_increment;
-        obj_index = i % heap->heap_increment;
-
-        obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
-        if (obj->next_free == ALLOCATED) {
-            *iter = i;
-            return obj;
-        }
-        i++;
-    }
-    *iter = i;
-    return NULL;
-}
-
 object_base_p
 object_heap_next(object_heap_p heap, object_heap_iterator *iter)
 {
-    object_base_p obj;
+    object_base_p obj = *iter;
 
     pthread_mutex_lock(&heap->mutex);
-    obj = object_heap_next_unlocked(heap, iter);
+    do {
+        obj = obj ? obj->next_live : NULL;
+    } while (obj && obj->next_free != ALLOCATED);
     pthread_mutex_unlock(&heap->mutex);
+    *iter = obj;
     return obj;
 }
 
@@ -240,8 +240,22 @@ object_heap_free_unlocked(object_heap_p heap, object_base_p obj)
     /* Check if the object has in fact been allocated */
     ASSERT(obj->next_free == ALLOCATED);
 
-    obj->next_free = heap->next_free;
-    heap->next_free = obj->id & OBJECT_HEAP_ID_MASK;
+    /* Unlink from the live objects list, keeping next_live for iterators */
+    if (obj->prev_live) {
+        obj->prev_live->next_live = obj->next_live;
+    } else {
+        heap->live_objects = obj->next_live;
+    }
+    if (obj->next_live) {
+        obj->next_live->prev_live = obj->prev_live;
+    }
+
+    /* Bump the generation so that the freed ID becomes stale */
+    const int gen = ((obj->id >> OBJECT_HEAP_GEN_SHIFT) + 1) << OBJECT_HEAP_GEN_SHIFT;
+    const int id = (obj->id & ~OBJECT_HEAP_GEN_MASK) | (gen & OBJECT_HEAP_GEN_MASK);
+    __atomic_store_n(&obj->id, id, __ATOMIC_RELEASE);
+    __atomic_store_n(&obj->next_free, heap->next_free, __ATOMIC_RELEASE);
+    heap->next_free = id & OBJECT_HEAP_INDEX_MASK;
 }
 
 void
@@ -260,28 +274,20 @@ object_heap_free(object_heap_p heap, object_base_p obj)
 void
 object_heap_destroy(object_heap_p heap)
 {
-    object_base_p obj;
-    int bucket_index, obj_index, i;
+    int i;
 
     /* Check if heap is empty */
-    for (i = 0; i < heap->heap_size; i++) {
-        /* Check if object is not still allocated */
-        bucket_index = i / heap->heap_increment;
-        obj_index = i % heap->heap_increment;
-        obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
-        ASSERT(obj->next_free != ALLOCATED);
-    }
+    ASSERT(heap->live_objects == NULL);
 
-    if (heap->bucket) {
-        for (i = 0; i < heap->heap_size / heap->heap_increment; i++) {
-            free(heap->bucket[i]);
-        }
+    for (i = 0; i < heap->num_buckets; i++) {
+        free(heap->bucket[i]);
+        heap->bucket[i] = NULL;
     }
 
     pthread_mutex_destroy(&heap->mutex);
 
-    free(heap->bucket);
-    heap->bucket = NULL;
+    heap->num_buckets = 0;
     heap->heap_size = 0;
     heap->next_free = LAST_FREE;
+    heap->live_objects = NULL;
 }
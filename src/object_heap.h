@@ -21,8 +21,18 @@
 #ifndef VA_OBJECT_HEAP_H
 #define VA_OBJECT_HEAP_H
 
+/*
+ * Object IDs are made of the heap offset, a per-slot generation counter
+ * that is bumped when the object is freed, and the slot index. So, stale
+ * IDs of freed objects do not resolve to objects reusing the slot
+ */
 #define OBJECT_HEAP_OFFSET_MASK 0x7f000000
 #define OBJECT_HEAP_ID_MASK     0x00ffffff
+#define OBJECT_HEAP_GEN_MASK    0x00ff0000
+#define OBJECT_HEAP_GEN_SHIFT   16
+#define OBJECT_HEAP_INDEX_MASK  0x0000ffff
+
+#define OBJECT_HEAP_MAX_BUCKETS 16
 
 typedef struct object_base *object_base_p;
 typedef struct object_heap *object_heap_p;
@@ -30,8 +40,16 @@ typedef struct object_heap *object_heap_p;
 struct object_base {
     int id;
     int next_free;
+    object_base_p prev_live;
+    object_base_p next_live;
 };
 
+/*
+ * Lookups are lock-free: buckets are never moved, and the heap size is
+ * published with release semantics once new buckets are filled in.
+ * Allocation, free and iteration hold the mutex. Allocated objects are
+ * chained so that iteration only visits live objects.
+ */
 struct object_heap {
     pthread_mutex_t mutex;
     int object_size;
@@ -39,11 +57,12 @@ struct object_heap {
     int next_free;
     int heap_size;
     int heap_increment;
-    void **bucket;
+    void *bucket[OBJECT_HEAP_MAX_BUCKETS];
     int num_buckets;
+    object_base_p live_objects;
 };
 
-typedef int object_heap_iterator;
+typedef object_base_p object_heap_iterator;
 
 /*
  * Return 0 on success, -1 on error
@@ -20,32 +20,127 @@
 
 #include "sysdeps.h"
 #include "uasyncqueue.h"
-#include "uqueue.h"
 #include <pthread.h>
+#include <limits.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+/* Bounded multi-producer/single-consumer ring. Producers claim slots
+   by advancing push_pos, then publish each slot through its sequence
+   number. The single consumer owns pop_pos. Threads only sleep when
+   the ring is empty (consumer) or full (producers) */
+
+#define ASYNC_QUEUE_DEFAULT_SIZE 256
+#define CACHE_LINE_SIZE          64
+
+typedef struct {
+    unsigned int        seq;
+    void               *data;
+} UAsyncQueueCell;
 
 struct _UAsyncQueue {
-    UQueue             *queue;
-    pthread_mutex_t     mutex;
-    pthread_cond_t      cond;
-    unsigned int        is_waiting;
+    UAsyncQueueCell    *cells;
+    unsigned int        mask;
+    unsigned int        push_pos        __attribute__((aligned(CACHE_LINE_SIZE)));
+    unsigned int        pop_pos         __attribute__((aligned(CACHE_LINE_SIZE)));
+    unsigned int        pop_wake        __attribute__((aligned(CACHE_LINE_SIZE)));
+    unsigned int        pop_waiting;
+    unsigned int        push_wake       __attribute__((aligned(CACHE_LINE_SIZE)));
+    unsigned int        push_waiting;
 };
 
+#ifdef __linux__
+// Waits for *addr to change from val, or until end_time (usec, realtime)
+static void futex_wait(unsigned int *addr, unsigned int val, uint64_t end_time)
+{
+    struct timespec timeout, *ptimeout = NULL;
+
+    if (end_time) {
+        timeout.tv_sec  = end_time / 1000000;
+        timeout.tv_nsec = 1000 * (end_time % 1000000);
+        ptimeout        = &timeout;
+    }
+    syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE|FUTEX_CLOCK_REALTIME,
+            val, ptimeout, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+// Wakes up all threads waiting on addr
+static void futex_wake(unsigned int *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#else
+static pthread_mutex_t g_futex_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_futex_cond = PTHREAD_COND_INITIALIZER;
+
+static void futex_wait(unsigned int *addr, unsigned int val, uint64_t end_time)
+{
+    pthread_mutex_lock(&g_futex_lock);
+    if (__atomic_load_n(addr, __ATOMIC_SEQ_CST) == val) {
+        if (!end_time)
+            pthread_cond_wait(&g_futex_cond, &g_futex_lock);
+        else {
+            struct timespec timeout;
+            timeout.tv_sec  = end_time / 1000000;
+            timeout.tv_nsec = 1000 * (end_time % 1000000);
+            pthread_cond_timedwait(&g_futex_cond, &g_futex_lock, &timeout);
+        }
+    }
+    pthread_mutex_unlock(&g_futex_lock);
+}
+
+static void futex_wake(unsigned int *addr)
+{
+    pthread_mutex_lock(&g_futex_lock);
+    pthread_cond_broadcast(&g_futex_cond);
+    pthread_mutex_unlock(&g_futex_lock);
+}
+#endif
+
+// Returns the current realtime clock in microseconds
+static uint64_t get_realtime_usec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
 UAsyncQueue *async_queue_new(void)
 {
-    UAsyncQueue *queue = malloc(sizeof(*queue));
+    return async_queue_new_sized(ASYNC_QUEUE_DEFAULT_SIZE);
+}
 
-    if (!queue)
+UAsyncQueue *async_queue_new_sized(unsigned int size)
+{
+    UAsyncQueue *queue;
+    unsigned int i, capacity;
+
+    if (size == 0 || size > (UINT_MAX >> 2))
         return NULL;
 
-    queue->queue = queue_new();
-    if (!queue->queue)
-        goto error;
+    capacity = 1;
+    while (capacity < size)
+        capacity <<= 1;
 
-    if (pthread_cond_init(&queue->cond, NULL) != 0)
+    if (posix_memalign((void **)&queue, CACHE_LINE_SIZE, sizeof(*queue)) != 0)
+        return NULL;
+    memset(queue, 0, sizeof(*queue));
+
+    queue->cells = malloc(capacity * sizeof(queue->cells[0]));
+    if (!queue->cells)
         goto error;
 
-    pthread_mutex_init(&queue->mutex, NULL);
-    queue->is_waiting = 0;
+    /* Slot i is published for position p once its seq is p + 1 */
+    for (i = 0; i < capacity; i++) {
+        queue->cells[i].seq  = i;
+        queue->cells[i].data = NULL;
+    }
+    queue->mask = capacity - 1;
     return queue;
 
 error:
@@ -58,65 +153,157 @@ void async_queue_free(UAsyncQueue *queue)
     if (!queue)
         return;
 
-    pthread_mutex_unlock(&queue->mutex);
-    queue_free(queue->queue);
+    free(queue->cells);
     free(queue);
 }
 
 int async_queue_is_empty(UAsyncQueue *queue)
 {
-    return queue && queue_is_empty(queue->queue);
+    return queue && (__atomic_load_n(&queue->push_pos, __ATOMIC_ACQUIRE) ==
+                     __atomic_load_n(&queue->pop_pos, __ATOMIC_ACQUIRE));
 }
 
-static UAsyncQueue *async_queue_push_unlocked(UAsyncQueue *queue, void *data)
+static inline int async_queue_is_full(UAsyncQueue *queue)
 {
-    queue_push(queue->queue, data);
-    if (queue->is_waiting)
-        pthread_cond_signal(&queue->cond);
-    return queue;
+    return (__atomic_load_n(&queue->push_pos, __ATOMIC_SEQ_CST) -
+            __atomic_load_n(&queue->pop_pos, __ATOMIC_SEQ_CST)) > queue->mask;
 }
 
-UAsyncQueue *async_queue_push(UAsyncQueue *queue, void *data)
+// Claims up to count slots, returns the number of slots claimed at *ppos
+static unsigned int
+async_queue_claim(UAsyncQueue *queue, unsigned int count, unsigned int *ppos)
 {
+    unsigned int pos, n;
+
+    pos = __atomic_load_n(&queue->push_pos, __ATOMIC_RELAXED);
+    do {
+        const unsigned int used =
+            pos - __atomic_load_n(&queue->pop_pos, __ATOMIC_ACQUIRE);
+        n = queue->mask + 1 - used;
+        if (n == 0)
+            return 0;
+        if (n > count)
+            n = count;
+    } while (!__atomic_compare_exchange_n(&queue->push_pos, &pos, pos + n, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    *ppos = pos;
+    return n;
+}
+
+unsigned int
+async_queue_push_many(UAsyncQueue *queue, void **data, unsigned int count)
+{
+    unsigned int i, n, pos, done = 0;
+
     if (!queue)
-        return NULL;
+        return 0;
+
+    while (done < count) {
+        const unsigned int wake =
+            __atomic_load_n(&queue->push_wake, __ATOMIC_SEQ_CST);
 
-    pthread_mutex_lock(&queue->mutex);
-    async_queue_push_unlocked(queue, data);
-    pthread_mutex_unlock(&queue->mutex);
+        n = async_queue_claim(queue, count - done, &pos);
+        if (n == 0) {
+            /* Ring is full: sleep until the consumer frees slots */
+            __atomic_add_fetch(&queue->push_waiting, 1, __ATOMIC_SEQ_CST);
+            if (async_queue_is_full(queue))
+                futex_wait(&queue->push_wake, wake, 0);
+            __atomic_sub_fetch(&queue->push_waiting, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        for (i = 0; i < n; i++) {
+            UAsyncQueueCell * const cell = &queue->cells[(pos + i) & queue->mask];
+            cell->data = data[done + i];
+            __atomic_store_n(&cell->seq, pos + i + 1, __ATOMIC_SEQ_CST);
+        }
+        done += n;
+
+        /* Only the first producer to see the consumer asleep wakes it */
+        if (__atomic_load_n(&queue->pop_waiting, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&queue->pop_waiting, 0, __ATOMIC_SEQ_CST)) {
+            __atomic_add_fetch(&queue->pop_wake, 1, __ATOMIC_SEQ_CST);
+            futex_wake(&queue->pop_wake);
+        }
+    }
+    return done;
+}
+
+UAsyncQueue *async_queue_push(UAsyncQueue *queue, void *data)
+{
+    if (async_queue_push_many(queue, &data, 1) != 1)
+        return NULL;
     return queue;
 }
 
-static void *
-async_queue_timed_pop_unlocked(UAsyncQueue *queue, uint64_t end_time)
+// Pops up to count published items without blocking
+static unsigned int
+async_queue_try_pop_many(UAsyncQueue *queue, void **data, unsigned int count)
 {
-    if (queue_is_empty(queue->queue)) {
-        assert(!queue->is_waiting);
-        ++queue->is_waiting;
-        if (!end_time)
-            pthread_cond_wait(&queue->cond, &queue->mutex);
-        else {
-            struct timespec timeout;
-            timeout.tv_sec  = end_time / 1000000;
-            timeout.tv_nsec = 1000 * (end_time % 1000000);
-            pthread_cond_timedwait(&queue->cond, &queue->mutex, &timeout);
-        }
-        --queue->is_waiting;
-        if (queue_is_empty(queue->queue))
-            return NULL;
+    const unsigned int pos = queue->pop_pos;
+    unsigned int n;
+
+    for (n = 0; n < count; n++) {
+        UAsyncQueueCell * const cell = &queue->cells[(pos + n) & queue->mask];
+        if (__atomic_load_n(&cell->seq, __ATOMIC_SEQ_CST) != pos + n + 1)
+            break;
+        data[n] = cell->data;
+    }
+    if (n == 0)
+        return 0;
+
+    /* Producers asleep on a full ring are only woken up once it is half
+       empty, rather than for every slot freed. The consumer keeps popping
+       until the ring is empty, so it gets there */
+    __atomic_store_n(&queue->pop_pos, pos + n, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->push_waiting, __ATOMIC_SEQ_CST) &&
+        __atomic_load_n(&queue->push_pos, __ATOMIC_SEQ_CST) - (pos + n) <=
+        (queue->mask + 1) / 2) {
+        __atomic_add_fetch(&queue->push_wake, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&queue->push_wake);
+    }
+    return n;
+}
+
+unsigned int
+async_queue_timed_pop_many(
+    UAsyncQueue        *queue,
+    void              **data,
+    unsigned int        count,
+    uint64_t            end_time
+)
+{
+    unsigned int n;
+
+    if (!queue || count == 0)
+        return 0;
+
+    for (;;) {
+        n = async_queue_try_pop_many(queue, data, count);
+        if (n > 0)
+            return n;
+
+        /* Ring is empty: sleep until a producer publishes an item */
+        const unsigned int wake =
+            __atomic_load_n(&queue->pop_wake, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&queue->pop_waiting, 1, __ATOMIC_SEQ_CST);
+        n = async_queue_try_pop_many(queue, data, count);
+        if (n == 0)
+            futex_wait(&queue->pop_wake, wake, end_time);
+        __atomic_store_n(&queue->pop_waiting, 0, __ATOMIC_SEQ_CST);
+        if (n > 0)
+            return n;
+
+        if (end_time && get_realtime_usec() >= end_time)
+            return async_queue_try_pop_many(queue, data, count);
     }
-    return queue_pop(queue->queue);
 }
 
 void *async_queue_timed_pop(UAsyncQueue *queue, uint64_t end_time)
 {
     void *data;
 
-    if (!queue)
+    if (async_queue_timed_pop_many(queue, &data, 1, end_time) != 1)
         return NULL;
-
-    pthread_mutex_lock(&queue->mutex);
-    data = async_queue_timed_pop_unlocked(queue, end_time);
-    pthread_mutex_unlock(&queue->mutex);
     return data;
 }
@@ -23,9 +23,15 @@
 
 typedef struct _UAsyncQueue UAsyncQueue;
 
+/* Bounded queue with multiple producers and a single consumer.
+   Pushing to a full queue blocks until the consumer pops items */
+
 UAsyncQueue *async_queue_new(void)
     attribute_hidden;
 
+UAsyncQueue *async_queue_new_sized(unsigned int size)
+    attribute_hidden;
+
 void async_queue_free(UAsyncQueue *queue)
     attribute_hidden;
 
@@ -35,10 +41,25 @@ int async_queue_is_empty(UAsyncQueue *queue)
 UAsyncQueue *async_queue_push(UAsyncQueue *queue, void *data)
     attribute_hidden;
 
+unsigned int
+async_queue_push_many(UAsyncQueue *queue, void **data, unsigned int count)
+    attribute_hidden;
+
 void *async_queue_timed_pop(UAsyncQueue *queue, uint64_t end_time)
     attribute_hidden;
 
+unsigned int
+async_queue_timed_pop_many(
+    UAsyncQueue        *queue,
+    void              **data,
+    unsigned int        count,
+    uint64_t            end_time
+) attribute_hidden;
+
 #define async_queue_pop(queue) \
     async_queue_timed_pop(queue, 0)
 
+#define async_queue_pop_many(queue, data, count) \
+    async_queue_timed_pop_many(queue, data, count, 0)
+
 #endif /* UASYNCQUEUE_H */
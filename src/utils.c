@@ -22,6 +22,9 @@
 #include "utils.h"
 #include <time.h>
 #include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define DEBUG 1
 #include "debug.h"
@@ -78,6 +81,18 @@ uint64_t get_ticks_usec(void)
 #endif
 }
 
+// Get current value of monotonic nanosecond timer
+uint64_t get_ticks_nsec(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+#else
+    return get_ticks_usec() * 1000;
+#endif
+}
+
 #if defined(__linux__)
 // Linux select() changes its timeout parameter upon return to contain
 // the remaining time. Most other unixen leave it unchanged or undefined.
@@ -202,3 +217,52 @@ int find_string(const char *name, const char *ext, const char *sep)
     }
     return 0;
 }
+
+// Checks for a 00 00 01 start code at each of the N bytes starting at P
+static inline const uint8_t *
+find_start_code_n(const uint8_t *p, unsigned int n)
+{
+    for (; n > 0; n--, p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+            return p;
+    }
+    return NULL;
+}
+
+// Lookup for the first 00 00 01 start code in [ BUF, END ). Returns END if none
+const uint8_t *find_start_code(const uint8_t *buf, const uint8_t *end)
+{
+    const uint8_t *p = buf, *start_code;
+
+    if (end - buf < 3)
+        return end;
+
+    /* A start code has a zero byte at least at its first two positions,
+       so only the blocks holding a zero byte need a closer look. Stop
+       early enough to have the two bytes following any position */
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; end - p >= 16 + 2; p += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+        while (mask) {
+            const unsigned int i = __builtin_ctz(mask);
+            if (p[i + 1] == 0 && p[i + 2] == 1)
+                return p + i;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; end - p >= 4 + 2; p += 4) {
+        uint32_t x;
+        memcpy(&x, p, sizeof(x));
+        if (((x - 0x01010101) & ~x & 0x80808080) == 0)
+            continue;
+        if ((start_code = find_start_code_n(p, 4)) != NULL)
+            return start_code;
+    }
+
+    start_code = find_start_code_n(p, end - p - 2);
+    return start_code ? start_code : end;
+}
@@ -30,6 +30,9 @@ int getenv_yesno(const char *env, int *pval)
 uint64_t get_ticks_usec(void)
     attribute_hidden;
 
+uint64_t get_ticks_nsec(void)
+    attribute_hidden;
+
 void delay_usec(unsigned int usec)
     attribute_hidden;
 
@@ -44,4 +47,7 @@ realloc_buffer(
 int find_string(const char *name, const char *ext, const char *sep)
     attribute_hidden;
 
+const uint8_t *find_start_code(const uint8_t *buf, const uint8_t *end)
+    attribute_hidden;
+
 #endif /* UTILS_H */
@@ -22,12 +22,131 @@
 #include "vdpau_buffer.h"
 #include "vdpau_driver.h"
 #include "vdpau_video.h"
+#include "vdpau_image.h"
 #include "vdpau_dump.h"
 #include "utils.h"
+#include <pthread.h>
 
 #define DEBUG 1
 #include "debug.h"
 
+#define BUFFER_POOL_MIN_SIZE_LOG2       6
+#define BUFFER_POOL_SIZE_MAX_DEFAULT    (16 << 20)
+
+// Returns the maximum number of bytes retained by the buffer pool
+static unsigned int get_buffer_pool_size_max(void)
+{
+    static int g_buffer_pool_size = -1;
+    if (g_buffer_pool_size < 0) {
+        if (getenv_int("VDPAU_VIDEO_BUFFER_POOL_SIZE", &g_buffer_pool_size) < 0 ||
+            g_buffer_pool_size < 0)
+            g_buffer_pool_size = BUFFER_POOL_SIZE_MAX_DEFAULT;
+    }
+    return g_buffer_pool_size;
+}
+
+// Returns the size class for a block of SIZE bytes, or -1 if it is not pooled
+static int get_buffer_pool_class(unsigned int size)
+{
+    unsigned int class_size = 1U << BUFFER_POOL_MIN_SIZE_LOG2;
+    int i;
+
+    for (i = 0; i < VDPAU_BUFFER_POOL_CLASSES; i++, class_size <<= 1) {
+        if (size <= class_size)
+            return i;
+    }
+    return -1;
+}
+
+// Initialize buffer pool
+void
+buffer_pool_init(vdpau_driver_data_t *driver_data)
+{
+    vdpau_buffer_pool_t * const pool = &driver_data->buffer_pool;
+
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->size_max = get_buffer_pool_size_max();
+}
+
+// Release all blocks retained by the buffer pool
+void
+buffer_pool_destroy(vdpau_driver_data_t *driver_data)
+{
+    vdpau_buffer_pool_t * const pool = &driver_data->buffer_pool;
+    void *block, *next_block;
+    unsigned int i;
+
+    if (stats_enabled() && (pool->num_hits || pool->num_misses))
+        vdpau_information_message(
+            "buffer pool: %llu hits, %llu misses (%.1f%% hit rate)\n",
+            (unsigned long long)pool->num_hits,
+            (unsigned long long)pool->num_misses,
+            100.0 * pool->num_hits / (pool->num_hits + pool->num_misses));
+
+    for (i = 0; i < ARRAY_ELEMS(pool->free_blocks); i++) {
+        for (block = pool->free_blocks[i]; block != NULL; block = next_block) {
+            next_block = *(void **)block;
+            free(block);
+        }
+        pool->free_blocks[i] = NULL;
+    }
+    pool->size = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
+
+// Allocate a block of SIZE bytes, recycling a released block if possible
+void *
+buffer_pool_alloc(vdpau_driver_data_t *driver_data, unsigned int size, int *phit)
+{
+    vdpau_buffer_pool_t * const pool = &driver_data->buffer_pool;
+    const int class = get_buffer_pool_class(size);
+    void *block = NULL;
+
+    if (phit)
+        *phit = 0;
+    if (class < 0)
+        return malloc(size);
+
+    pthread_mutex_lock(&pool->lock);
+    block = pool->free_blocks[class];
+    if (block) {
+        pool->free_blocks[class] = *(void **)block;
+        pool->size -= 1U << (class + BUFFER_POOL_MIN_SIZE_LOG2);
+        pool->num_hits++;
+    }
+    else
+        pool->num_misses++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!block)
+        block = malloc(1U << (class + BUFFER_POOL_MIN_SIZE_LOG2));
+    else if (phit)
+        *phit = 1;
+    return block;
+}
+
+// Release a block of SIZE bytes, retaining it in the pool if possible
+void
+buffer_pool_free(vdpau_driver_data_t *driver_data, void *block, unsigned int size)
+{
+    vdpau_buffer_pool_t * const pool = &driver_data->buffer_pool;
+    const int class = get_buffer_pool_class(size);
+
+    if (class >= 0) {
+        const unsigned int class_size = 1U << (class + BUFFER_POOL_MIN_SIZE_LOG2);
+        pthread_mutex_lock(&pool->lock);
+        if (pool->size + class_size <= pool->size_max) {
+            *(void **)block = pool->free_blocks[class];
+            pool->free_blocks[class] = block;
+            pool->size += class_size;
+            block = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    free(block);
+}
+
 // Destroy dead VA buffers
 void
 destroy_dead_va_buffers(
@@ -62,6 +181,7 @@ create_va_buffer(
 {
     VABufferID buffer_id;
     object_buffer_p obj_buffer;
+    int pool_hit;
 
     buffer_id = object_heap_allocate(&driver_data->buffer_heap);
     if (buffer_id == VA_INVALID_BUFFER)
@@ -76,14 +196,23 @@ create_va_buffer(
     obj_buffer->max_num_elements = num_elements;
     obj_buffer->num_elements     = num_elements;
     obj_buffer->buffer_size      = size * num_elements;
-    obj_buffer->buffer_data      = malloc(obj_buffer->buffer_size);
+    obj_buffer->buffer_data      = buffer_pool_alloc(driver_data, obj_buffer->buffer_size,
+                                                     &pool_hit);
     obj_buffer->mtime            = 0;
+    obj_buffer->derived_image    = VA_INVALID_ID;
     obj_buffer->delayed_destroy  = 0;
 
     if (!obj_buffer->buffer_data) {
         destroy_va_buffer(driver_data, obj_buffer);
         return NULL;
     }
+
+    /* Recycled blocks cost no allocation */
+    if (!pool_hit && stats_enabled()) {
+        object_context_p obj_context = VDPAU_CONTEXT(context);
+        if (obj_context)
+            obj_context->decode_stats.num_allocations++;
+    }
     return obj_buffer;
 }
 
@@ -98,7 +227,7 @@ destroy_va_buffer(
         return;
 
     if (obj_buffer->buffer_data) {
-        free(obj_buffer->buffer_data);
+        buffer_pool_free(driver_data, obj_buffer->buffer_data, obj_buffer->buffer_size);
         obj_buffer->buffer_data = NULL;
     }
     object_heap_free(&driver_data->buffer_heap, (object_base_p)obj_buffer);
@@ -115,6 +244,8 @@ schedule_destroy_va_buffer(
     if (!obj_context)
         return;
 
+    if (obj_context->dead_buffers_count_max <= 16 + obj_context->dead_buffers_count)
+        obj_context->decode_stats.num_allocations++;
     realloc_buffer(
         (void **)&obj_context->dead_buffers,
         &obj_context->dead_buffers_count_max,
@@ -160,6 +291,16 @@ vdpau_CreateBuffer(
         return VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
     }
 
+    /* Decode buffers must match the codec of the context */
+    if (type != VAImageBufferType) {
+        object_context_p obj_context = VDPAU_CONTEXT(context);
+        if (obj_context && !is_supported_buffer_type(obj_context, type)) {
+            D(bug("ERROR: unsupported buffer type %d for context 0x%08x\n",
+                  type, context));
+            return VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
+        }
+    }
+
     object_buffer_p obj_buffer;
     obj_buffer = create_va_buffer(driver_data, context, type, num_elements, size);
     if (!obj_buffer)
@@ -232,6 +373,16 @@ vdpau_MapBuffer(
     if (obj_buffer->buffer_data == NULL)
         return VA_STATUS_ERROR_UNKNOWN;
 
+    if (obj_buffer->derived_image != VA_INVALID_ID) {
+        object_image_p obj_image = VDPAU_IMAGE(obj_buffer->derived_image);
+        if (!obj_image)
+            return VA_STATUS_ERROR_INVALID_IMAGE;
+
+        VAStatus va_status = derived_image_map(driver_data, obj_image);
+        if (va_status != VA_STATUS_SUCCESS)
+            return va_status;
+    }
+
     ++obj_buffer->mtime;
     return VA_STATUS_SUCCESS;
 }
@@ -249,6 +400,16 @@ vdpau_UnmapBuffer(
     if (!obj_buffer)
         return VA_STATUS_ERROR_INVALID_BUFFER;
 
+    if (obj_buffer->derived_image != VA_INVALID_ID) {
+        object_image_p obj_image = VDPAU_IMAGE(obj_buffer->derived_image);
+        if (!obj_image)
+            return VA_STATUS_ERROR_INVALID_IMAGE;
+
+        VAStatus va_status = derived_image_unmap(driver_data, obj_image);
+        if (va_status != VA_STATUS_SUCCESS)
+            return va_status;
+    }
+
     ++obj_buffer->mtime;
     return VA_STATUS_SUCCESS;
 }
@@ -33,9 +33,31 @@ struct object_buffer {
     unsigned int        max_num_elements;
     unsigned int        num_elements;
     uint64_t            mtime;
+    VAImageID           derived_image;  /* image derived from a surface */
     unsigned int        delayed_destroy : 1;
 };
 
+// Initialize buffer pool
+void
+buffer_pool_init(vdpau_driver_data_t *driver_data)
+    attribute_hidden;
+
+// Release all blocks retained by the buffer pool
+void
+buffer_pool_destroy(vdpau_driver_data_t *driver_data)
+    attribute_hidden;
+
+// Allocate a block of SIZE bytes, recycling a released block if possible.
+// If PHIT is not NULL, it is set to whether the block was recycled
+void *
+buffer_pool_alloc(vdpau_driver_data_t *driver_data, unsigned int size, int *phit)
+    attribute_hidden;
+
+// Release a block of SIZE bytes, retaining it in the pool if possible
+void
+buffer_pool_free(vdpau_driver_data_t *driver_data, void *block, unsigned int size)
+    attribute_hidden;
+
 // Destroy dead VA buffers
 void
 destroy_dead_va_buffers(
@@ -0,0 +1,344 @@
+/*
+ *  vdpau_caps.c - VDPAU device capabilities
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#include "sysdeps.h"
+#include "vdpau_caps.h"
+#include "vdpau_driver.h"
+#include "utils.h"
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define DEBUG 1
+#include "debug.h"
+
+#define CAPS_CACHE_MAGIC        "VDPCAPS"
+#define CAPS_CACHE_VERSION      1
+#define CAPS_CACHE_DIR          "libva-vdpau-driver"
+
+// Header of the on-disk capabilities cache
+typedef struct {
+    char                magic[8];
+    uint32_t            version;
+    uint32_t            caps_size;
+    uint64_t            key;
+} caps_cache_header_t;
+
+// Decoder profiles the driver translates VA profiles to
+static const VdpDecoderProfile vdpau_caps_decoder_profiles[] = {
+    VDP_DECODER_PROFILE_MPEG2_SIMPLE,
+    VDP_DECODER_PROFILE_MPEG2_MAIN,
+#if USE_VDPAU_MPEG4
+    VDP_DECODER_PROFILE_MPEG4_PART2_SP,
+    VDP_DECODER_PROFILE_MPEG4_PART2_ASP,
+#endif
+    VDP_DECODER_PROFILE_H264_CONSTRAINED_BASELINE,
+    VDP_DECODER_PROFILE_H264_BASELINE,
+    VDP_DECODER_PROFILE_H264_MAIN,
+    VDP_DECODER_PROFILE_H264_HIGH,
+    VDP_DECODER_PROFILE_VC1_SIMPLE,
+    VDP_DECODER_PROFILE_VC1_MAIN,
+    VDP_DECODER_PROFILE_VC1_ADVANCED,
+};
+
+// Returns TRUE if the capabilities are to be kept on disk
+static int caps_cache_enabled(void)
+{
+    static int g_caps_cache = -1;
+    if (g_caps_cache < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_CAPS_CACHE", &g_caps_cache) < 0)
+            g_caps_cache = 0;
+    }
+    return g_caps_cache;
+}
+
+// Hashes the VDPAU implementation identification (FNV-1a)
+static uint64_t
+caps_cache_key(vdpau_driver_data_t *driver_data, const char *impl_string)
+{
+    uint64_t key = 0xcbf29ce484222325ULL;
+    uint32_t values[3];
+    const uint8_t *p;
+    unsigned int i;
+
+    values[0] = CAPS_CACHE_VERSION;
+    values[1] = sizeof(vdpau_caps_t);
+    values[2] = driver_data->vdp_impl_version;
+    for (p = (const uint8_t *)values, i = 0; i < sizeof(values); i++)
+        key = (key ^ p[i]) * 0x100000001b3ULL;
+    for (p = (const uint8_t *)(impl_string ? impl_string : ""); *p; p++)
+        key = (key ^ *p) * 0x100000001b3ULL;
+    return key;
+}
+
+// Builds the cache file path, creating the directory if requested
+static int
+caps_cache_path(uint64_t key, char *path, size_t path_size, int create)
+{
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    const char *home;
+    char dir[PATH_MAX];
+    int n;
+
+    if (cache_home && cache_home[0] == '/')
+        n = snprintf(dir, sizeof(dir), "%s/%s", cache_home, CAPS_CACHE_DIR);
+    else if ((home = getenv("HOME")) != NULL && home[0] == '/') {
+        n = snprintf(dir, sizeof(dir), "%s/.cache", home);
+        if (n > 0 && n < sizeof(dir) && create &&
+            mkdir(dir, 0700) < 0 && errno != EEXIST)
+            return -1;
+        n = snprintf(dir, sizeof(dir), "%s/.cache/%s", home, CAPS_CACHE_DIR);
+    }
+    else
+        return -1;
+    if (n < 0 || n >= sizeof(dir))
+        return -1;
+
+    if (create && mkdir(dir, 0700) < 0 && errno != EEXIST)
+        return -1;
+
+    n = snprintf(path, path_size, "%s/caps-%016llx.bin",
+                 dir, (unsigned long long)key);
+    return (n > 0 && n < path_size) ? 0 : -1;
+}
+
+// Loads capabilities from the on-disk cache
+static int
+caps_cache_load(vdpau_caps_t *caps, uint64_t key)
+{
+    caps_cache_header_t header;
+    char path[PATH_MAX];
+    FILE *fp;
+    int ok;
+
+    if (caps_cache_path(key, path, sizeof(path), 0) < 0)
+        return -1;
+    if ((fp = fopen(path, "rb")) == NULL)
+        return -1;
+
+    ok = (fread(&header, sizeof(header), 1, fp) == 1 &&
+          memcmp(header.magic, CAPS_CACHE_MAGIC, sizeof(CAPS_CACHE_MAGIC)) == 0 &&
+          header.version == CAPS_CACHE_VERSION &&
+          header.caps_size == sizeof(*caps) &&
+          header.key == key &&
+          fread(caps, sizeof(*caps), 1, fp) == 1 &&
+          fgetc(fp) == EOF);
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
+// Stores capabilities into the on-disk cache
+static void
+caps_cache_save(const vdpau_caps_t *caps, uint64_t key)
+{
+    caps_cache_header_t header;
+    char path[PATH_MAX], tmp_path[PATH_MAX + 8];
+    FILE *fp;
+    int fd, ok;
+
+    if (caps_cache_path(key, path, sizeof(path), 1) < 0)
+        return;
+
+    /* Write to a temporary file first so that readers never see a
+       partial cache, concurrent writers store identical data */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+    if ((fd = mkstemp(tmp_path)) < 0)
+        return;
+    if ((fp = fdopen(fd, "wb")) == NULL) {
+        close(fd);
+        unlink(tmp_path);
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPS_CACHE_MAGIC, sizeof(CAPS_CACHE_MAGIC));
+    header.version   = CAPS_CACHE_VERSION;
+    header.caps_size = sizeof(*caps);
+    header.key       = key;
+
+    ok = (fwrite(&header, sizeof(header), 1, fp) == 1 &&
+          fwrite(caps, sizeof(*caps), 1, fp) == 1);
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp_path, path) < 0)
+        unlink(tmp_path);
+}
+
+// Queries all capabilities from the VDPAU implementation
+static void
+caps_probe(vdpau_driver_data_t *driver_data, vdpau_caps_t *caps)
+{
+    VdpDevice const device = driver_data->vdp_device;
+    VdpStatus vdp_status;
+    VdpBool is_supported;
+    uint32_t max_width, max_height;
+    unsigned int i;
+
+    memset(caps, 0, sizeof(*caps));
+
+    for (i = 0; i < ARRAY_ELEMS(vdpau_caps_decoder_profiles); i++) {
+        const VdpDecoderProfile profile = vdpau_caps_decoder_profiles[i];
+        vdpau_decoder_caps_t * const dc = &caps->decoders[profile];
+        uint32_t max_level, max_references;
+
+        ASSERT(profile < VDPAU_CAPS_MAX_DECODER_PROFILES);
+        is_supported = VDP_FALSE;
+        vdp_status = vdpau_decoder_query_capabilities(
+            driver_data,
+            device,
+            profile,
+            &is_supported,
+            &max_level,
+            &max_references,
+            &max_width,
+            &max_height
+        );
+        if (VDPAU_CHECK_STATUS(vdp_status, "VdpDecoderQueryCapabilities()") &&
+            is_supported) {
+            dc->is_supported   = 1;
+            dc->max_level      = max_level;
+            dc->max_references = max_references;
+            dc->max_width      = max_width;
+            dc->max_height     = max_height;
+        }
+    }
+
+    for (i = VDP_YCBCR_FORMAT_NV12; i <= VDP_YCBCR_FORMAT_V8U8Y8A8; i++) {
+        is_supported = VDP_FALSE;
+        vdp_status = vdpau_video_surface_query_ycbcr_caps(
+            driver_data,
+            device,
+            VDP_CHROMA_TYPE_420,
+            i,
+            &is_supported
+        );
+        if (vdp_status == VDP_STATUS_OK && is_supported)
+            caps->ycbcr_formats |= 1U << i;
+    }
+
+    for (i = VDP_RGBA_FORMAT_B8G8R8A8; i <= VDP_RGBA_FORMAT_R8G8B8A8; i++) {
+        is_supported = VDP_FALSE;
+        vdp_status = vdpau_output_surface_query_rgba_caps(
+            driver_data,
+            device,
+            i,
+            &is_supported
+        );
+        if (vdp_status == VDP_STATUS_OK && is_supported)
+            caps->rgba_formats |= 1U << i;
+
+        is_supported = VDP_FALSE;
+        vdp_status = vdpau_bitmap_surface_query_capabilities(
+            driver_data,
+            device,
+            i,
+            &is_supported,
+            &max_width,
+            &max_height
+        );
+        if (vdp_status == VDP_STATUS_OK && is_supported)
+            caps->bitmap_formats |= 1U << i;
+    }
+
+    for (i = VDP_INDEXED_FORMAT_A4I4; i <= VDP_INDEXED_FORMAT_I8A8; i++) {
+        is_supported = VDP_FALSE;
+        vdp_status = vdpau_output_surface_query_put_bits_indexed_capabilities(
+            driver_data,
+            device,
+            VDP_RGBA_FORMAT_B8G8R8A8,
+            i,
+            VDP_COLOR_TABLE_FORMAT_B8G8R8X8,
+            &is_supported
+        );
+        if (vdp_status == VDP_STATUS_OK && is_supported)
+            caps->indexed_formats |= 1U << i;
+    }
+
+    for (i = 1; i <= 9; i++) {
+        is_supported = VDP_FALSE;
+        vdp_status = vdpau_video_mixer_query_feature_support(
+            driver_data,
+            device,
+            VDP_VIDEO_MIXER_FEATURE_HIGH_QUALITY_SCALING_L1 + i - 1,
+            &is_supported
+        );
+        if (VDPAU_CHECK_STATUS(vdp_status, "VdpVideoMixerQueryFeatureSupport()") &&
+            is_supported)
+            caps->hqscaling_levels |= 1U << i;
+    }
+}
+
+// Initialize device capabilities
+void
+vdpau_caps_init(vdpau_driver_data_t *driver_data, const char *impl_string)
+{
+    vdpau_caps_t * const caps = &driver_data->vdp_caps;
+    uint64_t key = 0;
+
+    if (caps_cache_enabled()) {
+        key = caps_cache_key(driver_data, impl_string);
+        if (caps_cache_load(caps, key) == 0) {
+            D(bug("loaded device capabilities from cache\n"));
+            return;
+        }
+    }
+
+    caps_probe(driver_data, caps);
+
+    if (caps_cache_enabled())
+        caps_cache_save(caps, key);
+}
+
+// Returns the decoder capabilities for the profile, or NULL if unsupported
+const vdpau_decoder_caps_t *
+vdpau_caps_get_decoder(
+    vdpau_driver_data_t *driver_data,
+    VdpDecoderProfile    profile
+)
+{
+    const vdpau_decoder_caps_t *dc;
+
+    if (profile >= VDPAU_CAPS_MAX_DECODER_PROFILES)
+        return NULL;
+
+    dc = &driver_data->vdp_caps.decoders[profile];
+    return dc->is_supported ? dc : NULL;
+}
+
+// Checks whether the image format is supported for the usage
+VdpBool
+vdpau_caps_has_format(
+    vdpau_driver_data_t *driver_data,
+    vdpau_caps_format_t  usage,
+    uint32_t             format
+)
+{
+    const vdpau_caps_t * const caps = &driver_data->vdp_caps;
+    uint32_t formats;
+
+    switch (usage) {
+    case VDPAU_CAPS_FORMAT_YCBCR:   formats = caps->ycbcr_formats;   break;
+    case VDPAU_CAPS_FORMAT_RGBA:    formats = caps->rgba_formats;    break;
+    case VDPAU_CAPS_FORMAT_BITMAP:  formats = caps->bitmap_formats;  break;
+    case VDPAU_CAPS_FORMAT_INDEXED: formats = caps->indexed_formats; break;
+    default:                        formats = 0;                     break;
+    }
+    return format < 32 && (formats & (1U << format)) != 0;
+}
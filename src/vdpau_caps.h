@@ -0,0 +1,53 @@
+/*
+ *  vdpau_caps.h - VDPAU device capabilities
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#ifndef VDPAU_CAPS_H
+#define VDPAU_CAPS_H
+
+#include "vdpau_driver.h"
+
+typedef enum {
+    VDPAU_CAPS_FORMAT_YCBCR = 1,    // video surface get/put bits (4:2:0)
+    VDPAU_CAPS_FORMAT_RGBA,         // output surface
+    VDPAU_CAPS_FORMAT_BITMAP,       // bitmap surface
+    VDPAU_CAPS_FORMAT_INDEXED,      // output surface put bits indexed
+} vdpau_caps_format_t;
+
+// Initialize device capabilities, from the disk cache if enabled
+void
+vdpau_caps_init(vdpau_driver_data_t *driver_data, const char *impl_string)
+    attribute_hidden;
+
+// Returns the decoder capabilities for the profile, or NULL if unsupported
+const vdpau_decoder_caps_t *
+vdpau_caps_get_decoder(
+    vdpau_driver_data_t *driver_data,
+    VdpDecoderProfile    profile
+) attribute_hidden;
+
+// Checks whether the image format is supported for the usage
+VdpBool
+vdpau_caps_has_format(
+    vdpau_driver_data_t *driver_data,
+    vdpau_caps_format_t  usage,
+    uint32_t             format
+) attribute_hidden;
+
+#endif /* VDPAU_CAPS_H */
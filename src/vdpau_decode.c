@@ -22,14 +22,33 @@
 #include "vdpau_decode.h"
 #include "vdpau_driver.h"
 #include "vdpau_buffer.h"
+#include "vdpau_caps.h"
 #include "vdpau_video.h"
 #include "vdpau_dump.h"
 #include "utils.h"
 #include "put_bits.h"
+#include <pthread.h>
 
 #define DEBUG 1
 #include "debug.h"
 
+// Minimal size of a generated slice data chunk
+#define GEN_SLICE_CHUNK_SIZE 4096
+
+// Default budget for idle decoders kept in cache
+#define DECODER_CACHE_SIZE_MAX_DEFAULT (32 << 20)
+
+// Idle decoder kept in cache
+struct vdpau_decoder_cache_entry {
+    vdpau_decoder_cache_entry_t *next;
+    VdpDecoder                  vdp_decoder;
+    VdpDecoderProfile           vdp_profile;
+    uint32_t                    width;
+    uint32_t                    height;
+    uint32_t                    max_references;
+    unsigned int                size;
+};
+
 
 // Translates VdpDecoderProfile to VdpCodec
 VdpCodec get_VdpCodec(VdpDecoderProfile profile)
@@ -95,25 +114,7 @@ is_supported_profile(
     VdpDecoderProfile    profile
 )
 {
-    VdpBool is_supported = VDP_FALSE;
-    VdpStatus vdp_status;
-    uint32_t max_level, max_references, max_width, max_height;
-
-    if (profile == (VdpDecoderProfile)-1)
-        return VDP_FALSE;
-
-    vdp_status = vdpau_decoder_query_capabilities(
-        driver_data,
-        driver_data->vdp_device,
-        profile,
-        &is_supported,
-        &max_level,
-        &max_references,
-        &max_width,
-        &max_height
-    );
-    return (VDPAU_CHECK_STATUS(vdp_status, "VdpDecoderQueryCapabilities()") &&
-            is_supported);
+    return vdpau_caps_get_decoder(driver_data, profile) != NULL;
 }
 
 // Checks decoder for profile/entrypoint is available
@@ -145,6 +146,8 @@ get_max_ref_frames(
     int max_ref_frames = 2;
 
     switch (profile) {
+    case VDP_DECODER_PROFILE_H264_CONSTRAINED_BASELINE:
+    case VDP_DECODER_PROFILE_H264_BASELINE:
     case VDP_DECODER_PROFILE_H264_MAIN:
     case VDP_DECODER_PROFILE_H264_HIGH:
     {
@@ -168,6 +171,179 @@ static inline int get_num_ref_frames(object_context_p obj_context)
     return 2;
 }
 
+// Waits for all pending decode submissions of the context to complete
+static void
+decode_sync_context(object_context_p obj_context)
+{
+    if (!obj_context->decode_queue)
+        return;
+
+    pthread_mutex_lock(&obj_context->decode_lock);
+    while (obj_context->decode_jobs_pending > 0)
+        pthread_cond_wait(&obj_context->decode_cond, &obj_context->decode_lock);
+    pthread_mutex_unlock(&obj_context->decode_lock);
+}
+
+// Returns the maximum number of bytes retained by idle decoders
+static unsigned int get_decoder_cache_size_max(void)
+{
+    static int g_decoder_cache_size = -1;
+    if (g_decoder_cache_size < 0) {
+        if (getenv_int("VDPAU_VIDEO_DECODER_CACHE_SIZE", &g_decoder_cache_size) < 0 ||
+            g_decoder_cache_size < 0)
+            g_decoder_cache_size = DECODER_CACHE_SIZE_MAX_DEFAULT;
+    }
+    return g_decoder_cache_size;
+}
+
+// Estimates the memory held by a decoder: a working picture, plus
+// co-located motion data (64 bytes per macroblock) for each reference
+static unsigned int
+get_decoder_size(uint32_t width, uint32_t height, uint32_t max_references)
+{
+    const unsigned int num_mbs = ((width + 15) / 16) * ((height + 15) / 16);
+
+    return num_mbs * (384 + 64 * max_references);
+}
+
+// Initialize idle decoders cache
+void
+decoder_cache_init(vdpau_driver_data_t *driver_data)
+{
+    vdpau_decoder_cache_t * const cache = &driver_data->decoder_cache;
+
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->size_max = get_decoder_cache_size_max();
+}
+
+// Destroy all decoders retained by the cache
+void
+decoder_cache_destroy(vdpau_driver_data_t *driver_data)
+{
+    vdpau_decoder_cache_t * const cache = &driver_data->decoder_cache;
+    vdpau_decoder_cache_entry_t *entry, *next_entry;
+
+    if (stats_enabled() && (cache->num_hits || cache->num_misses))
+        vdpau_information_message(
+            "decoder cache: %llu hits, %llu misses\n",
+            (unsigned long long)cache->num_hits,
+            (unsigned long long)cache->num_misses);
+
+    for (entry = cache->entries; entry != NULL; entry = next_entry) {
+        next_entry = entry->next;
+        vdpau_decoder_destroy(driver_data, entry->vdp_decoder);
+        free(entry);
+    }
+    cache->entries = NULL;
+    cache->size    = 0;
+    pthread_mutex_destroy(&cache->lock);
+}
+
+// Looks up an idle decoder with at least MAX_REFERENCES reference frames
+static VdpDecoder
+decoder_cache_get(
+    vdpau_driver_data_t *driver_data,
+    VdpDecoderProfile    vdp_profile,
+    uint32_t             width,
+    uint32_t             height,
+    uint32_t             max_references,
+    uint32_t            *pmax_references
+)
+{
+    vdpau_decoder_cache_t * const cache = &driver_data->decoder_cache;
+    vdpau_decoder_cache_entry_t *entry, **entry_p;
+    VdpDecoder vdp_decoder = VDP_INVALID_HANDLE;
+
+    pthread_mutex_lock(&cache->lock);
+    for (entry_p = &cache->entries; (entry = *entry_p) != NULL;
+         entry_p = &entry->next) {
+        if (entry->vdp_profile == vdp_profile &&
+            entry->width == width && entry->height == height &&
+            entry->max_references >= max_references)
+            break;
+    }
+    if (entry) {
+        *entry_p = entry->next;
+        cache->size -= entry->size;
+        cache->num_hits++;
+        vdp_decoder = entry->vdp_decoder;
+        *pmax_references = entry->max_references;
+        free(entry);
+    }
+    else
+        cache->num_misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return vdp_decoder;
+}
+
+// Keeps an idle decoder in cache, evicting least recently used ones
+static void
+decoder_cache_put(
+    vdpau_driver_data_t *driver_data,
+    VdpDecoder           vdp_decoder,
+    VdpDecoderProfile    vdp_profile,
+    uint32_t             width,
+    uint32_t             height,
+    uint32_t             max_references
+)
+{
+    vdpau_decoder_cache_t * const cache = &driver_data->decoder_cache;
+    vdpau_decoder_cache_entry_t *entry, **entry_p;
+
+    const unsigned int size = get_decoder_size(width, height, max_references);
+    if (size > cache->size_max || !(entry = malloc(sizeof(*entry)))) {
+        vdpau_decoder_destroy(driver_data, vdp_decoder);
+        return;
+    }
+    entry->vdp_decoder    = vdp_decoder;
+    entry->vdp_profile    = vdp_profile;
+    entry->width          = width;
+    entry->height         = height;
+    entry->max_references = max_references;
+    entry->size           = size;
+
+    pthread_mutex_lock(&cache->lock);
+    entry->next    = cache->entries;
+    cache->entries = entry;
+    cache->size   += size;
+
+    /* Evict from the tail of the list until the budget is met */
+    while (cache->size > cache->size_max) {
+        entry_p = &cache->entries;
+        while ((*entry_p)->next)
+            entry_p = &(*entry_p)->next;
+        entry    = *entry_p;
+        *entry_p = NULL;
+        cache->size -= entry->size;
+        vdpau_decoder_destroy(driver_data, entry->vdp_decoder);
+        free(entry);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Releases the context decoder, keeping it in cache for later reuse
+void
+release_decoder(
+    vdpau_driver_data_t *driver_data,
+    object_context_p     obj_context
+)
+{
+    if (obj_context->vdp_decoder == VDP_INVALID_HANDLE)
+        return;
+
+    decode_sync_context(obj_context);
+    decoder_cache_put(
+        driver_data,
+        obj_context->vdp_decoder,
+        obj_context->vdp_profile,
+        obj_context->picture_width,
+        obj_context->picture_height,
+        obj_context->max_ref_frames
+    );
+    obj_context->vdp_decoder = VDP_INVALID_HANDLE;
+}
+
 // Ensure VDPAU decoder is created for the specified number of reference frames
 static VdpStatus
 ensure_decoder_with_max_refs(
@@ -178,20 +354,29 @@ ensure_decoder_with_max_refs(
 {
     VdpStatus vdp_status;
 
-    if (max_ref_frames < 0)
-        max_ref_frames =
-            get_max_ref_frames(obj_context->vdp_profile,
-                               obj_context->picture_width,
-                               obj_context->picture_height);
+    /* Pre-size from the level limits so that the decoder does not need
+       to be re-created mid-stream */
+    max_ref_frames = MAX(max_ref_frames,
+                         get_max_ref_frames(obj_context->vdp_profile,
+                                            obj_context->picture_width,
+                                            obj_context->picture_height));
 
     if (obj_context->vdp_decoder == VDP_INVALID_HANDLE ||
         obj_context->max_ref_frames < max_ref_frames) {
-        obj_context->max_ref_frames = max_ref_frames;
+        release_decoder(driver_data, obj_context);
 
-        if (obj_context->vdp_decoder != VDP_INVALID_HANDLE) {
-            vdpau_decoder_destroy(driver_data, obj_context->vdp_decoder);
-            obj_context->vdp_decoder = VDP_INVALID_HANDLE;
-        }
+        uint32_t max_references = max_ref_frames;
+        obj_context->vdp_decoder = decoder_cache_get(
+            driver_data,
+            obj_context->vdp_profile,
+            obj_context->picture_width,
+            obj_context->picture_height,
+            max_ref_frames,
+            &max_references
+        );
+        obj_context->max_ref_frames = max_references;
+        if (obj_context->vdp_decoder != VDP_INVALID_HANDLE)
+            return VDP_STATUS_OK;
 
         vdp_status = vdpau_decoder_create(
             driver_data,
@@ -208,22 +393,83 @@ ensure_decoder_with_max_refs(
     return VDP_STATUS_OK;
 }
 
-// Lazy allocate (generated) slice data buffer. Buffer lives until vaDestroyContext()
+// Releases a list of generated slice data chunks
+static void
+free_gen_slice_chunks(gen_slice_chunk_t *chunk)
+{
+    gen_slice_chunk_t *next_chunk;
+
+    for (; chunk; chunk = next_chunk) {
+        next_chunk = chunk->next;
+        free(chunk);
+    }
+}
+
+// Releases generated slice data chunks
+void
+destroy_gen_slice_data(object_context_p obj_context)
+{
+    free_gen_slice_chunks(obj_context->gen_slice_data);
+    obj_context->gen_slice_data          = NULL;
+    obj_context->gen_slice_data_chunk    = NULL;
+    obj_context->gen_slice_data_size     = 0;
+    obj_context->gen_slice_data_size_max = 0;
+}
+
+// Resets (generated) slice data for a new picture. Chunks are kept for reuse
+static void
+reset_gen_slice_data(object_context_p obj_context)
+{
+    gen_slice_chunk_t * const chunk = obj_context->gen_slice_data;
+
+    if (chunk)
+        chunk->used = 0;
+    obj_context->gen_slice_data_chunk = chunk;
+    obj_context->gen_slice_data_size  = 0;
+}
+
+// Lazy allocate (generated) slice data. Data lives until the next picture
 static uint8_t *
 alloc_gen_slice_data(object_context_p obj_context, unsigned int size)
 {
-    uint8_t *gen_slice_data = obj_context->gen_slice_data;
+    gen_slice_chunk_t *chunk = obj_context->gen_slice_data_chunk;
+
+    /* Walk through chunks left over from previous pictures first */
+    while (chunk && chunk->used + size > chunk->size && chunk->next) {
+        chunk = chunk->next;
+        chunk->used = 0;
+    }
 
-    if (obj_context->gen_slice_data_size + size > obj_context->gen_slice_data_size_max) {
-        obj_context->gen_slice_data_size_max += size;
-        gen_slice_data = realloc(obj_context->gen_slice_data,
-                                 obj_context->gen_slice_data_size_max);
-        if (!gen_slice_data)
+    if (!chunk || chunk->used + size > chunk->size) {
+        unsigned int chunk_size = GEN_SLICE_CHUNK_SIZE;
+        if (chunk)
+            chunk_size = MAX(chunk_size, 2 * chunk->size);
+        chunk_size = MAX(chunk_size, size);
+
+        gen_slice_chunk_t * const new_chunk =
+            malloc(sizeof(*new_chunk) + chunk_size);
+        if (!new_chunk)
             return NULL;
-        obj_context->gen_slice_data = gen_slice_data;
+        obj_context->decode_stats.num_allocations++;
+
+        new_chunk->next = NULL;
+        new_chunk->size = chunk_size;
+        new_chunk->used = 0;
+        if (chunk)
+            chunk->next = new_chunk;
+        else
+            obj_context->gen_slice_data = new_chunk;
+        chunk = new_chunk;
     }
-    gen_slice_data += obj_context->gen_slice_data_size;
+    obj_context->gen_slice_data_chunk = chunk;
+
+    uint8_t * const gen_slice_data = &chunk->data[chunk->used];
+    chunk->used += size;
+
+    /* Keep track of the high-water mark, this is what a picture needs */
     obj_context->gen_slice_data_size += size;
+    if (obj_context->gen_slice_data_size_max < obj_context->gen_slice_data_size)
+        obj_context->gen_slice_data_size_max = obj_context->gen_slice_data_size;
     return gen_slice_data;
 }
 
@@ -233,6 +479,9 @@ alloc_VdpBitstreamBuffer(object_context_p obj_context)
 {
     VdpBitstreamBuffer *vdp_bitstream_buffers;
 
+    if (obj_context->vdp_bitstream_buffers_count_max <=
+        obj_context->vdp_bitstream_buffers_count + 1)
+        obj_context->decode_stats.num_allocations++;
     vdp_bitstream_buffers = realloc_buffer(
         (void **)&obj_context->vdp_bitstream_buffers,
         &obj_context->vdp_bitstream_buffers_count_max,
@@ -246,6 +495,7 @@ alloc_VdpBitstreamBuffer(object_context_p obj_context)
 }
 
 // Append VASliceDataBuffer hunk into VDPAU buffer
+// NOTE: hunks contiguous to the previous one are merged into it
 static int
 append_VdpBitstreamBuffer(
     object_context_p obj_context,
@@ -255,6 +505,16 @@ append_VdpBitstreamBuffer(
 {
     VdpBitstreamBuffer *bitstream_buffer;
 
+    if (obj_context->vdp_bitstream_buffers_count > 0) {
+        bitstream_buffer = &obj_context->vdp_bitstream_buffers[
+            obj_context->vdp_bitstream_buffers_count - 1];
+        if ((const uint8_t *)bitstream_buffer->bitstream +
+            bitstream_buffer->bitstream_bytes == buffer) {
+            bitstream_buffer->bitstream_bytes += buffer_size;
+            return 0;
+        }
+    }
+
     bitstream_buffer = alloc_VdpBitstreamBuffer(obj_context);
     if (!bitstream_buffer)
         return -1;
@@ -265,6 +525,51 @@ append_VdpBitstreamBuffer(
     return 0;
 }
 
+// Returns TRUE if the whole picture is copied into a single bitstream buffer
+static int bitstream_copy_enabled(void)
+{
+    static int g_bitstream_copy = -1;
+    if (g_bitstream_copy < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_BITSTREAM_COPY", &g_bitstream_copy) < 0)
+            g_bitstream_copy = 0;
+    }
+    return g_bitstream_copy;
+}
+
+// Copies all VdpBitstreamBuffer hunks into a single contiguous one
+static int
+flatten_VdpBitstreamBuffers(object_context_p obj_context)
+{
+    VdpBitstreamBuffer * const bitstream_buffers =
+        obj_context->vdp_bitstream_buffers;
+    const unsigned int num_bitstream_buffers =
+        obj_context->vdp_bitstream_buffers_count;
+    uint32_t bitstream_size = 0;
+    uint8_t *bitstream;
+    unsigned int i;
+
+    if (num_bitstream_buffers < 2)
+        return 0;
+
+    for (i = 0; i < num_bitstream_buffers; i++)
+        bitstream_size += bitstream_buffers[i].bitstream_bytes;
+
+    /* The copy lives in the generated slice data, reused across pictures */
+    bitstream = alloc_gen_slice_data(obj_context, bitstream_size);
+    if (!bitstream)
+        return -1;
+
+    bitstream_buffers[0].bitstream = bitstream;
+    for (i = 0; i < num_bitstream_buffers; i++) {
+        memcpy(bitstream, bitstream_buffers[i].bitstream,
+               bitstream_buffers[i].bitstream_bytes);
+        bitstream += bitstream_buffers[i].bitstream_bytes;
+    }
+    bitstream_buffers[0].bitstream_bytes = bitstream_size;
+    obj_context->vdp_bitstream_buffers_count = 1;
+    return 0;
+}
+
 // Initialize VdpReferenceFrameH264 to default values
 static void init_VdpReferenceFrameH264(VdpReferenceFrameH264 *rf)
 {
@@ -420,6 +725,51 @@ translate_nothing(
     return 1;
 }
 
+// Checks the slice data lies within the VASliceDataBuffer
+static inline int
+is_valid_slice_data(
+    object_buffer_p obj_buffer,
+    uint32_t        slice_data_offset,
+    uint32_t        slice_data_size
+)
+{
+    if (slice_data_offset > obj_buffer->buffer_size ||
+        slice_data_size > obj_buffer->buffer_size - slice_data_offset) {
+        D(bug("ERROR: slice data (offset %u, size %u) exceeds buffer size %u\n",
+              slice_data_offset, slice_data_size, obj_buffer->buffer_size));
+        return 0;
+    }
+    return 1;
+}
+
+// Appends the VCL NAL units from an H.264 Annex-B byte stream. Other NAL
+// units (SPS, PPS, SEI, AUD, ...) are conveyed through VdpPictureInfoH264
+// Returns the number of VCL NAL units, or -1 on error
+static int
+append_VdpBitstreamBuffer_H264(
+    object_context_p obj_context,
+    const uint8_t   *buffer,
+    uint32_t         buffer_size
+)
+{
+    const uint8_t * const end = buffer + buffer_size;
+    const uint8_t *nal, *next_nal;
+    int num_nal_units = 0;
+
+    for (nal = find_start_code(buffer, end); nal < end; nal = next_nal) {
+        next_nal = find_start_code(nal + 3, end);
+        if (nal + 3 >= end)
+            break;
+        const unsigned int nal_unit_type = nal[3] & 0x1f;
+        if (nal_unit_type < 1 || nal_unit_type > 5)
+            continue;
+        if (append_VdpBitstreamBuffer(obj_context, nal, next_nal - nal) < 0)
+            return -1;
+        num_nal_units++;
+    }
+    return num_nal_units;
+}
+
 static int
 translate_VASliceDataBuffer_MPEG2(
     vdpau_driver_data_t *driver_data,
@@ -435,17 +785,19 @@ translate_VASliceDataBuffer_MPEG2(
     /* Check we have the start code */
     for (i = 0; i < obj_context->last_slice_params_count; i++) {
         VASliceParameterBufferMPEG2 * const slice_param = &slice_params[i];
+        if (!is_valid_slice_data(obj_buffer, slice_param->slice_data_offset,
+                                 slice_param->slice_data_size))
+            return 0;
         uint8_t * const buf = (uint8_t *)obj_buffer->buffer_data + slice_param->slice_data_offset;
-        if (memcmp(buf, start_code_prefix, sizeof(start_code_prefix)) != 0) {
-            if (append_VdpBitstreamBuffer(obj_context,
-                                          start_code_prefix,
-                                          sizeof(start_code_prefix)) < 0)
-                return 0;
-            slice_header = alloc_gen_slice_data(obj_context, 1);
+        if (slice_param->slice_data_size < sizeof(start_code_prefix) ||
+            memcmp(buf, start_code_prefix, sizeof(start_code_prefix)) != 0) {
+            /* Generate start code and slice_vertical_position in one run */
+            slice_header = alloc_gen_slice_data(obj_context, 4);
             if (!slice_header)
                 return 0;
-            slice_header[0] = slice_param->slice_vertical_position + 1;
-            if (append_VdpBitstreamBuffer(obj_context, slice_header, 1) < 0)
+            memcpy(slice_header, start_code_prefix, sizeof(start_code_prefix));
+            slice_header[3] = slice_param->slice_vertical_position + 1;
+            if (append_VdpBitstreamBuffer(obj_context, slice_header, 4) < 0)
                 return 0;
         }
         if (append_VdpBitstreamBuffer(obj_context,
@@ -473,13 +825,32 @@ translate_VASliceDataBuffer(
         unsigned int i;
         for (i = 0; i < obj_context->last_slice_params_count; i++) {
             VASliceParameterBufferH264 * const slice_param = &slice_params[i];
+            if (!is_valid_slice_data(obj_buffer, slice_param->slice_data_offset,
+                                     slice_param->slice_data_size))
+                return 0;
             uint8_t *buf = (uint8_t *)obj_buffer->buffer_data + slice_param->slice_data_offset;
-            if (memcmp(buf, start_code_prefix, sizeof(start_code_prefix)) != 0) {
-                if (append_VdpBitstreamBuffer(obj_context,
-                                              start_code_prefix,
-                                              sizeof(start_code_prefix)) < 0)
+            if (slice_param->slice_data_size >= sizeof(start_code_prefix) &&
+                memcmp(buf, start_code_prefix, sizeof(start_code_prefix)) == 0) {
+                /* The slice data may hold several NAL units, e.g. when
+                   the whole access unit was submitted at once, or none
+                   at all (SPS, PPS, SEI only). The slice parameters
+                   counted one */
+                const int num_nal_units =
+                    append_VdpBitstreamBuffer_H264(obj_context, buf,
+                                                   slice_param->slice_data_size);
+                if (num_nal_units < 0)
                     return 0;
+                if (num_nal_units > 1)
+                    obj_context->vdp_picture_info.h264.slice_count +=
+                        num_nal_units - 1;
+                else if (num_nal_units == 0)
+                    obj_context->vdp_picture_info.h264.slice_count--;
+                continue;
             }
+            if (append_VdpBitstreamBuffer(obj_context,
+                                          start_code_prefix,
+                                          sizeof(start_code_prefix)) < 0)
+                return 0;
             if (append_VdpBitstreamBuffer(obj_context,
                                           buf,
                                           slice_param->slice_data_size) < 0)
@@ -989,11 +1360,6 @@ translate_VASliceParameterBufferVC1(
 }
 
 // Translate VA buffer
-typedef int
-(*translate_buffer_func_t)(vdpau_driver_data_t *driver_data,
-                           object_context_p    obj_context,
-                           object_buffer_p     obj_buffer);
-
 typedef struct translate_buffer_info translate_buffer_info_t;
 struct translate_buffer_info {
     VdpCodec codec;
@@ -1001,12 +1367,9 @@ struct translate_buffer_info {
     translate_buffer_func_t func;
 };
 
-static int
-translate_buffer(
-    vdpau_driver_data_t *driver_data,
-    object_context_p    obj_context,
-    object_buffer_p     obj_buffer
-)
+// Resolves the translate functions for the context codec
+void
+init_translate_buffer_funcs(object_context_p obj_context)
 {
     static const translate_buffer_info_t translate_info[] = {
 #define _(CODEC, TYPE)                                  \
@@ -1031,17 +1394,40 @@ translate_buffer(
         { 0, 0, NULL }
     };
     const translate_buffer_info_t *tbip;
+
+    memset(obj_context->translate_buffer_funcs, 0,
+           sizeof(obj_context->translate_buffer_funcs));
     for (tbip = translate_info; tbip->func != NULL; tbip++) {
         if (tbip->codec && tbip->codec != obj_context->vdp_codec)
             continue;
-        if (tbip->type != obj_buffer->type)
-            continue;
-        return tbip->func(driver_data, obj_context, obj_buffer);
+        ASSERT(tbip->type < VDPAU_MAX_TRANSLATE_BUFFER_TYPES);
+        obj_context->translate_buffer_funcs[tbip->type] = tbip->func;
     }
-    D(bug("ERROR: no translate function found for %s%s\n",
-          string_of_VABufferType(obj_buffer->type),
-          obj_context->vdp_codec ? string_of_VdpCodec(obj_context->vdp_codec) : NULL));
-    return 0;
+}
+
+// Returns TRUE if buffers of that type can be rendered to the context
+int
+is_supported_buffer_type(object_context_p obj_context, VABufferType type)
+{
+    return ((unsigned int)type < VDPAU_MAX_TRANSLATE_BUFFER_TYPES &&
+            obj_context->translate_buffer_funcs[type] != NULL);
+}
+
+static inline int
+translate_buffer(
+    vdpau_driver_data_t *driver_data,
+    object_context_p    obj_context,
+    object_buffer_p     obj_buffer
+)
+{
+    if (!is_supported_buffer_type(obj_context, obj_buffer->type)) {
+        D(bug("ERROR: no translate function found for %s%s\n",
+              string_of_VABufferType(obj_buffer->type),
+              obj_context->vdp_codec ? string_of_VdpCodec(obj_context->vdp_codec) : NULL));
+        return 0;
+    }
+    return obj_context->translate_buffer_funcs[obj_buffer->type](
+        driver_data, obj_context, obj_buffer);
 }
 
 // vaQueryConfigProfiles
@@ -1136,31 +1522,275 @@ vdpau_QueryConfigEntrypoints(
     return VA_STATUS_SUCCESS;
 }
 
-// vaBeginPicture
-VAStatus
-vdpau_BeginPicture(
-    VADriverContextP    ctx,
-    VAContextID         context,
-    VASurfaceID         render_target
+// Picture handed over to the decode submission thread. The job owns the
+// slice buffers and generated slice data the bitstream buffers point to
+typedef struct decode_job decode_job_t;
+struct decode_job {
+    vdpau_driver_data_t        *driver_data;
+    object_surface_p            obj_surface;
+    VdpDecoder                  vdp_decoder;
+    VdpVideoSurface             vdp_surface;
+    vdpau_picture_info_t        vdp_picture_info;
+    VdpBitstreamBuffer         *vdp_bitstream_buffers;
+    unsigned int                vdp_bitstream_buffers_count;
+    VABufferID                 *dead_buffers;
+    unsigned int                dead_buffers_count;
+    gen_slice_chunk_t          *gen_slice_data;
+};
+
+// Returns TRUE if decode submission is offloaded to a per-context thread
+int decode_async_enabled(void)
+{
+    static int g_decode_async = -1;
+    if (g_decode_async < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_ASYNC_DECODE", &g_decode_async) < 0)
+            g_decode_async = 0;
+    }
+    return g_decode_async;
+}
+
+// Submits the picture to VDPAU and releases the resources held by the job
+static void
+decode_job_run(object_context_p obj_context, decode_job_t *job)
+{
+    vdpau_driver_data_t * const driver_data = job->driver_data;
+    gen_slice_chunk_t *chunk;
+    VdpStatus vdp_status;
+    unsigned int i;
+
+    const uint64_t start_time = stats_enabled() ? get_ticks_nsec() : 0;
+    vdp_status = vdpau_decoder_render(
+        driver_data,
+        job->vdp_decoder,
+        job->vdp_surface,
+        (VdpPictureInfo *)&job->vdp_picture_info,
+        job->vdp_bitstream_buffers_count,
+        job->vdp_bitstream_buffers
+    );
+    const uint64_t end_time = start_time ? get_ticks_nsec() : 0;
+
+    for (i = 0; i < job->dead_buffers_count; i++) {
+        object_buffer_p obj_buffer = VDPAU_BUFFER(job->dead_buffers[i]);
+        ASSERT(obj_buffer);
+        destroy_va_buffer(driver_data, obj_buffer);
+    }
+
+    pthread_mutex_lock(&obj_context->decode_lock);
+    /* Hand the generated slice data chunks back for later pictures */
+    if (job->gen_slice_data) {
+        for (chunk = job->gen_slice_data; chunk->next; chunk = chunk->next)
+            ;
+        chunk->next = obj_context->gen_slice_data_free;
+        obj_context->gen_slice_data_free = job->gen_slice_data;
+    }
+    if (vdp_status != VDP_STATUS_OK &&
+        obj_context->decode_status == VDP_STATUS_OK)
+        obj_context->decode_status = vdp_status;
+    if (start_time)
+        obj_context->decode_stats.vdpau_time += end_time - start_time;
+    obj_context->decode_jobs_pending--;
+    pthread_cond_broadcast(&obj_context->decode_cond);
+    pthread_mutex_unlock(&obj_context->decode_lock);
+
+    surface_fence_end_decode(job->obj_surface);
+    free(job);
+}
+
+// Exit request for the decode submission thread
+static decode_job_t g_decode_job_exit;
+
+// Decode submission thread
+static void *decode_thread(void *arg)
+{
+    object_context_p const obj_context = arg;
+    void *jobs[16];
+    unsigned int i, n;
+
+    for (;;) {
+        n = async_queue_pop_many(obj_context->decode_queue,
+                                 jobs, ARRAY_ELEMS(jobs));
+        for (i = 0; i < n; i++) {
+            if (jobs[i] == &g_decode_job_exit)
+                return NULL;
+            decode_job_run(obj_context, jobs[i]);
+        }
+    }
+    return NULL;
+}
+
+// Starts the asynchronous decode submission thread of the context
+int
+decode_thread_start(object_context_p obj_context)
+{
+    obj_context->decode_jobs_pending = 0;
+    obj_context->decode_status       = VDP_STATUS_OK;
+    obj_context->gen_slice_data_free = NULL;
+
+    obj_context->decode_queue = async_queue_new();
+    if (!obj_context->decode_queue)
+        return -1;
+
+    pthread_mutex_init(&obj_context->decode_lock, NULL);
+    pthread_cond_init(&obj_context->decode_cond, NULL);
+    if (pthread_create(&obj_context->decode_thread, NULL,
+                       decode_thread, obj_context) != 0) {
+        pthread_cond_destroy(&obj_context->decode_cond);
+        pthread_mutex_destroy(&obj_context->decode_lock);
+        async_queue_free(obj_context->decode_queue);
+        obj_context->decode_queue = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Stops the decode submission thread once all pending pictures are submitted
+void
+decode_thread_stop(object_context_p obj_context)
+{
+    if (!obj_context->decode_queue)
+        return;
+
+    /* Pending jobs are processed in order before the exit request */
+    async_queue_push(obj_context->decode_queue, &g_decode_job_exit);
+    pthread_join(obj_context->decode_thread, NULL);
+
+    free_gen_slice_chunks(obj_context->gen_slice_data_free);
+    obj_context->gen_slice_data_free = NULL;
+
+    pthread_cond_destroy(&obj_context->decode_cond);
+    pthread_mutex_destroy(&obj_context->decode_lock);
+    async_queue_free(obj_context->decode_queue);
+    obj_context->decode_queue = NULL;
+}
+
+// Hands the current picture over to the decode submission thread
+static VdpStatus
+decode_thread_submit(
+    vdpau_driver_data_t *driver_data,
+    object_context_p     obj_context,
+    object_surface_p     obj_surface
 )
 {
-    VDPAU_DRIVER_DATA_INIT;
+    const unsigned int num_bitstream_buffers =
+        obj_context->vdp_bitstream_buffers_count;
+    const unsigned int num_dead_buffers = obj_context->dead_buffers_count;
+    decode_job_t *job;
+
+    /* Single allocation for the job and its arrays */
+    job = malloc(sizeof(*job) +
+                 num_bitstream_buffers * sizeof(*job->vdp_bitstream_buffers) +
+                 num_dead_buffers * sizeof(*job->dead_buffers));
+    if (!job)
+        return VDP_STATUS_RESOURCES;
+    obj_context->decode_stats.num_allocations++;
+
+    job->driver_data                 = driver_data;
+    job->obj_surface                 = obj_surface;
+    job->vdp_decoder                 = obj_context->vdp_decoder;
+    job->vdp_surface                 = obj_surface->vdp_surface;
+    job->vdp_picture_info            = obj_context->vdp_picture_info;
+    job->vdp_bitstream_buffers       = (VdpBitstreamBuffer *)(job + 1);
+    job->vdp_bitstream_buffers_count = num_bitstream_buffers;
+    job->dead_buffers                = (VABufferID *)
+        (job->vdp_bitstream_buffers + num_bitstream_buffers);
+    job->dead_buffers_count          = num_dead_buffers;
+    job->gen_slice_data              = NULL;
+    memcpy(job->vdp_bitstream_buffers, obj_context->vdp_bitstream_buffers,
+           num_bitstream_buffers * sizeof(*job->vdp_bitstream_buffers));
+    memcpy(job->dead_buffers, obj_context->dead_buffers,
+           num_dead_buffers * sizeof(*job->dead_buffers));
+    obj_context->dead_buffers_count = 0;
+
+    /* Generated slice data is referenced by the bitstream buffers, so
+       the job takes the chunks over if any of them was used */
+    if (obj_context->gen_slice_data_size > 0) {
+        job->gen_slice_data                  = obj_context->gen_slice_data;
+        obj_context->gen_slice_data          = NULL;
+        obj_context->gen_slice_data_chunk    = NULL;
+        obj_context->gen_slice_data_size     = 0;
+    }
 
-    object_context_p obj_context = VDPAU_CONTEXT(context);
-    if (!obj_context)
-        return VA_STATUS_ERROR_INVALID_CONTEXT;
+    pthread_mutex_lock(&obj_context->decode_lock);
+    obj_context->decode_jobs_pending++;
+    /* Reuse the chunks of completed jobs, so that the arena is not
+       allocated again for every picture */
+    if (!obj_context->gen_slice_data) {
+        obj_context->gen_slice_data      = obj_context->gen_slice_data_free;
+        obj_context->gen_slice_data_free = NULL;
+    }
+    pthread_mutex_unlock(&obj_context->decode_lock);
+    surface_fence_begin_decode(obj_surface);
+
+    async_queue_push(obj_context->decode_queue, job);
+    return VDP_STATUS_OK;
+}
+
+// Returns the error of an earlier asynchronous submission, if any
+static VdpStatus
+decode_thread_get_status(object_context_p obj_context)
+{
+    VdpStatus vdp_status;
+
+    pthread_mutex_lock(&obj_context->decode_lock);
+    vdp_status = obj_context->decode_status;
+    obj_context->decode_status = VDP_STATUS_OK;
+    pthread_mutex_unlock(&obj_context->decode_lock);
+    return vdp_status;
+}
+
+// Reports decode statistics for the context
+void
+decode_stats_report(object_context_p obj_context)
+{
+    const vdpau_decode_stats_t * const stats = &obj_context->decode_stats;
+
+    if (!stats_enabled() || stats->num_pictures == 0)
+        return;
+
+    const uint64_t busy_time = stats->driver_time + stats->vdpau_time;
+    const uint64_t wall_time = stats->last_time - stats->first_time;
+    vdpau_information_message(
+        "context 0x%08x: %llu pictures, %llu slices, %llu bytes\n",
+        obj_context->context_id,
+        (unsigned long long)stats->num_pictures,
+        (unsigned long long)stats->num_slices,
+        (unsigned long long)stats->num_slice_bytes);
+    vdpau_information_message(
+        "context 0x%08x: %.1f pictures/s (%.1f wall-clock), "
+        "%llu ns/picture, %llu ns/slice in driver, "
+        "%.2f allocations/picture\n",
+        obj_context->context_id,
+        busy_time ? stats->num_pictures * 1e9 / busy_time : 0.0,
+        wall_time ? stats->num_pictures * 1e9 / wall_time : 0.0,
+        (unsigned long long)(stats->driver_time / stats->num_pictures),
+        (unsigned long long)(stats->num_slices ?
+                             stats->driver_time / stats->num_slices : 0),
+        (double)stats->num_allocations / stats->num_pictures);
+}
+
+// Begins decoding of a picture into the render target (context locked)
+static VAStatus
+begin_picture(
+    vdpau_driver_data_t *driver_data,
+    object_context_p     obj_context,
+    VASurfaceID          render_target
+)
+{
+    const uint64_t start_time = stats_enabled() ? get_ticks_nsec() : 0;
 
     object_surface_p obj_surface = VDPAU_SURFACE(render_target);
     if (!obj_surface)
         return VA_STATUS_ERROR_INVALID_SURFACE;
 
+    pthread_mutex_lock(&obj_surface->lock);
     obj_surface->va_surface_status           = VASurfaceRendering;
+    pthread_mutex_unlock(&obj_surface->lock);
     obj_context->last_pic_param              = NULL;
     obj_context->last_slice_params           = NULL;
     obj_context->last_slice_params_count     = 0;
     obj_context->current_render_target       = obj_surface->base.id;
-    obj_context->gen_slice_data_size         = 0;
     obj_context->vdp_bitstream_buffers_count = 0;
+    reset_gen_slice_data(obj_context);
 
     switch (obj_context->vdp_codec) {
     case VDP_CODEC_MPEG1:
@@ -1180,25 +1810,49 @@ vdpau_BeginPicture(
     }
 
     destroy_dead_va_buffers(driver_data, obj_context);
+
+    if (start_time) {
+        vdpau_decode_stats_t * const stats = &obj_context->decode_stats;
+        if (stats->first_time == 0)
+            stats->first_time = start_time;
+        stats->driver_time += get_ticks_nsec() - start_time;
+    }
     return VA_STATUS_SUCCESS;
 }
 
-// vaRenderPicture
+// vaBeginPicture
 VAStatus
-vdpau_RenderPicture(
+vdpau_BeginPicture(
     VADriverContextP    ctx,
     VAContextID         context,
-    VABufferID         *buffers,
-    int                 num_buffers
+    VASurfaceID         render_target
 )
 {
     VDPAU_DRIVER_DATA_INIT;
-    int i;
+    VAStatus va_status;
 
-    object_context_p obj_context = VDPAU_CONTEXT(context);
+    object_context_p obj_context = context_lock(driver_data, context);
     if (!obj_context)
         return VA_STATUS_ERROR_INVALID_CONTEXT;
 
+    va_status = begin_picture(driver_data, obj_context, render_target);
+    context_unlock(driver_data, obj_context);
+    return va_status;
+}
+
+// Translates the picture buffers into VDPAU structures (context locked)
+static VAStatus
+render_picture(
+    vdpau_driver_data_t *driver_data,
+    object_context_p     obj_context,
+    VABufferID          *buffers,
+    int                  num_buffers
+)
+{
+    int i;
+
+    const uint64_t start_time = stats_enabled() ? get_ticks_nsec() : 0;
+
     object_surface_p obj_surface = VDPAU_SURFACE(obj_context->current_render_target);
     if (!obj_surface)
         return VA_STATUS_ERROR_INVALID_SURFACE;
@@ -1215,6 +1869,10 @@ vdpau_RenderPicture(
         object_buffer_p obj_buffer = VDPAU_BUFFER(buffers[i]);
         if (!translate_buffer(driver_data, obj_context, obj_buffer))
             return VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
+        if (obj_buffer->type == VASliceParameterBufferType)
+            obj_context->decode_stats.num_slices += obj_buffer->num_elements;
+        else if (obj_buffer->type == VASliceDataBufferType)
+            obj_context->decode_stats.num_slice_bytes += obj_buffer->buffer_size;
         /* Release any buffer that is not VASliceDataBuffer */
         /* VASliceParameterBuffer is also needed to check for start_codes */
         switch (obj_buffer->type) {
@@ -1236,27 +1894,51 @@ vdpau_RenderPicture(
         buffers[i] = VA_INVALID_BUFFER;
     }
 
+    if (start_time)
+        obj_context->decode_stats.driver_time += get_ticks_nsec() - start_time;
     return VA_STATUS_SUCCESS;
 }
 
-// vaEndPicture
+// vaRenderPicture
 VAStatus
-vdpau_EndPicture(
+vdpau_RenderPicture(
     VADriverContextP    ctx,
-    VAContextID         context
+    VAContextID         context,
+    VABufferID         *buffers,
+    int                 num_buffers
 )
 {
     VDPAU_DRIVER_DATA_INIT;
-    unsigned int i;
+    VAStatus va_status;
 
-    object_context_p obj_context = VDPAU_CONTEXT(context);
+    object_context_p obj_context = context_lock(driver_data, context);
     if (!obj_context)
         return VA_STATUS_ERROR_INVALID_CONTEXT;
 
+    va_status = render_picture(driver_data, obj_context, buffers, num_buffers);
+    context_unlock(driver_data, obj_context);
+    return va_status;
+}
+
+// Submits the picture for decoding (context locked)
+static VAStatus
+end_picture(
+    vdpau_driver_data_t *driver_data,
+    object_context_p     obj_context
+)
+{
+    unsigned int i;
+
+    const uint64_t start_time = stats_enabled() ? get_ticks_nsec() : 0;
+
     object_surface_p obj_surface = VDPAU_SURFACE(obj_context->current_render_target);
     if (!obj_surface)
         return VA_STATUS_ERROR_INVALID_SURFACE;
 
+    /* On allocation failure, the scattered hunks are submitted as is */
+    if (bitstream_copy_enabled())
+        flatten_VdpBitstreamBuffers(obj_context);
+
     if (trace_enabled()) {
         switch (obj_context->vdp_codec) {
         case VDP_CODEC_MPEG1:
@@ -1283,12 +1965,26 @@ vdpau_EndPicture(
 
     VAStatus va_status;
     VdpStatus vdp_status;
+    uint64_t vdpau_time = 0;
     vdp_status = ensure_decoder_with_max_refs(
         driver_data,
         obj_context,
         get_num_ref_frames(obj_context)
     );
-    if (vdp_status == VDP_STATUS_OK)
+    int submitted = 0;
+    if (vdp_status == VDP_STATUS_OK && obj_context->decode_queue) {
+        /* An earlier picture failed asynchronously. The error is reported
+           now, but this picture is still decoded */
+        const VdpStatus async_status = decode_thread_get_status(obj_context);
+        vdp_status = decode_thread_submit(driver_data, obj_context,
+                                          obj_surface);
+        if (vdp_status == VDP_STATUS_OK) {
+            submitted  = 1;
+            vdp_status = async_status;
+        }
+    }
+    else if (vdp_status == VDP_STATUS_OK) {
+        const uint64_t render_time = start_time ? get_ticks_nsec() : 0;
         vdp_status = vdpau_decoder_render(
             driver_data,
             obj_context->vdp_decoder,
@@ -1297,13 +1993,53 @@ vdpau_EndPicture(
             obj_context->vdp_bitstream_buffers_count,
             obj_context->vdp_bitstream_buffers
         );
+        if (render_time)
+            vdpau_time = get_ticks_nsec() - render_time;
+        submitted = 1;
+    }
     va_status = vdpau_get_VAStatus(vdp_status);
 
+    /* The surface contents only change if the picture reached VDPAU */
+    if (submitted)
+        __atomic_add_fetch(&obj_surface->mtime, 1, __ATOMIC_RELEASE);
+    else {
+        pthread_mutex_lock(&obj_surface->lock);
+        obj_surface->va_surface_status = VASurfaceReady;
+        pthread_mutex_unlock(&obj_surface->lock);
+    }
+
     /* XXX: assume we are done with rendering right away */
     obj_context->current_render_target = VA_INVALID_SURFACE;
 
     /* Release pending buffers */
     destroy_dead_va_buffers(driver_data, obj_context);
 
+    vdpau_decode_stats_t * const stats = &obj_context->decode_stats;
+    stats->num_pictures++;
+    if (start_time) {
+        stats->last_time    = get_ticks_nsec();
+        stats->driver_time += stats->last_time - start_time - vdpau_time;
+        if (vdpau_time)
+            stats->vdpau_time += vdpau_time;
+    }
+    return va_status;
+}
+
+// vaEndPicture
+VAStatus
+vdpau_EndPicture(
+    VADriverContextP    ctx,
+    VAContextID         context
+)
+{
+    VDPAU_DRIVER_DATA_INIT;
+    VAStatus va_status;
+
+    object_context_p obj_context = context_lock(driver_data, context);
+    if (!obj_context)
+        return VA_STATUS_ERROR_INVALID_CONTEXT;
+
+    va_status = end_picture(driver_data, obj_context);
+    context_unlock(driver_data, obj_context);
     return va_status;
 }
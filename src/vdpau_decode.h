@@ -31,6 +31,38 @@ typedef enum {
     VDP_CODEC_VC1
 } VdpCodec;
 
+// Decode path statistics, reported when VDPAU_VIDEO_STATS=yes
+typedef struct vdpau_decode_stats vdpau_decode_stats_t;
+struct vdpau_decode_stats {
+    uint64_t                    num_pictures;
+    uint64_t                    num_slices;
+    uint64_t                    num_slice_bytes;
+    uint64_t                    num_allocations;
+    uint64_t                    driver_time;    // nsec, VDPAU excluded
+    uint64_t                    vdpau_time;     // nsec in VdpDecoderRender()
+    uint64_t                    first_time;
+    uint64_t                    last_time;
+};
+
+// Picture information for any of the supported codecs
+typedef union {
+    VdpPictureInfoMPEG1Or2      mpeg2;
+#if HAVE_VDPAU_MPEG4
+    VdpPictureInfoMPEG4Part2    mpeg4;
+#endif
+    VdpPictureInfoH264          h264;
+    VdpPictureInfoVC1           vc1;
+} vdpau_picture_info_t;
+
+// Number of VA buffer types that may be translated for decoding
+#define VDPAU_MAX_TRANSLATE_BUFFER_TYPES (VASliceDataBufferType + 1)
+
+// Translates a VA buffer into the VDPAU picture state of the context
+typedef int
+(*translate_buffer_func_t)(vdpau_driver_data_t *driver_data,
+                           object_context_p    obj_context,
+                           object_buffer_p     obj_buffer);
+
 // Translates VdpDecoderProfile to VdpCodec
 VdpCodec get_VdpCodec(VdpDecoderProfile profile)
     attribute_hidden;
@@ -47,6 +79,67 @@ check_decoder(
     VAEntrypoint         entrypoint
 ) attribute_hidden;
 
+// Chunk of generated slice data. Chunks are chained and never moved, so
+// that VdpBitstreamBuffer pointers into them stay valid for the picture
+typedef struct gen_slice_chunk gen_slice_chunk_t;
+struct gen_slice_chunk {
+    gen_slice_chunk_t          *next;
+    unsigned int                size;
+    unsigned int                used;
+    uint8_t                     data[];
+};
+
+// Resolves the translate functions for the context codec
+void
+init_translate_buffer_funcs(object_context_p obj_context)
+    attribute_hidden;
+
+// Returns TRUE if buffers of that type can be rendered to the context
+int
+is_supported_buffer_type(object_context_p obj_context, VABufferType type)
+    attribute_hidden;
+
+// Initialize idle decoders cache
+void
+decoder_cache_init(vdpau_driver_data_t *driver_data)
+    attribute_hidden;
+
+// Destroy all decoders retained by the cache
+void
+decoder_cache_destroy(vdpau_driver_data_t *driver_data)
+    attribute_hidden;
+
+// Releases the context decoder, keeping it in cache for later reuse
+void
+release_decoder(
+    vdpau_driver_data_t *driver_data,
+    object_context_p     obj_context
+) attribute_hidden;
+
+// Releases generated slice data chunks
+void
+destroy_gen_slice_data(object_context_p obj_context)
+    attribute_hidden;
+
+// Returns TRUE if decode submission is offloaded to a per-context thread
+int decode_async_enabled(void)
+    attribute_hidden;
+
+// Starts the asynchronous decode submission thread of the context
+int
+decode_thread_start(object_context_p obj_context)
+    attribute_hidden;
+
+// Stops the decode submission thread once all pending pictures are submitted
+void
+decode_thread_stop(object_context_p obj_context)
+    attribute_hidden;
+
+// Reports decode statistics for the context
+void
+decode_stats_report(object_context_p obj_context)
+    attribute_hidden;
+
 // vaQueryConfigProfiles
 VAStatus
 vdpau_QueryConfigProfiles(
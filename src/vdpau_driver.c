@@ -21,11 +21,14 @@
 #include "sysdeps.h"
 #include <ctype.h>
 #include "vdpau_driver.h"
+#include "utils.h"
 #include "vdpau_buffer.h"
+#include "vdpau_caps.h"
 #include "vdpau_decode.h"
 #include "vdpau_image.h"
 #include "vdpau_subpic.h"
 #include "vdpau_mixer.h"
+#include "vdpau_soft.h"
 #include "vdpau_video.h"
 #include "vdpau_video_x11.h"
 #if USE_GLX
@@ -157,6 +160,9 @@ static void
 vdpau_common_Terminate(vdpau_driver_data_t *driver_data)
 {
     DESTROY_HEAP(buffer,      destroy_buffer_cb);
+    buffer_pool_destroy(driver_data);
+    decoder_cache_destroy(driver_data);
+    copy_pool_destroy(driver_data);
     DESTROY_HEAP(image,       NULL);
     DESTROY_HEAP(subpicture,  NULL);
     DESTROY_HEAP(output,      NULL);
@@ -167,6 +173,7 @@ vdpau_common_Terminate(vdpau_driver_data_t *driver_data)
 #if USE_GLX
     DESTROY_HEAP(glx_surface, NULL);
 #endif
+    output_pool_destroy(driver_data);
 
     if (driver_data->vdp_device != VDP_INVALID_HANDLE) {
         vdpau_device_destroy(driver_data, driver_data->vdp_device);
@@ -181,22 +188,67 @@ vdpau_common_Terminate(vdpau_driver_data_t *driver_data)
     }
 }
 
+// Checks whether VDPAU procs are resolved on first use only
+static int vdpau_fast_start_enabled(void)
+{
+    static int g_fast_start = -1;
+    if (g_fast_start < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_FAST_START", &g_fast_start) < 0)
+            g_fast_start = 0;
+    }
+    return g_fast_start;
+}
+
+// Returns the time elapsed since the last phase, in microseconds
+static inline uint64_t get_phase_usec(uint64_t *ticks)
+{
+    uint64_t now, elapsed;
+
+    if (!*ticks)
+        return 0;
+    now = get_ticks_nsec();
+    elapsed = now - *ticks;
+    *ticks = now;
+    return elapsed / 1000;
+}
+
 // vaInitialize
 static VAStatus
 vdpau_common_Initialize(vdpau_driver_data_t *driver_data)
 {
-    /* Create a dedicated X11 display for VDPAU purposes */
-    const char * const x11_dpy_name = XDisplayString(driver_data->x11_dpy);
-    driver_data->vdp_dpy = XOpenDisplay(x11_dpy_name);
-    if (!driver_data->vdp_dpy) {
+    VdpDeviceCreateX11 *vdp_device_create = vdp_device_create_x11;
+    uint64_t ticks = stats_enabled() ? get_ticks_nsec() : 0;
+    uint64_t t_display, t_device, t_procs, t_caps, t_heaps;
+
+    if (vdpau_soft_enabled()) {
+        /* The software implementation does not talk to the X server */
+        driver_data->vdp_dpy = driver_data->x11_dpy;
+        driver_data->vdp_impl_type = VDP_IMPLEMENTATION_SOFTWARE;
+        vdp_device_create = vdpau_soft_device_create_x11;
+    }
+    else if (vdpau_fast_start_enabled()) {
+        /* A VDPAU device is bound to the display it was created on,
+           so it cannot move to a dedicated X11 display later on */
         driver_data->vdp_dpy = driver_data->x11_dpy;
         if (!driver_data->vdp_dpy)
             return VA_STATUS_ERROR_UNKNOWN;
     }
+    else {
+        /* Create a dedicated X11 display for VDPAU purposes */
+        const char * const x11_dpy_name = XDisplayString(driver_data->x11_dpy);
+        driver_data->vdp_dpy = XOpenDisplay(x11_dpy_name);
+        if (!driver_data->vdp_dpy) {
+            driver_data->vdp_dpy = driver_data->x11_dpy;
+            if (!driver_data->vdp_dpy)
+                return VA_STATUS_ERROR_UNKNOWN;
+        }
+    }
+
+    t_display = get_phase_usec(&ticks);
 
     VdpStatus vdp_status;
     driver_data->vdp_device = VDP_INVALID_HANDLE;
-    vdp_status = vdp_device_create_x11(
+    vdp_status = vdp_device_create(
         driver_data->vdp_dpy,
         driver_data->x11_screen,
         &driver_data->vdp_device,
@@ -204,8 +256,10 @@ vdpau_common_Initialize(vdpau_driver_data_t *driver_data)
     );
     if (vdp_status != VDP_STATUS_OK)
         return VA_STATUS_ERROR_UNKNOWN;
+    t_device = get_phase_usec(&ticks);
 
-    if (vdpau_gate_init(driver_data) < 0)
+    /* In fast-start mode, procs are resolved through VDPAU_INVOKE() */
+    if (!vdpau_fast_start_enabled() && vdpau_gate_init(driver_data) < 0)
         return VA_STATUS_ERROR_UNKNOWN;
 
     uint32_t api_version;
@@ -241,6 +295,11 @@ vdpau_common_Initialize(vdpau_driver_data_t *driver_data)
         }
     }
 
+    t_procs = get_phase_usec(&ticks);
+
+    vdpau_caps_init(driver_data, impl_string);
+    t_caps = get_phase_usec(&ticks);
+
     sprintf(driver_data->va_vendor, "%s %s - %d.%d.%d",
             VDPAU_STR_DRIVER_VENDOR,
             VDPAU_STR_DRIVER_NAME,
@@ -257,6 +316,10 @@ vdpau_common_Initialize(vdpau_driver_data_t *driver_data)
     CREATE_HEAP(context,        CONTEXT);
     CREATE_HEAP(surface,        SURFACE);
     CREATE_HEAP(buffer,         BUFFER);
+    buffer_pool_init(driver_data);
+    decoder_cache_init(driver_data);
+    output_pool_init(driver_data);
+    copy_pool_init(driver_data);
     CREATE_HEAP(output,         OUTPUT);
     CREATE_HEAP(image,          IMAGE);
     CREATE_HEAP(subpicture,     SUBPICTURE);
@@ -264,6 +327,16 @@ vdpau_common_Initialize(vdpau_driver_data_t *driver_data)
 #if USE_GLX
     CREATE_HEAP(glx_surface,    GLX_SURFACE);
 #endif
+    t_heaps = get_phase_usec(&ticks);
+
+    if (ticks)
+        vdpau_information_message(
+            "vaInitialize(): display %llu us, device %llu us, "
+            "procs %llu us, caps %llu us, heaps %llu us\n",
+            (unsigned long long)t_display, (unsigned long long)t_device,
+            (unsigned long long)t_procs, (unsigned long long)t_caps,
+            (unsigned long long)t_heaps
+        );
     return VA_STATUS_SUCCESS;
 }
 
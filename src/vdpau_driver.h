@@ -57,11 +57,15 @@
 #define VDPAU_MAX_PROFILES              12
 #define VDPAU_MAX_ENTRYPOINTS           5
 #define VDPAU_MAX_CONFIG_ATTRIBUTES     10
-#define VDPAU_MAX_IMAGE_FORMATS         10
+#define VDPAU_MAX_IMAGE_FORMATS         16
 #define VDPAU_MAX_SUBPICTURES           8
 #define VDPAU_MAX_SUBPICTURE_FORMATS    6
 #define VDPAU_MAX_DISPLAY_ATTRIBUTES    6
-#define VDPAU_MAX_OUTPUT_SURFACES       2
+#define VDPAU_MIN_OUTPUT_SURFACES       2
+#define VDPAU_MAX_OUTPUT_SURFACES       8
+#define VDPAU_BUFFER_POOL_CLASSES       17 /* 64 bytes .. 4 MB */
+#define VDPAU_OUTPUT_POOL_BUCKETS       16
+#define VDPAU_CAPS_MAX_DECODER_PROFILES 32
 #define VDPAU_STR_DRIVER_VENDOR         "Splitted-Desktop Systems"
 #define VDPAU_STR_DRIVER_NAME           "VDPAU backend for VA-API"
 
@@ -73,8 +77,63 @@
 
 typedef enum {
     VDP_IMPLEMENTATION_NVIDIA = 1,
+    VDP_IMPLEMENTATION_SOFTWARE,
 } VdpImplementation;
 
+typedef struct vdpau_buffer_pool vdpau_buffer_pool_t;
+struct vdpau_buffer_pool {
+    pthread_mutex_t             lock;
+    void                       *free_blocks[VDPAU_BUFFER_POOL_CLASSES];
+    unsigned int                size;
+    unsigned int                size_max;
+    uint64_t                    num_hits;
+    uint64_t                    num_misses;
+};
+
+typedef struct vdpau_decoder_caps vdpau_decoder_caps_t;
+struct vdpau_decoder_caps {
+    uint32_t                    is_supported;
+    uint32_t                    max_level;
+    uint32_t                    max_references;
+    uint32_t                    max_width;
+    uint32_t                    max_height;
+};
+
+// Device capabilities, probed once (see vdpau_caps.c)
+// NOTE: this is also the on-disk cache layout, keep it plain data
+typedef struct vdpau_caps vdpau_caps_t;
+struct vdpau_caps {
+    vdpau_decoder_caps_t        decoders[VDPAU_CAPS_MAX_DECODER_PROFILES];
+    uint32_t                    ycbcr_formats;      // VdpYCbCrFormat mask (4:2:0)
+    uint32_t                    rgba_formats;       // VdpRGBAFormat mask
+    uint32_t                    bitmap_formats;     // VdpRGBAFormat mask
+    uint32_t                    indexed_formats;    // VdpIndexedFormat mask
+    uint32_t                    hqscaling_levels;   // 1 << level mask
+};
+
+typedef struct vdpau_decoder_cache_entry vdpau_decoder_cache_entry_t;
+typedef struct vdpau_decoder_cache vdpau_decoder_cache_t;
+struct vdpau_decoder_cache {
+    pthread_mutex_t             lock;
+    vdpau_decoder_cache_entry_t *entries;   // most recently used first
+    unsigned int                size;
+    unsigned int                size_max;
+    uint64_t                    num_hits;
+    uint64_t                    num_misses;
+};
+
+typedef struct vdpau_output_pool_entry vdpau_output_pool_entry_t;
+typedef struct vdpau_output_pool vdpau_output_pool_t;
+struct vdpau_output_pool {
+    pthread_mutex_t             lock;
+    vdpau_output_pool_entry_t  *buckets[VDPAU_OUTPUT_POOL_BUCKETS]; // idle
+    vdpau_output_pool_entry_t  *pending;   // still queued for display
+    unsigned int                size;
+    unsigned int                size_max;
+    uint64_t                    num_hits;
+    uint64_t                    num_misses;
+};
+
 typedef struct vdpau_driver_data vdpau_driver_data_t;
 struct vdpau_driver_data {
     VADriverContextP            va_context;
@@ -88,6 +147,10 @@ struct vdpau_driver_data {
     struct object_heap          image_heap;
     struct object_heap          subpicture_heap;
     struct object_heap          mixer_heap;
+    vdpau_buffer_pool_t         buffer_pool;
+    vdpau_decoder_cache_t       decoder_cache;
+    vdpau_output_pool_t         output_pool;
+    struct image_copy_pool     *copy_pool;
     Display                    *x11_dpy;
     int                         x11_screen;
     Display                    *vdp_dpy;
@@ -96,6 +159,7 @@ struct vdpau_driver_data {
     vdpau_vtable_t              vdp_vtable;
     VdpImplementation           vdp_impl_type;
     uint32_t                    vdp_impl_version;
+    vdpau_caps_t                vdp_caps;
     VADisplayAttribute          va_display_attrs[VDPAU_MAX_DISPLAY_ATTRIBUTES];
     uint64_t                    va_display_attrs_mtime[VDPAU_MAX_DISPLAY_ATTRIBUTES];
     unsigned int                va_display_attrs_count;
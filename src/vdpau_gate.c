@@ -26,112 +26,153 @@
 #include "debug.h"
 
 
+// VDPAU procs, by offset in the vtable
+typedef struct {
+    VdpFuncId           func_id;
+    unsigned int        offset;
+} vdpau_proc_t;
+
+static const vdpau_proc_t vdpau_procs[] = {
+#define VDP_PROC(FUNC_ID, FUNC) \
+    { VDP_FUNC_ID_##FUNC_ID, offsetof(vdpau_vtable_t, vdp_##FUNC) }
+    VDP_PROC(DEVICE_DESTROY,
+             device_destroy),
+    VDP_PROC(GENERATE_CSC_MATRIX,
+             generate_csc_matrix),
+    VDP_PROC(VIDEO_SURFACE_CREATE,
+             video_surface_create),
+    VDP_PROC(VIDEO_SURFACE_DESTROY,
+             video_surface_destroy),
+    VDP_PROC(VIDEO_SURFACE_GET_BITS_Y_CB_CR,
+             video_surface_get_bits_ycbcr),
+    VDP_PROC(VIDEO_SURFACE_PUT_BITS_Y_CB_CR,
+             video_surface_put_bits_ycbcr),
+    VDP_PROC(OUTPUT_SURFACE_CREATE,
+             output_surface_create),
+    VDP_PROC(OUTPUT_SURFACE_DESTROY,
+             output_surface_destroy),
+    VDP_PROC(OUTPUT_SURFACE_GET_BITS_NATIVE,
+             output_surface_get_bits_native),
+    VDP_PROC(OUTPUT_SURFACE_PUT_BITS_NATIVE,
+             output_surface_put_bits_native),
+    VDP_PROC(OUTPUT_SURFACE_RENDER_BITMAP_SURFACE,
+             output_surface_render_bitmap_surface),
+    VDP_PROC(OUTPUT_SURFACE_RENDER_OUTPUT_SURFACE,
+             output_surface_render_output_surface),
+    VDP_PROC(OUTPUT_SURFACE_QUERY_PUT_BITS_INDEXED_CAPABILITIES,
+             output_surface_query_put_bits_indexed_capabilities),
+    VDP_PROC(OUTPUT_SURFACE_PUT_BITS_INDEXED,
+             output_surface_put_bits_indexed),
+    VDP_PROC(BITMAP_SURFACE_QUERY_CAPABILITIES,
+             bitmap_surface_query_capabilities),
+    VDP_PROC(BITMAP_SURFACE_CREATE,
+             bitmap_surface_create),
+    VDP_PROC(BITMAP_SURFACE_DESTROY,
+             bitmap_surface_destroy),
+    VDP_PROC(BITMAP_SURFACE_PUT_BITS_NATIVE,
+             bitmap_surface_put_bits_native),
+    VDP_PROC(VIDEO_MIXER_CREATE,
+             video_mixer_create),
+    VDP_PROC(VIDEO_MIXER_DESTROY,
+             video_mixer_destroy),
+    VDP_PROC(VIDEO_MIXER_RENDER,
+             video_mixer_render),
+    VDP_PROC(VIDEO_MIXER_QUERY_FEATURE_SUPPORT,
+             video_mixer_query_feature_support),
+    VDP_PROC(VIDEO_MIXER_GET_FEATURE_ENABLES,
+             video_mixer_get_feature_enables),
+    VDP_PROC(VIDEO_MIXER_SET_FEATURE_ENABLES,
+             video_mixer_set_feature_enables),
+    VDP_PROC(VIDEO_MIXER_QUERY_ATTRIBUTE_SUPPORT,
+             video_mixer_query_attribute_support),
+    VDP_PROC(VIDEO_MIXER_GET_ATTRIBUTE_VALUES,
+             video_mixer_get_attribute_values),
+    VDP_PROC(VIDEO_MIXER_SET_ATTRIBUTE_VALUES,
+             video_mixer_set_attribute_values),
+    VDP_PROC(PRESENTATION_QUEUE_CREATE,
+             presentation_queue_create),
+    VDP_PROC(PRESENTATION_QUEUE_DESTROY,
+             presentation_queue_destroy),
+    VDP_PROC(PRESENTATION_QUEUE_SET_BACKGROUND_COLOR,
+             presentation_queue_set_background_color),
+    VDP_PROC(PRESENTATION_QUEUE_GET_BACKGROUND_COLOR,
+             presentation_queue_get_background_color),
+    VDP_PROC(PRESENTATION_QUEUE_DISPLAY,
+             presentation_queue_display),
+    VDP_PROC(PRESENTATION_QUEUE_BLOCK_UNTIL_SURFACE_IDLE,
+             presentation_queue_block_until_surface_idle),
+    VDP_PROC(PRESENTATION_QUEUE_QUERY_SURFACE_STATUS,
+             presentation_queue_query_surface_status),
+    VDP_PROC(PRESENTATION_QUEUE_TARGET_CREATE_X11,
+             presentation_queue_target_create_x11),
+    VDP_PROC(PRESENTATION_QUEUE_TARGET_DESTROY,
+             presentation_queue_target_destroy),
+    VDP_PROC(DECODER_CREATE,
+             decoder_create),
+    VDP_PROC(DECODER_DESTROY,
+             decoder_destroy),
+    VDP_PROC(DECODER_RENDER,
+             decoder_render),
+    VDP_PROC(DECODER_QUERY_CAPABILITIES,
+             decoder_query_capabilities),
+    VDP_PROC(VIDEO_SURFACE_QUERY_GET_PUT_BITS_Y_CB_CR_CAPABILITIES,
+             video_surface_query_ycbcr_caps),
+    VDP_PROC(OUTPUT_SURFACE_QUERY_GET_PUT_BITS_NATIVE_CAPABILITIES,
+             output_surface_query_rgba_caps),
+    VDP_PROC(GET_API_VERSION,
+             get_api_version),
+    VDP_PROC(GET_INFORMATION_STRING,
+             get_information_string),
+    VDP_PROC(GET_ERROR_STRING,
+             get_error_string),
+#undef VDP_PROC
+};
+
+// Resolves a single VDPAU proc
+static int
+vdpau_gate_init_proc(vdpau_driver_data_t *driver_data, const vdpau_proc_t *proc)
+{
+    void **pfunc = (void **)((uint8_t *)&driver_data->vdp_vtable + proc->offset);
+    void *func = NULL;
+    VdpStatus vdp_status;
+
+    vdp_status = driver_data->vdp_get_proc_address(
+        driver_data->vdp_device,
+        proc->func_id,
+        &func
+    );
+    if (vdp_status != VDP_STATUS_OK || !func)
+        return 0;
+
+    __atomic_store_n(pfunc, func, __ATOMIC_RELEASE);
+    return 1;
+}
+
 // Initialize VDPAU hooks
 int vdpau_gate_init(vdpau_driver_data_t *driver_data)
 {
-    VdpStatus vdp_status;
+    unsigned int i;
 
-#define VDP_INIT_PROC(FUNC_ID, FUNC) do {                       \
-        vdp_status = driver_data->vdp_get_proc_address          \
-            (driver_data->vdp_device,                           \
-             VDP_FUNC_ID_##FUNC_ID,                             \
-             (void *)&driver_data->vdp_vtable.vdp_##FUNC);      \
-        if (vdp_status != VDP_STATUS_OK)                        \
-            return -1;                                          \
-    } while (0)
-
-    VDP_INIT_PROC(DEVICE_DESTROY,
-                  device_destroy);
-    VDP_INIT_PROC(GENERATE_CSC_MATRIX,
-                  generate_csc_matrix);
-    VDP_INIT_PROC(VIDEO_SURFACE_CREATE,
-                  video_surface_create);
-    VDP_INIT_PROC(VIDEO_SURFACE_DESTROY,
-                  video_surface_destroy);
-    VDP_INIT_PROC(VIDEO_SURFACE_GET_BITS_Y_CB_CR,
-                  video_surface_get_bits_ycbcr);
-    VDP_INIT_PROC(VIDEO_SURFACE_PUT_BITS_Y_CB_CR,
-                  video_surface_put_bits_ycbcr);
-    VDP_INIT_PROC(OUTPUT_SURFACE_CREATE,
-                  output_surface_create);
-    VDP_INIT_PROC(OUTPUT_SURFACE_DESTROY,
-                  output_surface_destroy);
-    VDP_INIT_PROC(OUTPUT_SURFACE_GET_BITS_NATIVE,
-                  output_surface_get_bits_native);
-    VDP_INIT_PROC(OUTPUT_SURFACE_PUT_BITS_NATIVE,
-                  output_surface_put_bits_native);
-    VDP_INIT_PROC(OUTPUT_SURFACE_RENDER_BITMAP_SURFACE,
-                  output_surface_render_bitmap_surface);
-    VDP_INIT_PROC(OUTPUT_SURFACE_RENDER_OUTPUT_SURFACE,
-                  output_surface_render_output_surface);
-    VDP_INIT_PROC(OUTPUT_SURFACE_QUERY_PUT_BITS_INDEXED_CAPABILITIES,
-                  output_surface_query_put_bits_indexed_capabilities);
-    VDP_INIT_PROC(OUTPUT_SURFACE_PUT_BITS_INDEXED,
-                  output_surface_put_bits_indexed);
-    VDP_INIT_PROC(BITMAP_SURFACE_QUERY_CAPABILITIES,
-                  bitmap_surface_query_capabilities);
-    VDP_INIT_PROC(BITMAP_SURFACE_CREATE,
-                  bitmap_surface_create);
-    VDP_INIT_PROC(BITMAP_SURFACE_DESTROY,
-                  bitmap_surface_destroy);
-    VDP_INIT_PROC(BITMAP_SURFACE_PUT_BITS_NATIVE,
-                  bitmap_surface_put_bits_native);
-    VDP_INIT_PROC(VIDEO_MIXER_CREATE,
-                  video_mixer_create);
-    VDP_INIT_PROC(VIDEO_MIXER_DESTROY,
-                  video_mixer_destroy);
-    VDP_INIT_PROC(VIDEO_MIXER_RENDER,
-                  video_mixer_render);
-    VDP_INIT_PROC(VIDEO_MIXER_QUERY_FEATURE_SUPPORT,
-                  video_mixer_query_feature_support);
-    VDP_INIT_PROC(VIDEO_MIXER_GET_FEATURE_ENABLES,
-                  video_mixer_get_feature_enables);
-    VDP_INIT_PROC(VIDEO_MIXER_SET_FEATURE_ENABLES,
-                  video_mixer_set_feature_enables);
-    VDP_INIT_PROC(VIDEO_MIXER_QUERY_ATTRIBUTE_SUPPORT,
-                  video_mixer_query_attribute_support);
-    VDP_INIT_PROC(VIDEO_MIXER_GET_ATTRIBUTE_VALUES,
-                  video_mixer_get_attribute_values);
-    VDP_INIT_PROC(VIDEO_MIXER_SET_ATTRIBUTE_VALUES,
-                  video_mixer_set_attribute_values);
-    VDP_INIT_PROC(PRESENTATION_QUEUE_CREATE,
-                  presentation_queue_create);
-    VDP_INIT_PROC(PRESENTATION_QUEUE_DESTROY,
-                  presentation_queue_destroy);
-    VDP_INIT_PROC(PRESENTATION_QUEUE_SET_BACKGROUND_COLOR,
-                  presentation_queue_set_background_color);
-    VDP_INIT_PROC(PRESENTATION_QUEUE_GET_BACKGROUND_COLOR,
-                  presentation_queue_get_background_color);
-    VDP_INIT_PROC(PRESENTATION_QUEUE_DISPLAY,
-                  presentation_queue_display);
-    VDP_INIT_PROC(PRESENTATION_QUEUE_BLOCK_UNTIL_SURFACE_IDLE,
-                  presentation_queue_block_until_surface_idle);
-    VDP_INIT_PROC(PRESENTATION_QUEUE_QUERY_SURFACE_STATUS,
-                  presentation_queue_query_surface_status);
-    VDP_INIT_PROC(PRESENTATION_QUEUE_TARGET_CREATE_X11,
-                  presentation_queue_target_create_x11);
-    VDP_INIT_PROC(PRESENTATION_QUEUE_TARGET_DESTROY,
-                  presentation_queue_target_destroy);
-    VDP_INIT_PROC(DECODER_CREATE,
-                  decoder_create);
-    VDP_INIT_PROC(DECODER_DESTROY,
-                  decoder_destroy);
-    VDP_INIT_PROC(DECODER_RENDER,
-                  decoder_render);
-    VDP_INIT_PROC(DECODER_QUERY_CAPABILITIES,
-                  decoder_query_capabilities);
-    VDP_INIT_PROC(VIDEO_SURFACE_QUERY_GET_PUT_BITS_Y_CB_CR_CAPABILITIES,
-                  video_surface_query_ycbcr_caps);
-    VDP_INIT_PROC(OUTPUT_SURFACE_QUERY_GET_PUT_BITS_NATIVE_CAPABILITIES,
-                  output_surface_query_rgba_caps);
-    VDP_INIT_PROC(GET_API_VERSION,
-                  get_api_version);
-    VDP_INIT_PROC(GET_INFORMATION_STRING,
-                  get_information_string);
-    VDP_INIT_PROC(GET_ERROR_STRING,
-                  get_error_string);
-
-#undef VDP_INIT_PROC
+    for (i = 0; i < ARRAY_ELEMS(vdpau_procs); i++) {
+        if (!vdpau_gate_init_proc(driver_data, &vdpau_procs[i]))
+            return -1;
+    }
+    return 0;
+}
+
+// Resolves the VDPAU proc at the specified vtable offset, on first use
+static int
+vdpau_gate_resolve(vdpau_driver_data_t *driver_data, unsigned int offset)
+{
+    unsigned int i;
+
+    if (!driver_data->vdp_get_proc_address)
+        return 0;
+
+    for (i = 0; i < ARRAY_ELEMS(vdpau_procs); i++) {
+        if (vdpau_procs[i].offset == offset)
+            return vdpau_gate_init_proc(driver_data, &vdpau_procs[i]);
+    }
     return 0;
 }
 
@@ -157,9 +198,13 @@ int vdpau_check_status(
     return 1;
 }
 
-#define VDPAU_INVOKE_(retval, func, ...)               \
-    (driver_data && driver_data->vdp_vtable.vdp_##func \
-     ? driver_data->vdp_vtable.vdp_##func(__VA_ARGS__) \
+#define VDPAU_INVOKE_(retval, func, ...)                        \
+    (driver_data &&                                             \
+     (__atomic_load_n(&driver_data->vdp_vtable.vdp_##func,      \
+                      __ATOMIC_ACQUIRE) ||                      \
+      vdpau_gate_resolve(driver_data,                           \
+          offsetof(vdpau_vtable_t, vdp_##func)))                \
+     ? driver_data->vdp_vtable.vdp_##func(__VA_ARGS__)          \
      : (retval))
 
 #define VDPAU_INVOKE(func, ...)                        \
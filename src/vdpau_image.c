@@ -22,7 +22,11 @@
 #include "vdpau_image.h"
 #include "vdpau_video.h"
 #include "vdpau_buffer.h"
+#include "vdpau_caps.h"
 #include "vdpau_mixer.h"
+#include "utils.h"
+#include "image_convert.h"
+#include <unistd.h>
 
 #define DEBUG 1
 #include "debug.h"
@@ -36,6 +40,7 @@ typedef struct {
     unsigned int        num_palette_entries;
     unsigned int        entry_bytes;
     char                component_order[4];
+    ImageConvert        convert;
 } vdpau_image_format_map_t;
 
 static const vdpau_image_format_map_t vdpau_image_formats_map[] = {
@@ -48,22 +53,37 @@ static const vdpau_image_format_map_t vdpau_image_formats_map[] = {
 #define DEF_IDX(TYPE, FORMAT, FOURCC, ENDIAN, BPP, NPE, EB, C0,C1,C2,C3) \
     { DEF(TYPE, FORMAT), { VA_FOURCC FOURCC, VA_##ENDIAN##_FIRST, BPP, }, \
       NPE, EB, { C0, C1, C2, C3 } }
+#define DEF_CNV(TYPE, FORMAT, FOURCC, ENDIAN, BPP, CONVERT) \
+    { DEF(TYPE, FORMAT), { VA_FOURCC FOURCC, VA_##ENDIAN##_FIRST, BPP, }, \
+      0, 0, { 0, }, IMAGE_CONVERT_##CONVERT }
     DEF_YUV(YCBCR, NV12,        ('N','V','1','2'), LSB, 12),
     DEF_YUV(YCBCR, YV12,        ('Y','V','1','2'), LSB, 12),
     DEF_YUV(YCBCR, YV12,        ('I','4','2','0'), LSB, 12), // swap U/V planes
     DEF_YUV(YCBCR, UYVY,        ('U','Y','V','Y'), LSB, 16),
     DEF_YUV(YCBCR, YUYV,        ('Y','U','Y','V'), LSB, 16),
+    DEF_YUV(YCBCR, YUYV,        ('Y','U','Y','2'), LSB, 16),
     DEF_YUV(YCBCR, V8U8Y8A8,    ('A','Y','U','V'), LSB, 32),
+    DEF_CNV(YCBCR, NV12,        ('N','V','2','1'), LSB, 12, NV21),
+    DEF_CNV(YCBCR, NV12,        ('P','0','1','0'), LSB, 24, P010),
+    DEF_CNV(YCBCR, NV12,        ('P','0','1','6'), LSB, 24, P016),
 #ifdef WORDS_BIGENDIAN
     DEF_RGB(RGBA, B8G8R8A8,     ('A','R','G','B'), MSB, 32,
             32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000),
     DEF_RGB(RGBA, R8G8B8A8,     ('A','B','G','R'), MSB, 32,
             32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000),
+    DEF_RGB(RGBA, B8G8R8A8,     ('X','R','G','B'), MSB, 32,
+            24, 0x00ff0000, 0x0000ff00, 0x000000ff, 0x00000000),
+    DEF_RGB(RGBA, R8G8B8A8,     ('X','B','G','R'), MSB, 32,
+            24, 0x000000ff, 0x0000ff00, 0x00ff0000, 0x00000000),
 #else
     DEF_RGB(RGBA, B8G8R8A8,     ('B','G','R','A'), LSB, 32,
             32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000),
     DEF_RGB(RGBA, R8G8B8A8,     ('R','G','B','A'), LSB, 32,
             32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000),
+    DEF_RGB(RGBA, B8G8R8A8,     ('B','G','R','X'), LSB, 32,
+            24, 0x00ff0000, 0x0000ff00, 0x000000ff, 0x00000000),
+    DEF_RGB(RGBA, R8G8B8A8,     ('R','G','B','X'), LSB, 32,
+            24, 0x000000ff, 0x0000ff00, 0x00ff0000, 0x00000000),
 #endif
     DEF_IDX(INDEXED, A4I4,      ('A','I','4','4'), MSB, 8,
             16, 3, 'R','G','B',0),
@@ -73,6 +93,7 @@ static const vdpau_image_format_map_t vdpau_image_formats_map[] = {
             256, 3, 'R','G','B',0),
     DEF_IDX(INDEXED, I8A8,      ('I','A','8','8'), MSB, 16,
             256, 3, 'R','G','B',0),
+#undef DEF_CNV
 #undef DEF_IDX
 #undef DEF_RGB
 #undef DEF_YUV
@@ -97,6 +118,96 @@ static const vdpau_image_format_map_t *get_format(const VAImageFormat *format)
     return NULL;
 }
 
+// Returns the VA image format for the specified VDPAU format
+static const VAImageFormat *
+get_va_format(VdpImageFormatType type, uint32_t format)
+{
+    unsigned int i;
+    for (i = 0; i < ARRAY_ELEMS(vdpau_image_formats_map); i++) {
+        const vdpau_image_format_map_t * const m = &vdpau_image_formats_map[i];
+        if (m->vdp_format_type == type && m->vdp_format == format &&
+            m->convert == IMAGE_CONVERT_NONE)
+            return &m->va_format;
+    }
+    return NULL;
+}
+
+// Checks whether derived images are written back to their surface on unmap.
+// This hashes the image on map and unmap, so that images the client did
+// not modify are not uploaded, hence off by default
+static int derive_image_writeback_enabled(void)
+{
+    static int g_writeback = -1;
+    if (g_writeback < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_DERIVE_IMAGE_WRITEBACK", &g_writeback) < 0)
+            g_writeback = 0;
+    }
+    return g_writeback;
+}
+
+// Returns the color space used to convert RGB images to video surfaces
+static ImageColorspace get_rgb_colorspace(void)
+{
+    static int g_bt709 = -1;
+    if (g_bt709 < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_RGB_BT709", &g_bt709) < 0)
+            g_bt709 = 0;
+    }
+    return g_bt709 ? IMAGE_COLORSPACE_BT709 : IMAGE_COLORSPACE_BT601;
+}
+
+// Copy engine defaults: one thread per CPU up to 4, for copies of 1 MB
+// or more. VDPAU_VIDEO_COPY_THREADS overrides the thread count as is
+#define COPY_THREADS_MAX                4
+#define COPY_THREADS_MIN_SIZE_DEFAULT   (1 << 20)
+
+// Returns the number of threads used for large copies, the caller included
+static unsigned int get_copy_threads(void)
+{
+    static int g_copy_threads = -1;
+    if (g_copy_threads < 0) {
+        if (getenv_int("VDPAU_VIDEO_COPY_THREADS", &g_copy_threads) < 0 ||
+            g_copy_threads < 0) {
+            const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            g_copy_threads = MIN(num_cpus > 0 ? num_cpus : 1, COPY_THREADS_MAX);
+        }
+    }
+    return g_copy_threads;
+}
+
+// Returns the minimum size of a copy split across threads, in bytes
+static unsigned int get_copy_threads_min_size(void)
+{
+    static int g_copy_min_size = -1;
+    if (g_copy_min_size < 0) {
+        if (getenv_int("VDPAU_VIDEO_COPY_THREADS_MIN_SIZE", &g_copy_min_size) < 0 ||
+            g_copy_min_size < 0)
+            g_copy_min_size = COPY_THREADS_MIN_SIZE_DEFAULT;
+    }
+    return g_copy_min_size;
+}
+
+// Initialize the copy engine used for image readback and upload. Its
+// workers only start on the first large copy
+void
+copy_pool_init(vdpau_driver_data_t *driver_data)
+{
+    const unsigned int num_threads = get_copy_threads();
+
+    driver_data->copy_pool = image_copy_pool_new(
+        num_threads > 1 ? num_threads - 1 : 0,
+        get_copy_threads_min_size()
+    );
+}
+
+// Destroy the copy engine
+void
+copy_pool_destroy(vdpau_driver_data_t *driver_data)
+{
+    image_copy_pool_free(driver_data->copy_pool);
+    driver_data->copy_pool = NULL;
+}
+
 // Checks whether the VDPAU implementation supports the specified image format
 static inline VdpBool
 is_supported_format(
@@ -105,30 +216,15 @@ is_supported_format(
     uint32_t             format
 )
 {
-    VdpBool is_supported = VDP_FALSE;
-    VdpStatus vdp_status;
-
     switch (type) {
     case VDP_IMAGE_FORMAT_TYPE_YCBCR:
-        vdp_status =
-            vdpau_video_surface_query_ycbcr_caps(driver_data,
-                                                 driver_data->vdp_device,
-                                                 VDP_CHROMA_TYPE_420,
-                                                 format,
-                                                 &is_supported);
-        break;
+        return vdpau_caps_has_format(driver_data, VDPAU_CAPS_FORMAT_YCBCR, format);
     case VDP_IMAGE_FORMAT_TYPE_RGBA:
-        vdp_status =
-            vdpau_output_surface_query_rgba_caps(driver_data,
-                                                 driver_data->vdp_device,
-                                                 format,
-                                                 &is_supported);
-        break;
+        return vdpau_caps_has_format(driver_data, VDPAU_CAPS_FORMAT_RGBA, format);
     default:
-        vdp_status = VDP_STATUS_INVALID_VALUE;
         break;
     }
-    return vdp_status == VDP_STATUS_OK && is_supported;
+    return VDP_FALSE;
 }
 
 // vaQueryImageFormats
@@ -212,6 +308,7 @@ vdpau_CreateImage(
 
     switch (format->fourcc) {
     case VA_FOURCC('N','V','1','2'):
+    case VA_FOURCC('N','V','2','1'):
         image->num_planes = 2;
         image->pitches[0] = width;
         image->offsets[0] = 0;
@@ -230,10 +327,29 @@ vdpau_CreateImage(
         image->offsets[2] = size + size2;
         image->data_size  = size + 2 * size2;
         break;
+    case VA_FOURCC('P','0','1','0'):
+    case VA_FOURCC('P','0','1','6'):
+        image->num_planes = 2;
+        image->pitches[0] = width * 2;
+        image->offsets[0] = 0;
+        image->pitches[1] = width2 * 4;
+        image->offsets[1] = size * 2;
+        image->data_size  = (size + 2 * size2) * 2;
+        break;
+    case VA_FOURCC('Y','U','Y','2'):
+        image->num_planes = 1;
+        image->pitches[0] = width2 * 4;
+        image->offsets[0] = 0;
+        image->data_size  = image->offsets[0] + image->pitches[0] * height;
+        break;
     case VA_FOURCC('A','R','G','B'):
     case VA_FOURCC('A','B','G','R'):
     case VA_FOURCC('B','G','R','A'):
     case VA_FOURCC('R','G','B','A'):
+    case VA_FOURCC('X','R','G','B'):
+    case VA_FOURCC('X','B','G','R'):
+    case VA_FOURCC('B','G','R','X'):
+    case VA_FOURCC('R','G','B','X'):
     case VA_FOURCC('U','Y','V','Y'):
     case VA_FOURCC('Y','U','Y','V'):
         image->num_planes = 1;
@@ -283,7 +399,13 @@ vdpau_CreateImage(
     obj_image->vdp_rgba_output_surface = VDP_INVALID_HANDLE;
     obj_image->vdp_format_type  = m->vdp_format_type;
     obj_image->vdp_format       = m->vdp_format;
+    obj_image->convert          = m->convert;
     obj_image->vdp_palette      = NULL;
+    obj_image->derived_surface  = VA_INVALID_ID;
+    obj_image->derived_mtime    = 0;
+    obj_image->derived_checksum = 0;
+    obj_image->derived_map_count = 0;
+    obj_image->derived_refcount = 0;
 
     image->image_id             = image_id;
     image->format               = *format;
@@ -317,6 +439,24 @@ vdpau_DestroyImage(
     if (!obj_image)
         return VA_STATUS_ERROR_INVALID_IMAGE;
 
+    /* Derived images live until the last vaDeriveImage() reference is
+       released. References are only taken under the surface lock, while
+       the image is attached to its surface */
+    if (obj_image->derived_refcount > 0) {
+        object_surface_p obj_surface = VDPAU_SURFACE(obj_image->derived_surface);
+        if (obj_surface)
+            pthread_mutex_lock(&obj_surface->lock);
+        const unsigned int refcount =
+            __atomic_sub_fetch(&obj_image->derived_refcount, 1, __ATOMIC_ACQ_REL);
+        if (obj_surface) {
+            if (refcount == 0 && obj_surface->derived_image == image_id)
+                obj_surface->derived_image = VA_INVALID_ID;
+            pthread_mutex_unlock(&obj_surface->lock);
+        }
+        if (refcount > 0)
+            return VA_STATUS_SUCCESS;
+    }
+
     if (obj_image->vdp_rgba_output_surface != VDP_INVALID_HANDLE)
         vdpau_output_surface_destroy(driver_data,
                                      obj_image->vdp_rgba_output_surface);
@@ -339,8 +479,241 @@ vdpau_DeriveImage(
     VAImage             *image
 )
 {
-    /* TODO */
-    return VA_STATUS_ERROR_OPERATION_FAILED;
+    VDPAU_DRIVER_DATA_INIT;
+
+    VAStatus va_status;
+    const VAImageFormat *format;
+
+    if (!image)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    object_surface_p obj_surface = VDPAU_SURFACE(surface);
+    if (!obj_surface)
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    pthread_mutex_lock(&obj_surface->lock);
+
+    /* Only one image is derived from a given surface. Each call takes a
+       reference, released by vaDestroyImage() */
+    object_image_p obj_image = VDPAU_IMAGE(obj_surface->derived_image);
+    if (obj_image) {
+        __atomic_add_fetch(&obj_image->derived_refcount, 1, __ATOMIC_ACQ_REL);
+        *image = obj_image->image;
+        va_status = VA_STATUS_SUCCESS;
+        goto end;
+    }
+
+    /* The image is filled in lazily, on vaMapBuffer() */
+    if (is_supported_format(driver_data, VDP_IMAGE_FORMAT_TYPE_YCBCR,
+                            VDP_YCBCR_FORMAT_NV12))
+        format = get_va_format(VDP_IMAGE_FORMAT_TYPE_YCBCR,
+                               VDP_YCBCR_FORMAT_NV12);
+    else if (is_supported_format(driver_data, VDP_IMAGE_FORMAT_TYPE_YCBCR,
+                                 VDP_YCBCR_FORMAT_YV12))
+        format = get_va_format(VDP_IMAGE_FORMAT_TYPE_YCBCR,
+                               VDP_YCBCR_FORMAT_YV12);
+    else {
+        va_status = VA_STATUS_ERROR_OPERATION_FAILED;
+        goto end;
+    }
+
+    va_status = vdpau_CreateImage(ctx, (VAImageFormat *)format,
+                                  obj_surface->width, obj_surface->height,
+                                  image);
+    if (va_status != VA_STATUS_SUCCESS)
+        goto end;
+
+    obj_image = VDPAU_IMAGE(image->image_id);
+    object_buffer_p obj_buffer = VDPAU_BUFFER(image->buf);
+    if (!obj_image || !obj_buffer) {
+        va_status = VA_STATUS_ERROR_INVALID_IMAGE;
+        goto end;
+    }
+    obj_image->derived_surface  = surface;
+    obj_image->derived_refcount = 1;
+    obj_buffer->derived_image   = image->image_id;
+    obj_surface->derived_image  = image->image_id;
+
+ end:
+    pthread_mutex_unlock(&obj_surface->lock);
+    return va_status;
+}
+
+// Returns the VDPAU plane pointers and strides of the image
+static VAStatus
+get_image_planes(
+    vdpau_driver_data_t *driver_data,
+    object_image_p       obj_image,
+    uint8_t             *planes[3],
+    uint32_t             pitches[3]
+)
+{
+    VAImage * const image = &obj_image->image;
+    int i;
+
+    object_buffer_p obj_buffer = VDPAU_BUFFER(image->buf);
+    if (!obj_buffer)
+        return VA_STATUS_ERROR_INVALID_BUFFER;
+
+    switch (image->format.fourcc) {
+    case VA_FOURCC('I','4','2','0'):
+        planes[0] = (uint8_t *)obj_buffer->buffer_data + image->offsets[0];
+        pitches[0] = image->pitches[0];
+        planes[1] = (uint8_t *)obj_buffer->buffer_data + image->offsets[2];
+        pitches[1] = image->pitches[2];
+        planes[2] = (uint8_t *)obj_buffer->buffer_data + image->offsets[1];
+        pitches[2] = image->pitches[1];
+        break;
+    default:
+        for (i = 0; i < image->num_planes; i++) {
+            planes[i] = (uint8_t *)obj_buffer->buffer_data + image->offsets[i];
+            pitches[i] = image->pitches[i];
+        }
+        break;
+    }
+    return VA_STATUS_SUCCESS;
+}
+
+// Returns a checksum of the image data, used to detect client writes
+static uint64_t
+get_image_checksum(vdpau_driver_data_t *driver_data, object_image_p obj_image)
+{
+    uint64_t h[4] = { 1, 2, 3, 4 }, w;
+    unsigned int i, n;
+
+    object_buffer_p obj_buffer = VDPAU_BUFFER(obj_image->image.buf);
+    if (!obj_buffer || !obj_buffer->buffer_data)
+        return 0;
+
+    /* Four independent lanes, to keep the multiplier busy */
+    const uint8_t * const data = obj_buffer->buffer_data;
+    const unsigned int size = obj_buffer->buffer_size;
+    for (i = 0, n = size & ~31U; i < n; i += 32) {
+        memcpy(&w, &data[i +  0], 8); h[0] = (h[0] ^ w) * 0x100000001b3ULL;
+        memcpy(&w, &data[i +  8], 8); h[1] = (h[1] ^ w) * 0x100000001b3ULL;
+        memcpy(&w, &data[i + 16], 8); h[2] = (h[2] ^ w) * 0x100000001b3ULL;
+        memcpy(&w, &data[i + 24], 8); h[3] = (h[3] ^ w) * 0x100000001b3ULL;
+    }
+    for (; i < size; i++)
+        h[0] = (h[0] ^ data[i]) * 0x100000001b3ULL;
+    return h[0] ^ (h[1] << 1 | h[1] >> 63) ^ (h[2] << 2 | h[2] >> 62) ^
+        (h[3] << 3 | h[3] >> 61);
+}
+
+// Reads the surface back into the derived image, if it changed since
+VAStatus
+derived_image_map(
+    vdpau_driver_data_t *driver_data,
+    object_image_p       obj_image
+)
+{
+    VAStatus va_status = VA_STATUS_SUCCESS;
+    VdpStatus vdp_status;
+    uint8_t *planes[3];
+    uint32_t pitches[3];
+    uint64_t mtime;
+
+    object_surface_p obj_surface = VDPAU_SURFACE(obj_image->derived_surface);
+    if (!obj_surface)
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    surface_fence_wait_decode(obj_surface);
+
+    pthread_mutex_lock(&obj_surface->lock);
+    mtime = __atomic_load_n(&obj_surface->mtime, __ATOMIC_ACQUIRE);
+    if (obj_image->derived_map_count == 0 && obj_image->derived_mtime != mtime) {
+        va_status = get_image_planes(driver_data, obj_image, planes, pitches);
+        if (va_status != VA_STATUS_SUCCESS)
+            goto end;
+
+        vdp_status = vdpau_video_surface_get_bits_ycbcr(
+            driver_data,
+            obj_surface->vdp_surface,
+            obj_image->vdp_format,
+            planes, pitches
+        );
+        va_status = vdpau_get_VAStatus(vdp_status);
+        if (va_status != VA_STATUS_SUCCESS)
+            goto end;
+        obj_image->derived_mtime = mtime;
+    }
+    if (obj_image->derived_map_count == 0 && derive_image_writeback_enabled())
+        obj_image->derived_checksum = get_image_checksum(driver_data, obj_image);
+    obj_image->derived_map_count++;
+
+ end:
+    pthread_mutex_unlock(&obj_surface->lock);
+    return va_status;
+}
+
+// Writes the derived image back to its surface, on the last unmap
+VAStatus
+derived_image_unmap(
+    vdpau_driver_data_t *driver_data,
+    object_image_p       obj_image
+)
+{
+    VAStatus va_status = VA_STATUS_SUCCESS;
+    VdpStatus vdp_status;
+    uint8_t *planes[3];
+    uint32_t pitches[3];
+
+    object_surface_p obj_surface = VDPAU_SURFACE(obj_image->derived_surface);
+    if (!obj_surface)
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    pthread_mutex_lock(&obj_surface->lock);
+    if (obj_image->derived_map_count == 0 ||
+        --obj_image->derived_map_count > 0 ||
+        !derive_image_writeback_enabled())
+        goto end;
+
+    /* Skip the upload if the client only read the image */
+    if (get_image_checksum(driver_data, obj_image) == obj_image->derived_checksum)
+        goto end;
+
+    va_status = get_image_planes(driver_data, obj_image, planes, pitches);
+    if (va_status != VA_STATUS_SUCCESS)
+        goto end;
+
+    vdp_status = vdpau_video_surface_put_bits_ycbcr(
+        driver_data,
+        obj_surface->vdp_surface,
+        obj_image->vdp_format,
+        planes, pitches
+    );
+    va_status = vdpau_get_VAStatus(vdp_status);
+    if (va_status != VA_STATUS_SUCCESS)
+        goto end;
+
+    /* The image now matches the surface contents */
+    obj_image->derived_mtime =
+        __atomic_add_fetch(&obj_surface->mtime, 1, __ATOMIC_RELEASE);
+
+ end:
+    pthread_mutex_unlock(&obj_surface->lock);
+    return va_status;
+}
+
+// Detaches the derived image from the surface being destroyed (surface locked)
+void
+derived_image_detach(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface
+)
+{
+    object_image_p obj_image = VDPAU_IMAGE(obj_surface->derived_image);
+    obj_surface->derived_image = VA_INVALID_ID;
+    if (!obj_image)
+        return;
+
+    /* The client still owns the image, it becomes a plain image that
+       keeps the last contents read back */
+    object_buffer_p obj_buffer = VDPAU_BUFFER(obj_image->image.buf);
+    if (obj_buffer)
+        obj_buffer->derived_image = VA_INVALID_ID;
+    obj_image->derived_surface   = VA_INVALID_ID;
+    obj_image->derived_map_count = 0;
 }
 
 // Set image palette
@@ -387,6 +760,207 @@ vdpau_SetImagePalette(
     return set_image_palette(driver_data, obj_image, palette);
 }
 
+/* Staging buffer planes are aligned on cache lines */
+#define STAGING_ALIGN 64
+
+// Layout of a YCbCr plane: bytes per sample, horizontal and vertical
+// subsampling (log2)
+typedef struct {
+    unsigned int        bpp;
+    unsigned int        hshift;
+    unsigned int        vshift;
+} ycbcr_plane_t;
+
+// Returns the number of planes of the YCbCr format, and their layout
+static unsigned int
+get_ycbcr_planes(uint32_t vdp_format, ycbcr_plane_t planes[3])
+{
+    static const ycbcr_plane_t luma   = { 1, 0, 0 };
+    static const ycbcr_plane_t chroma = { 1, 1, 1 };
+
+    switch (vdp_format) {
+    case VDP_YCBCR_FORMAT_NV12:
+        planes[0] = luma;
+        planes[1] = chroma;
+        planes[1].bpp = 2;      /* interleaved Cb/Cr */
+        return 2;
+    case VDP_YCBCR_FORMAT_YV12:
+        planes[0] = luma;
+        planes[1] = chroma;
+        planes[2] = chroma;
+        return 3;
+    case VDP_YCBCR_FORMAT_UYVY:
+    case VDP_YCBCR_FORMAT_YUYV:
+        planes[0].bpp    = 4;   /* one macropixel spans two pixels */
+        planes[0].hshift = 1;
+        planes[0].vshift = 0;
+        return 1;
+    case VDP_YCBCR_FORMAT_Y8U8V8A8:
+    case VDP_YCBCR_FORMAT_V8U8Y8A8:
+        planes[0].bpp    = 4;
+        planes[0].hshift = 0;
+        planes[0].vshift = 0;
+        return 1;
+    }
+    return 0;
+}
+
+// Returns the size of a plane spanning LENGTH pixels once subsampled
+static inline unsigned int
+get_plane_length(unsigned int length, unsigned int shift)
+{
+    return (length + (1U << shift) - 1) >> shift;
+}
+
+// Releases the surface readback staging buffer
+void
+surface_staging_destroy(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface
+)
+{
+    if (obj_surface->staging_block) {
+        buffer_pool_free(driver_data, obj_surface->staging_block,
+                         obj_surface->staging_size);
+        obj_surface->staging_block = NULL;
+    }
+    obj_surface->staging_size  = 0;
+    obj_surface->staging_mtime = 0;
+}
+
+// Reads the surface back into its staging buffer, unless the buffer
+// already holds the current surface contents (surface locked). If the
+// caller is about to overwrite it all, the buffer is only allocated
+static VAStatus
+surface_staging_update(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface,
+    uint32_t             vdp_format,
+    uint8_t             *planes[3],
+    uint32_t             pitches[3],
+    int                  readback
+)
+{
+    ycbcr_plane_t layout[3];
+    unsigned int i, num_planes, size, offset;
+    uint64_t mtime;
+
+    num_planes = get_ycbcr_planes(vdp_format, layout);
+    if (num_planes == 0)
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+
+    for (i = 0, size = 0; i < num_planes; i++) {
+        const unsigned int width  =
+            get_plane_length(obj_surface->width, layout[i].hshift);
+        const unsigned int height =
+            get_plane_length(obj_surface->height, layout[i].vshift);
+        pitches[i] = (width * layout[i].bpp + STAGING_ALIGN - 1) & -STAGING_ALIGN;
+        size += pitches[i] * height;
+    }
+    size += STAGING_ALIGN - 1;
+
+    if (obj_surface->staging_size != size) {
+        surface_staging_destroy(driver_data, obj_surface);
+        obj_surface->staging_block = buffer_pool_alloc(driver_data, size, NULL);
+        if (!obj_surface->staging_block)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        obj_surface->staging_size = size;
+    }
+
+    offset = -(uintptr_t)obj_surface->staging_block & (STAGING_ALIGN - 1);
+    for (i = 0; i < num_planes; i++) {
+        planes[i] = (uint8_t *)obj_surface->staging_block + offset;
+        offset += pitches[i] *
+            get_plane_length(obj_surface->height, layout[i].vshift);
+    }
+
+    mtime = __atomic_load_n(&obj_surface->mtime, __ATOMIC_ACQUIRE);
+    if (!readback ||
+        (obj_surface->staging_mtime == mtime &&
+         obj_surface->staging_format == vdp_format))
+        return VA_STATUS_SUCCESS;
+
+    VdpStatus vdp_status;
+    vdp_status = vdpau_video_surface_get_bits_ycbcr(
+        driver_data,
+        obj_surface->vdp_surface,
+        vdp_format,
+        planes, pitches
+    );
+    if (vdp_status != VDP_STATUS_OK) {
+        obj_surface->staging_mtime = 0;
+        return vdpau_get_VAStatus(vdp_status);
+    }
+    obj_surface->staging_format = vdp_format;
+    obj_surface->staging_mtime  = mtime;
+    return VA_STATUS_SUCCESS;
+}
+
+// Get a YCbCr image from a sub-rectangle of the surface, cropped from
+// the staging buffer and converted from NV12 if needed
+static VAStatus
+get_image_rect(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface,
+    object_image_p       obj_image,
+    const VARectangle   *rect,
+    uint8_t             *dst[3],
+    uint32_t             dst_stride[3]
+)
+{
+    VAImage * const image = &obj_image->image;
+    ycbcr_plane_t layout[3];
+    uint8_t *src[3];
+    uint32_t src_stride[3];
+    unsigned int i, num_planes;
+    VAStatus va_status;
+
+    if (rect->x < 0 || rect->y < 0 ||
+        rect->x + rect->width  > obj_surface->width ||
+        rect->y + rect->height > obj_surface->height ||
+        rect->width  > image->width ||
+        rect->height > image->height)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    /* Subsampled planes must start on a whole chroma sample, or the
+       chroma rows and columns would not fit in the image planes */
+    num_planes = get_ycbcr_planes(obj_image->vdp_format, layout);
+    for (i = 0; i < num_planes; i++) {
+        const unsigned int hmask = (1U << layout[i].hshift) - 1;
+        const unsigned int vmask = (1U << layout[i].vshift) - 1;
+        if ((rect->x & hmask) || (rect->y & vmask))
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    pthread_mutex_lock(&obj_surface->lock);
+    va_status = surface_staging_update(
+        driver_data,
+        obj_surface,
+        obj_image->vdp_format,
+        src, src_stride,
+        1
+    );
+    if (va_status == VA_STATUS_SUCCESS) {
+        for (i = 0; i < num_planes; i++) {
+            const unsigned int x0 = rect->x >> layout[i].hshift;
+            const unsigned int y0 = rect->y >> layout[i].vshift;
+            const unsigned int x1 =
+                get_plane_length(rect->x + rect->width, layout[i].hshift);
+            const unsigned int y1 =
+                get_plane_length(rect->y + rect->height, layout[i].vshift);
+
+            image_convert_from_nv12(
+                driver_data->copy_pool, obj_image->convert, i,
+                dst[i], dst_stride[i],
+                src[i] + y0 * src_stride[i] + x0 * layout[i].bpp, src_stride[i],
+                (x1 - x0) * layout[i].bpp, y1 - y0
+            );
+        }
+    }
+    pthread_mutex_unlock(&obj_surface->lock);
+    return va_status;
+}
+
 // Get image from surface
 static VAStatus
 get_image(
@@ -396,41 +970,28 @@ get_image(
     const VARectangle   *rect
 )
 {
-    VAImage * const image = &obj_image->image;
+    VAStatus va_status;
     VdpStatus vdp_status;
     uint8_t *src[3];
-    unsigned int src_stride[3];
-    int i;
+    uint32_t src_stride[3];
 
-    object_buffer_p obj_buffer = VDPAU_BUFFER(image->buf);
-    if (!obj_buffer)
-        return VA_STATUS_ERROR_INVALID_BUFFER;
+    surface_fence_wait_decode(obj_surface);
 
-    switch (image->format.fourcc) {
-    case VA_FOURCC('I','4','2','0'):
-        src[0] = (uint8_t *)obj_buffer->buffer_data + image->offsets[0];
-        src_stride[0] = image->pitches[0];
-        src[1] = (uint8_t *)obj_buffer->buffer_data + image->offsets[2];
-        src_stride[1] = image->pitches[2];
-        src[2] = (uint8_t *)obj_buffer->buffer_data + image->offsets[1];
-        src_stride[2] = image->pitches[1];
-        break;
-    default:
-        for (i = 0; i < image->num_planes; i++) {
-            src[i] = (uint8_t *)obj_buffer->buffer_data + image->offsets[i];
-            src_stride[i] = image->pitches[i];
-        }
-        break;
-    }
+    va_status = get_image_planes(driver_data, obj_image, src, src_stride);
+    if (va_status != VA_STATUS_SUCCESS)
+        return va_status;
 
     switch (obj_image->vdp_format_type) {
     case VDP_IMAGE_FORMAT_TYPE_YCBCR: {
-        /* VDPAU only supports full video surface readback */
+        /* VDPAU only supports full video surface readback, so crop
+           sub-rectangles from a copy of the whole surface */
         if (rect->x != 0 ||
             rect->y != 0 ||
             obj_surface->width  != rect->width ||
-            obj_surface->height != rect->height)
-            return VA_STATUS_ERROR_OPERATION_FAILED;
+            obj_surface->height != rect->height ||
+            obj_image->convert != IMAGE_CONVERT_NONE)
+            return get_image_rect(driver_data, obj_surface, obj_image,
+                                  rect, src, src_stride);
 
         vdp_status = vdpau_video_surface_get_bits_ycbcr(
             driver_data,
@@ -454,6 +1015,13 @@ get_image(
                 return vdpau_get_VAStatus(vdp_status);
         }
 
+        object_mixer_p obj_mixer;
+        pthread_mutex_lock(&obj_surface->lock);
+        obj_mixer = video_mixer_ensure(driver_data, obj_surface);
+        pthread_mutex_unlock(&obj_surface->lock);
+        if (!obj_mixer)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
         VdpRect vdp_rect;
         vdp_rect.x0 = rect->x;
         vdp_rect.y0 = rect->y;
@@ -461,7 +1029,7 @@ get_image(
         vdp_rect.y1 = rect->y + rect->height;
         vdp_status = video_mixer_render(
             driver_data,
-            obj_surface->video_mixer,
+            obj_mixer,
             obj_surface,
             VDP_INVALID_HANDLE,
             obj_image->vdp_rgba_output_surface,
@@ -516,6 +1084,180 @@ vdpau_GetImage(
     return get_image(driver_data, obj_surface, obj_image, &rect);
 }
 
+// Uploads the staging buffer to the surface (surface locked)
+static VAStatus
+surface_staging_commit(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface,
+    uint32_t             vdp_format,
+    uint8_t             *planes[3],
+    uint32_t             pitches[3]
+)
+{
+    VdpStatus vdp_status;
+
+    vdp_status = vdpau_video_surface_put_bits_ycbcr(
+        driver_data,
+        obj_surface->vdp_surface,
+        vdp_format,
+        planes, pitches
+    );
+    if (vdp_status != VDP_STATUS_OK) {
+        obj_surface->staging_mtime = 0;
+        return vdpau_get_VAStatus(vdp_status);
+    }
+
+    /* The staging buffer now matches the surface contents */
+    obj_surface->staging_format = vdp_format;
+    obj_surface->staging_mtime  =
+        __atomic_add_fetch(&obj_surface->mtime, 1, __ATOMIC_RELEASE);
+    return VA_STATUS_SUCCESS;
+}
+
+// Put a YCbCr image to a sub-rectangle of the surface, through the
+// staging buffer, converting it to NV12 if needed (surface locked)
+static VAStatus
+put_image_rect(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface,
+    object_image_p       obj_image,
+    const VARectangle   *src_rect,
+    const VARectangle   *dst_rect,
+    uint8_t             *src[3],
+    uint32_t             src_stride[3]
+)
+{
+    const unsigned int scale = image_convert_scale(obj_image->convert);
+    ycbcr_plane_t layout[3];
+    uint8_t *dst[3];
+    uint32_t dst_stride[3];
+    unsigned int i, num_planes;
+    VAStatus va_status;
+
+    /* Subsampled planes must start on a whole chroma sample, like
+       put_image_rgba() requires */
+    num_planes = get_ycbcr_planes(obj_image->vdp_format, layout);
+    for (i = 0; i < num_planes; i++) {
+        const unsigned int hmask = (1U << layout[i].hshift) - 1;
+        const unsigned int vmask = (1U << layout[i].vshift) - 1;
+        if (((dst_rect->x | src_rect->x) & hmask) ||
+            ((dst_rect->y | src_rect->y) & vmask))
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    /* No need to read the surface back if it is overwritten entirely */
+    va_status = surface_staging_update(
+        driver_data,
+        obj_surface,
+        obj_image->vdp_format,
+        dst, dst_stride,
+        dst_rect->width  != obj_surface->width ||
+        dst_rect->height != obj_surface->height
+    );
+    if (va_status != VA_STATUS_SUCCESS)
+        return va_status;
+
+    for (i = 0; i < num_planes; i++) {
+        const unsigned int dx0 = dst_rect->x >> layout[i].hshift;
+        const unsigned int dy0 = dst_rect->y >> layout[i].vshift;
+        const unsigned int dx1 =
+            get_plane_length(dst_rect->x + dst_rect->width, layout[i].hshift);
+        const unsigned int dy1 =
+            get_plane_length(dst_rect->y + dst_rect->height, layout[i].vshift);
+        const unsigned int sx0 = src_rect->x >> layout[i].hshift;
+        const unsigned int sy0 = src_rect->y >> layout[i].vshift;
+
+        image_convert_to_nv12(
+            driver_data->copy_pool, obj_image->convert, i,
+            dst[i] + dy0 * dst_stride[i] + dx0 * layout[i].bpp, dst_stride[i],
+            src[i] + sy0 * src_stride[i] + sx0 * layout[i].bpp * scale,
+            src_stride[i],
+            (dx1 - dx0) * layout[i].bpp, dy1 - dy0
+        );
+    }
+    return surface_staging_commit(driver_data, obj_surface,
+                                  obj_image->vdp_format, dst, dst_stride);
+}
+
+// Put an RGBA image to a sub-rectangle of the surface, converting it to
+// 4:2:0 YCbCr in the staging buffer (surface locked)
+static VAStatus
+put_image_rgba(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface,
+    object_image_p       obj_image,
+    const VARectangle   *src_rect,
+    const VARectangle   *dst_rect,
+    uint8_t             *src[3],
+    uint32_t             src_stride[3]
+)
+{
+    uint8_t *dst[3], *dst_cb, *dst_cr;
+    uint32_t dst_stride[3], vdp_format;
+    unsigned int chroma_step;
+    uint8_t rgb_offsets[3];
+    VAStatus va_status;
+
+    switch (obj_image->vdp_format) {
+    case VDP_RGBA_FORMAT_B8G8R8A8:
+        rgb_offsets[0] = 2; rgb_offsets[1] = 1; rgb_offsets[2] = 0;
+        break;
+    case VDP_RGBA_FORMAT_R8G8B8A8:
+        rgb_offsets[0] = 0; rgb_offsets[1] = 1; rgb_offsets[2] = 2;
+        break;
+    default:
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+    }
+
+    /* Chroma is subsampled: the target must start on a 2x2 block */
+    if ((dst_rect->x | dst_rect->y) & 1)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    if (is_supported_format(driver_data, VDP_IMAGE_FORMAT_TYPE_YCBCR,
+                            VDP_YCBCR_FORMAT_NV12))
+        vdp_format = VDP_YCBCR_FORMAT_NV12;
+    else if (is_supported_format(driver_data, VDP_IMAGE_FORMAT_TYPE_YCBCR,
+                                 VDP_YCBCR_FORMAT_YV12))
+        vdp_format = VDP_YCBCR_FORMAT_YV12;
+    else
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+
+    /* No need to read the surface back if it is overwritten entirely */
+    va_status = surface_staging_update(
+        driver_data,
+        obj_surface,
+        vdp_format,
+        dst, dst_stride,
+        dst_rect->width  != obj_surface->width ||
+        dst_rect->height != obj_surface->height
+    );
+    if (va_status != VA_STATUS_SUCCESS)
+        return va_status;
+
+    if (vdp_format == VDP_YCBCR_FORMAT_NV12) {
+        dst_cb = dst[1] + (dst_rect->y / 2) * dst_stride[1] + dst_rect->x;
+        dst_cr = dst_cb + 1;
+        chroma_step = 2;
+    }
+    else {
+        dst_cr = dst[1] + (dst_rect->y / 2) * dst_stride[1] + dst_rect->x / 2;
+        dst_cb = dst[2] + (dst_rect->y / 2) * dst_stride[2] + dst_rect->x / 2;
+        chroma_step = 1;
+    }
+
+    image_rgb32_to_yuv420(
+        driver_data->copy_pool,
+        dst[0] + dst_rect->y * dst_stride[0] + dst_rect->x, dst_stride[0],
+        dst_cb, dst_cr, dst_stride[1], chroma_step,
+        src[0] + src_rect->y * src_stride[0] + src_rect->x * 4, src_stride[0],
+        rgb_offsets,
+        dst_rect->width, dst_rect->height,
+        get_rgb_colorspace()
+    );
+    return surface_staging_commit(driver_data, obj_surface,
+                                  vdp_format, dst, dst_stride);
+}
+
 // Put image to surface
 static VAStatus
 put_image(
@@ -527,10 +1269,12 @@ put_image(
 )
 {
     VAImage * const image = &obj_image->image;
+    VAStatus va_status;
     VdpStatus vdp_status;
     uint8_t *src[3];
-    unsigned int src_stride[3];
-    int i;
+    uint32_t src_stride[3];
+
+    surface_fence_wait_decode(obj_surface);
 
 #if 0
     /* Don't do anything if the surface is used for rendering for example */
@@ -539,57 +1283,61 @@ put_image(
         return VA_STATUS_ERROR_SURFACE_BUSY;
 #endif
 
-    /* RGBA to video surface requires color space conversion */
-    if (obj_image->vdp_rgba_output_surface != VDP_INVALID_HANDLE)
-        return VA_STATUS_ERROR_OPERATION_FAILED;
-
-    /* VDPAU does not support partial video surface updates */
-    if (src_rect->x != 0 ||
-        src_rect->y != 0 ||
-        src_rect->width != image->width ||
-        src_rect->height != image->height)
-        return VA_STATUS_ERROR_OPERATION_FAILED;
-    if (dst_rect->x != 0 ||
-        dst_rect->y != 0 ||
-        dst_rect->width != obj_surface->width ||
-        dst_rect->height != obj_surface->height)
-        return VA_STATUS_ERROR_OPERATION_FAILED;
+    /* VDPAU does not support scaling images to video surfaces */
     if (src_rect->width != dst_rect->width ||
         src_rect->height != dst_rect->height)
         return VA_STATUS_ERROR_OPERATION_FAILED;
 
-    object_buffer_p obj_buffer = VDPAU_BUFFER(image->buf);
-    if (!obj_buffer)
-        return VA_STATUS_ERROR_INVALID_BUFFER;
+    if (src_rect->x < 0 || src_rect->y < 0 ||
+        src_rect->x + src_rect->width  > image->width ||
+        src_rect->y + src_rect->height > image->height ||
+        dst_rect->x < 0 || dst_rect->y < 0 ||
+        dst_rect->x + dst_rect->width  > obj_surface->width ||
+        dst_rect->y + dst_rect->height > obj_surface->height)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
 
-    switch (image->format.fourcc) {
-    case VA_FOURCC('I','4','2','0'):
-        src[0] = (uint8_t *)obj_buffer->buffer_data + image->offsets[0];
-        src_stride[0] = image->pitches[0];
-        src[1] = (uint8_t *)obj_buffer->buffer_data + image->offsets[2];
-        src_stride[1] = image->pitches[2];
-        src[2] = (uint8_t *)obj_buffer->buffer_data + image->offsets[1];
-        src_stride[2] = image->pitches[1];
-        break;
-    default:
-        for (i = 0; i < image->num_planes; i++) {
-            src[i] = (uint8_t *)obj_buffer->buffer_data + image->offsets[i];
-            src_stride[i] = image->pitches[i];
+    va_status = get_image_planes(driver_data, obj_image, src, src_stride);
+    if (va_status != VA_STATUS_SUCCESS)
+        return va_status;
+
+    switch (obj_image->vdp_format_type) {
+    case VDP_IMAGE_FORMAT_TYPE_YCBCR:
+        /* VDPAU only supports full video surface updates, so patch
+           sub-rectangles into a copy of the whole surface */
+        if (src_rect->x != 0 ||
+            src_rect->y != 0 ||
+            src_rect->width != image->width ||
+            src_rect->height != image->height ||
+            dst_rect->width != obj_surface->width ||
+            dst_rect->height != obj_surface->height ||
+            obj_image->convert != IMAGE_CONVERT_NONE) {
+            pthread_mutex_lock(&obj_surface->lock);
+            va_status = put_image_rect(driver_data, obj_surface, obj_image,
+                                       src_rect, dst_rect, src, src_stride);
+            pthread_mutex_unlock(&obj_surface->lock);
+            return va_status;
         }
+
+        vdp_status = vdpau_video_surface_put_bits_ycbcr(
+            driver_data,
+            obj_surface->vdp_surface,
+            obj_image->vdp_format,
+            src, src_stride
+        );
+        if (vdp_status == VDP_STATUS_OK)
+            __atomic_add_fetch(&obj_surface->mtime, 1, __ATOMIC_RELEASE);
+        return vdpau_get_VAStatus(vdp_status);
+    case VDP_IMAGE_FORMAT_TYPE_RGBA:
+        /* RGBA to video surface requires color space conversion */
+        pthread_mutex_lock(&obj_surface->lock);
+        va_status = put_image_rgba(driver_data, obj_surface, obj_image,
+                                   src_rect, dst_rect, src, src_stride);
+        pthread_mutex_unlock(&obj_surface->lock);
+        return va_status;
+    default:
         break;
     }
-
-    /* XXX: only support YCbCr surfaces for now */
-    if (obj_image->vdp_format_type != VDP_IMAGE_FORMAT_TYPE_YCBCR)
-        return VA_STATUS_ERROR_OPERATION_FAILED;
-
-    vdp_status = vdpau_video_surface_put_bits_ycbcr(
-        driver_data,
-        obj_surface->vdp_surface,
-        obj_image->vdp_format,
-        src, src_stride
-    );
-    return vdpau_get_VAStatus(vdp_status);
+    return VA_STATUS_ERROR_OPERATION_FAILED;
 }
 
 // vaPutImage
@@ -22,6 +22,7 @@
 #define VDPAU_IMAGE_H
 
 #include "vdpau_driver.h"
+#include "image_convert.h"
 
 typedef enum {
     VDP_IMAGE_FORMAT_TYPE_YCBCR = 1,
@@ -35,8 +36,14 @@ struct object_image {
     VAImage             image;
     VdpImageFormatType  vdp_format_type;
     uint32_t            vdp_format;
+    ImageConvert        convert;            /* from/to vdp_format (NV12) */
     VdpOutputSurface    vdp_rgba_output_surface;
     uint32_t           *vdp_palette;
+    VASurfaceID         derived_surface;    /* surface the image derives from */
+    uint64_t            derived_mtime;      /* surface mtime of the image data */
+    uint64_t            derived_checksum;   /* image data on the first map */
+    unsigned int        derived_map_count;
+    unsigned int        derived_refcount;   /* vaDeriveImage() calls */
 };
 
 // vaQueryImageFormats
@@ -72,6 +79,44 @@ vdpau_DeriveImage(
     VAImage            *image
 ) attribute_hidden;
 
+// Reads the surface back into the derived image, if it changed since
+VAStatus
+derived_image_map(
+    vdpau_driver_data_t *driver_data,
+    object_image_p       obj_image
+) attribute_hidden;
+
+// Writes the derived image back to its surface, on the last unmap
+VAStatus
+derived_image_unmap(
+    vdpau_driver_data_t *driver_data,
+    object_image_p       obj_image
+) attribute_hidden;
+
+// Detaches the derived image from the surface being destroyed (surface locked)
+void
+derived_image_detach(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface
+) attribute_hidden;
+
+// Initialize the copy engine used for image readback and upload
+void
+copy_pool_init(vdpau_driver_data_t *driver_data)
+    attribute_hidden;
+
+// Destroy the copy engine
+void
+copy_pool_destroy(vdpau_driver_data_t *driver_data)
+    attribute_hidden;
+
+// Releases the surface readback staging buffer
+void
+surface_staging_destroy(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface
+) attribute_hidden;
+
 // vaSetImagePalette
 VAStatus
 vdpau_SetImagePalette(
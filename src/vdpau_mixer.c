@@ -45,26 +45,6 @@ video_mixer_init_deint_surfaces(object_mixer_p obj_mixer)
         obj_mixer->deint_surfaces[i] = VDP_INVALID_HANDLE;
 }
 
-/** Checks wether video mixer supports a specific feature */
-static inline VdpBool
-video_mixer_has_feature(
-    vdpau_driver_data_t *driver_data,
-    VdpVideoMixerFeature feature
-)
-{
-    VdpBool is_supported = VDP_FALSE;
-    VdpStatus status;
-
-    status = vdpau_video_mixer_query_feature_support(
-        driver_data,
-        driver_data->vdp_device,
-        feature,
-        &is_supported
-    );
-    return (VDPAU_CHECK_STATUS(status, "VdpVideoMixerQueryFeatureSupport()") &&
-            is_supported);
-}
-
 object_mixer_p
 video_mixer_create(
     vdpau_driver_data_t *driver_data,
@@ -107,12 +87,13 @@ video_mixer_create(
     params[n_params]         = VDP_VIDEO_MIXER_PARAMETER_CHROMA_TYPE;
     param_values[n_params++] = &obj_mixer->vdp_chroma_type;
 
-    VdpVideoMixerFeature feature, features[VDPAU_MAX_VIDEO_MIXER_FEATURES];
+    VdpVideoMixerFeature features[VDPAU_MAX_VIDEO_MIXER_FEATURES];
     unsigned int i, n_features = 0;
+    const uint32_t hqscaling_levels = driver_data->vdp_caps.hqscaling_levels;
     for (i = 1; i <= 9; i++) {
-        feature = VDP_VIDEO_MIXER_FEATURE_HIGH_QUALITY_SCALING_L1 + i - 1;
-        if (video_mixer_has_feature(driver_data, feature)) {
-            features[n_features++] = feature;
+        if (hqscaling_levels & (1U << i)) {
+            features[n_features++] =
+                VDP_VIDEO_MIXER_FEATURE_HIGH_QUALITY_SCALING_L1 + i - 1;
             obj_mixer->hqscaling_level = i;
         }
     }
@@ -156,6 +137,20 @@ video_mixer_create_cached(
     return video_mixer_create(driver_data, obj_surface);
 }
 
+// Returns the video mixer of the surface, creating it on first use
+// NOTE: the surface lock must be held
+object_mixer_p
+video_mixer_ensure(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface
+)
+{
+    if (!obj_surface->video_mixer)
+        obj_surface->video_mixer = video_mixer_create_cached(driver_data,
+                                                             obj_surface);
+    return obj_surface->video_mixer;
+}
+
 void
 video_mixer_destroy(
     vdpau_driver_data_t *driver_data,
@@ -384,6 +379,9 @@ video_mixer_render(
     unsigned int         flags
 )
 {
+    /* The surface must hold the decoded picture before it is mixed */
+    surface_fence_wait_decode(obj_surface);
+
     VdpColorStandard vdp_colorspace;
     if (flags & VA_SRC_SMPTE_240)
         vdp_colorspace = VDP_COLOR_STANDARD_SMPTE_240M;
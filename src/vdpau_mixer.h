@@ -54,6 +54,12 @@ video_mixer_create_cached(
     object_surface_p     obj_surface
 ) attribute_hidden;
 
+object_mixer_p
+video_mixer_ensure(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface
+) attribute_hidden;
+
 void
 video_mixer_destroy(
     vdpau_driver_data_t *driver_data,
@@ -0,0 +1,2094 @@
+/*
+ *  vdpau_soft.c - Software VDPAU implementation (host memory)
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+/*
+ * This is a stand-in for a real VDPAU device. Video surfaces, output
+ * surfaces and bitmaps live in host memory, the decoder only validates
+ * its arguments and the presentation queue runs on a simulated clock
+ * that advances by one refresh period per displayed surface. It lets
+ * the driver run on machines without a GPU (or an X server) so that its
+ * own CPU overhead can be measured in isolation.
+ */
+
+#include "sysdeps.h"
+#include "vdpau_soft.h"
+#include "utils.h"
+#include <pthread.h>
+#include <math.h>
+
+#define DEBUG 1
+#include "debug.h"
+
+#define SOFT_INFORMATION_STRING "Software VDPAU stand-in (libva-vdpau-driver)"
+#define SOFT_MAX_SIZE           4096
+#define SOFT_REFRESH_PERIOD     16666667 /* nsec, i.e. 60 Hz */
+#define SOFT_MAX_MIXER_FEATURES 32
+
+typedef enum {
+    SOFT_OBJECT_DEVICE = 1,
+    SOFT_OBJECT_VIDEO_SURFACE,
+    SOFT_OBJECT_OUTPUT_SURFACE,
+    SOFT_OBJECT_BITMAP_SURFACE,
+    SOFT_OBJECT_DECODER,
+    SOFT_OBJECT_VIDEO_MIXER,
+    SOFT_OBJECT_PRESENTATION_QUEUE_TARGET,
+    SOFT_OBJECT_PRESENTATION_QUEUE
+} soft_object_type_t;
+
+typedef struct soft_object soft_object_t;
+struct soft_object {
+    soft_object_type_t          type;
+    VdpDevice                   device;
+};
+
+typedef struct soft_video_surface soft_video_surface_t;
+struct soft_video_surface {
+    soft_object_t               base;
+    VdpChromaType               chroma_type;
+    uint32_t                    width;
+    uint32_t                    height;
+    uint32_t                    chroma_width;
+    uint32_t                    chroma_height;
+    uint8_t                    *planes[3];
+    uint32_t                    pitches[3];
+};
+
+typedef struct soft_rgba_surface soft_rgba_surface_t;
+struct soft_rgba_surface {
+    soft_object_t               base;
+    VdpRGBAFormat               rgba_format;
+    uint32_t                    width;
+    uint32_t                    height;
+    uint32_t                   *pixels;
+    VdpPresentationQueue        queue;
+    VdpPresentationQueueStatus  queue_status;
+    VdpTime                     presentation_time;
+};
+
+typedef struct soft_decoder soft_decoder_t;
+struct soft_decoder {
+    soft_object_t               base;
+    VdpDecoderProfile           profile;
+    uint32_t                    width;
+    uint32_t                    height;
+    uint32_t                    max_references;
+};
+
+typedef struct soft_video_mixer soft_video_mixer_t;
+struct soft_video_mixer {
+    soft_object_t               base;
+    uint32_t                    width;
+    uint32_t                    height;
+    VdpChromaType               chroma_type;
+    VdpColor                    background_color;
+    VdpCSCMatrix                csc_matrix;
+    VdpBool                     features[SOFT_MAX_MIXER_FEATURES];
+};
+
+typedef struct soft_presentation_queue_target soft_presentation_queue_target_t;
+struct soft_presentation_queue_target {
+    soft_object_t               base;
+    Drawable                    drawable;
+};
+
+typedef struct soft_presentation_queue soft_presentation_queue_t;
+struct soft_presentation_queue {
+    soft_object_t               base;
+    VdpPresentationQueueTarget  target;
+    VdpColor                    background_color;
+    VdpTime                     clock;
+    VdpOutputSurface            visible_surface;
+};
+
+/* ====================================================================== */
+/* === Handles                                                          === */
+/* ====================================================================== */
+
+static pthread_mutex_t  g_handles_lock = PTHREAD_MUTEX_INITIALIZER;
+static soft_object_t  **g_handles;
+static unsigned int     g_handles_count_max;
+
+// Returns TRUE if the software VDPAU implementation was requested
+int vdpau_soft_enabled(void)
+{
+    static int g_soft_enabled = -1;
+    if (g_soft_enabled < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_SOFTWARE", &g_soft_enabled) < 0)
+            g_soft_enabled = 0;
+    }
+    return g_soft_enabled;
+}
+
+// Registers OBJ and returns its handle
+static uint32_t
+soft_handle_create(soft_object_t *obj)
+{
+    uint32_t handle = VDP_INVALID_HANDLE;
+    unsigned int i;
+
+    pthread_mutex_lock(&g_handles_lock);
+    for (i = 0; i < g_handles_count_max; i++) {
+        if (!g_handles[i])
+            break;
+    }
+    if (i == g_handles_count_max) {
+        unsigned int count_max = MAX(2 * g_handles_count_max, 64);
+        soft_object_t **handles;
+        handles = realloc(g_handles, count_max * sizeof(*handles));
+        if (handles) {
+            memset(&handles[g_handles_count_max], 0,
+                   (count_max - g_handles_count_max) * sizeof(*handles));
+            g_handles           = handles;
+            g_handles_count_max = count_max;
+        }
+    }
+    if (i < g_handles_count_max) {
+        g_handles[i] = obj;
+        handle = i;
+    }
+    pthread_mutex_unlock(&g_handles_lock);
+    return handle;
+}
+
+// Unregisters HANDLE, returns the associated object
+static soft_object_t *
+soft_handle_destroy(uint32_t handle, soft_object_type_t type)
+{
+    soft_object_t *obj = NULL;
+
+    pthread_mutex_lock(&g_handles_lock);
+    if (handle < g_handles_count_max) {
+        obj = g_handles[handle];
+        if (obj && obj->type == type)
+            g_handles[handle] = NULL;
+        else
+            obj = NULL;
+    }
+    pthread_mutex_unlock(&g_handles_lock);
+    return obj;
+}
+
+// Returns the object associated to HANDLE, if it has the right TYPE
+static soft_object_t *
+soft_handle_lookup(uint32_t handle, soft_object_type_t type)
+{
+    soft_object_t *obj = NULL;
+
+    pthread_mutex_lock(&g_handles_lock);
+    if (handle < g_handles_count_max) {
+        obj = g_handles[handle];
+        if (obj && obj->type != type)
+            obj = NULL;
+    }
+    pthread_mutex_unlock(&g_handles_lock);
+    return obj;
+}
+
+#define SOFT_OBJECT(handle, TYPE, type) \
+    ((soft_##type##_t *)soft_handle_lookup(handle, SOFT_OBJECT_##TYPE))
+
+#define SOFT_VIDEO_SURFACE(handle) \
+    SOFT_OBJECT(handle, VIDEO_SURFACE, video_surface)
+#define SOFT_OUTPUT_SURFACE(handle) \
+    SOFT_OBJECT(handle, OUTPUT_SURFACE, rgba_surface)
+#define SOFT_BITMAP_SURFACE(handle) \
+    SOFT_OBJECT(handle, BITMAP_SURFACE, rgba_surface)
+#define SOFT_DECODER(handle) \
+    SOFT_OBJECT(handle, DECODER, decoder)
+#define SOFT_VIDEO_MIXER(handle) \
+    SOFT_OBJECT(handle, VIDEO_MIXER, video_mixer)
+#define SOFT_PRESENTATION_QUEUE_TARGET(handle) \
+    SOFT_OBJECT(handle, PRESENTATION_QUEUE_TARGET, presentation_queue_target)
+#define SOFT_PRESENTATION_QUEUE(handle) \
+    SOFT_OBJECT(handle, PRESENTATION_QUEUE, presentation_queue)
+
+// Allocates an object of SIZE bytes and registers it
+static void *
+soft_object_create(
+    VdpDevice           device,
+    soft_object_type_t  type,
+    size_t              size,
+    uint32_t           *handle
+)
+{
+    if (type != SOFT_OBJECT_DEVICE &&
+        !soft_handle_lookup(device, SOFT_OBJECT_DEVICE))
+        return NULL;
+
+    soft_object_t * const obj = calloc(1, size);
+    if (!obj)
+        return NULL;
+
+    obj->type   = type;
+    obj->device = device;
+    *handle = soft_handle_create(obj);
+    if (*handle == VDP_INVALID_HANDLE) {
+        free(obj);
+        return NULL;
+    }
+    return obj;
+}
+
+/* ====================================================================== */
+/* === Pixel helpers                                                    === */
+/* ====================================================================== */
+
+static inline uint32_t
+rgba_pack(
+    VdpRGBAFormat format,
+    unsigned int  r,
+    unsigned int  g,
+    unsigned int  b,
+    unsigned int  a
+)
+{
+    if (format == VDP_RGBA_FORMAT_R8G8B8A8)
+        return (a << 24) | (b << 16) | (g << 8) | r;
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+static inline void
+rgba_unpack(
+    VdpRGBAFormat format,
+    uint32_t      pixel,
+    unsigned int  c[4]
+)
+{
+    if (format == VDP_RGBA_FORMAT_R8G8B8A8) {
+        c[0] = pixel & 0xff;
+        c[2] = (pixel >> 16) & 0xff;
+    }
+    else {
+        c[0] = (pixel >> 16) & 0xff;
+        c[2] = pixel & 0xff;
+    }
+    c[1] = (pixel >> 8) & 0xff;
+    c[3] = pixel >> 24;
+}
+
+static inline unsigned int
+float_to_u8(float v)
+{
+    if (v <= 0.0f)
+        return 0;
+    if (v >= 1.0f)
+        return 255;
+    return (unsigned int)(v * 255.0f + 0.5f);
+}
+
+static inline uint32_t
+color_pack(VdpRGBAFormat format, const VdpColor *color)
+{
+    return rgba_pack(format,
+                     float_to_u8(color->red),
+                     float_to_u8(color->green),
+                     float_to_u8(color->blue),
+                     float_to_u8(color->alpha));
+}
+
+static inline int
+is_supported_rgba_format(VdpRGBAFormat format)
+{
+    return (format == VDP_RGBA_FORMAT_B8G8R8A8 ||
+            format == VDP_RGBA_FORMAT_R8G8B8A8);
+}
+
+// Clips RECT against a WIDTH x HEIGHT surface, a NULL rect means the whole surface
+static int
+get_rect(
+    const VdpRect *rect,
+    uint32_t       width,
+    uint32_t       height,
+    VdpRect       *out_rect
+)
+{
+    if (!rect) {
+        out_rect->x0 = 0;
+        out_rect->y0 = 0;
+        out_rect->x1 = width;
+        out_rect->y1 = height;
+        return 1;
+    }
+    out_rect->x0 = MIN(rect->x0, width);
+    out_rect->y0 = MIN(rect->y0, height);
+    out_rect->x1 = MIN(rect->x1, width);
+    out_rect->y1 = MIN(rect->y1, height);
+    return out_rect->x1 > out_rect->x0 && out_rect->y1 > out_rect->y0;
+}
+
+/* ====================================================================== */
+/* === Miscellaneous                                                    === */
+/* ====================================================================== */
+
+static const char *
+soft_get_error_string(VdpStatus status)
+{
+    switch (status) {
+#define _(STATUS) case VDP_STATUS_##STATUS: return #STATUS
+        _(OK);
+        _(NO_IMPLEMENTATION);
+        _(DISPLAY_PREEMPTED);
+        _(INVALID_HANDLE);
+        _(INVALID_POINTER);
+        _(INVALID_CHROMA_TYPE);
+        _(INVALID_Y_CB_CR_FORMAT);
+        _(INVALID_RGBA_FORMAT);
+        _(INVALID_INDEXED_FORMAT);
+        _(INVALID_COLOR_STANDARD);
+        _(INVALID_COLOR_TABLE_FORMAT);
+        _(INVALID_BLEND_FACTOR);
+        _(INVALID_BLEND_EQUATION);
+        _(INVALID_FLAG);
+        _(INVALID_DECODER_PROFILE);
+        _(INVALID_VIDEO_MIXER_FEATURE);
+        _(INVALID_VIDEO_MIXER_PARAMETER);
+        _(INVALID_VIDEO_MIXER_ATTRIBUTE);
+        _(INVALID_VIDEO_MIXER_PICTURE_STRUCTURE);
+        _(INVALID_FUNC_ID);
+        _(INVALID_SIZE);
+        _(INVALID_VALUE);
+        _(INVALID_STRUCT_VERSION);
+        _(RESOURCES);
+        _(HANDLE_DEVICE_MISMATCH);
+        _(ERROR);
+#undef _
+    }
+    return NULL;
+}
+
+static VdpStatus
+soft_get_api_version(uint32_t *api_version)
+{
+    if (!api_version)
+        return VDP_STATUS_INVALID_POINTER;
+
+    *api_version = VDPAU_VERSION;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_get_information_string(const char **info_string)
+{
+    if (!info_string)
+        return VDP_STATUS_INVALID_POINTER;
+
+    *info_string = SOFT_INFORMATION_STRING;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_generate_csc_matrix(
+    VdpProcamp         *procamp,
+    VdpColorStandard    standard,
+    VdpCSCMatrix       *csc_matrix
+)
+{
+    float kr, kb;
+
+    if (!csc_matrix)
+        return VDP_STATUS_INVALID_POINTER;
+
+    switch (standard) {
+    case VDP_COLOR_STANDARD_ITUR_BT_601:
+        kr = 0.299f;  kb = 0.114f;
+        break;
+    case VDP_COLOR_STANDARD_ITUR_BT_709:
+        kr = 0.2126f; kb = 0.0722f;
+        break;
+    case VDP_COLOR_STANDARD_SMPTE_240M:
+        kr = 0.212f;  kb = 0.087f;
+        break;
+    default:
+        return VDP_STATUS_INVALID_COLOR_STANDARD;
+    }
+
+    float brightness = 0.0f, contrast = 1.0f, saturation = 1.0f, hue = 0.0f;
+    if (procamp) {
+        if (procamp->struct_version > VDP_PROCAMP_VERSION)
+            return VDP_STATUS_INVALID_STRUCT_VERSION;
+        brightness = procamp->brightness;
+        contrast   = procamp->contrast;
+        saturation = procamp->saturation;
+        hue        = procamp->hue;
+    }
+
+    /* Studio range inputs, normalized to [0..1] */
+    const float kg     = 1.0f - kr - kb;
+    const float yscale = contrast * 255.0f / 219.0f;
+    const float cscale = contrast * saturation * 255.0f / 224.0f;
+    const float cos_h  = cosf(hue);
+    const float sin_h  = sinf(hue);
+
+    /* Per channel (Cb, Cr) coefficients, before hue rotation */
+    const float coefs[3][2] = {
+        { 0.0f,                          2.0f * (1.0f - kr)          },
+        { -2.0f * kb * (1.0f - kb) / kg, -2.0f * kr * (1.0f - kr) / kg },
+        { 2.0f * (1.0f - kb),            0.0f                        }
+    };
+
+    unsigned int i;
+    for (i = 0; i < 3; i++) {
+        const float cb = cscale * (coefs[i][0] * cos_h + coefs[i][1] * sin_h);
+        const float cr = cscale * (coefs[i][1] * cos_h - coefs[i][0] * sin_h);
+        (*csc_matrix)[i][0] = yscale;
+        (*csc_matrix)[i][1] = cb;
+        (*csc_matrix)[i][2] = cr;
+        (*csc_matrix)[i][3] = brightness - yscale * 16.0f / 255.0f -
+            (cb + cr) * 128.0f / 255.0f;
+    }
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_device_destroy(VdpDevice device)
+{
+    soft_object_t *obj;
+    unsigned int i;
+
+    obj = soft_handle_destroy(device, SOFT_OBJECT_DEVICE);
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    free(obj);
+
+    /* Release objects the client did not destroy */
+    pthread_mutex_lock(&g_handles_lock);
+    for (i = 0; i < g_handles_count_max; i++) {
+        obj = g_handles[i];
+        if (obj && obj->device == device) {
+            g_handles[i] = NULL;
+            if (obj->type == SOFT_OBJECT_VIDEO_SURFACE)
+                free(((soft_video_surface_t *)obj)->planes[0]);
+            else if (obj->type == SOFT_OBJECT_OUTPUT_SURFACE ||
+                     obj->type == SOFT_OBJECT_BITMAP_SURFACE)
+                free(((soft_rgba_surface_t *)obj)->pixels);
+            free(obj);
+        }
+    }
+    pthread_mutex_unlock(&g_handles_lock);
+    return VDP_STATUS_OK;
+}
+
+/* ====================================================================== */
+/* === Video surfaces                                                   === */
+/* ====================================================================== */
+
+static VdpStatus
+soft_video_surface_query_ycbcr_caps(
+    VdpDevice           device,
+    VdpChromaType       chroma_type,
+    VdpYCbCrFormat      format,
+    VdpBool            *is_supported
+)
+{
+    if (!soft_handle_lookup(device, SOFT_OBJECT_DEVICE))
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!is_supported)
+        return VDP_STATUS_INVALID_POINTER;
+
+    switch (chroma_type) {
+    case VDP_CHROMA_TYPE_420:
+        *is_supported = (format == VDP_YCBCR_FORMAT_NV12 ||
+                         format == VDP_YCBCR_FORMAT_YV12);
+        break;
+    case VDP_CHROMA_TYPE_422:
+        *is_supported = (format == VDP_YCBCR_FORMAT_UYVY ||
+                         format == VDP_YCBCR_FORMAT_YUYV);
+        break;
+    case VDP_CHROMA_TYPE_444:
+        *is_supported = (format == VDP_YCBCR_FORMAT_Y8U8V8A8 ||
+                         format == VDP_YCBCR_FORMAT_V8U8Y8A8);
+        break;
+    default:
+        return VDP_STATUS_INVALID_CHROMA_TYPE;
+    }
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_video_surface_create(
+    VdpDevice           device,
+    VdpChromaType       chroma_type,
+    uint32_t            width,
+    uint32_t            height,
+    VdpVideoSurface    *surface
+)
+{
+    uint32_t chroma_width, chroma_height;
+
+    if (!surface)
+        return VDP_STATUS_INVALID_POINTER;
+    if (width == 0 || height == 0 ||
+        width > SOFT_MAX_SIZE || height > SOFT_MAX_SIZE)
+        return VDP_STATUS_INVALID_SIZE;
+
+    switch (chroma_type) {
+    case VDP_CHROMA_TYPE_420:
+        chroma_width  = (width + 1) / 2;
+        chroma_height = (height + 1) / 2;
+        break;
+    case VDP_CHROMA_TYPE_422:
+        chroma_width  = (width + 1) / 2;
+        chroma_height = height;
+        break;
+    case VDP_CHROMA_TYPE_444:
+        chroma_width  = width;
+        chroma_height = height;
+        break;
+    default:
+        return VDP_STATUS_INVALID_CHROMA_TYPE;
+    }
+
+    soft_video_surface_t * const obj = soft_object_create(
+        device, SOFT_OBJECT_VIDEO_SURFACE, sizeof(*obj), surface);
+    if (!obj)
+        return VDP_STATUS_RESOURCES;
+
+    obj->chroma_type   = chroma_type;
+    obj->width         = width;
+    obj->height        = height;
+    obj->chroma_width  = chroma_width;
+    obj->chroma_height = chroma_height;
+    obj->pitches[0]    = width;
+    obj->pitches[1]    = chroma_width;
+    obj->pitches[2]    = chroma_width;
+
+    const size_t luma_size   = (size_t)width * height;
+    const size_t chroma_size = (size_t)chroma_width * chroma_height;
+    obj->planes[0] = malloc(luma_size + 2 * chroma_size);
+    if (!obj->planes[0]) {
+        soft_handle_destroy(*surface, SOFT_OBJECT_VIDEO_SURFACE);
+        free(obj);
+        *surface = VDP_INVALID_HANDLE;
+        return VDP_STATUS_RESOURCES;
+    }
+    obj->planes[1] = obj->planes[0] + luma_size;
+    obj->planes[2] = obj->planes[1] + chroma_size;
+
+    /* Start with a black picture */
+    memset(obj->planes[0], 16, luma_size);
+    memset(obj->planes[1], 128, 2 * chroma_size);
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_video_surface_destroy(VdpVideoSurface surface)
+{
+    soft_video_surface_t * const obj = (soft_video_surface_t *)
+        soft_handle_destroy(surface, SOFT_OBJECT_VIDEO_SURFACE);
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+
+    free(obj->planes[0]);
+    free(obj);
+    return VDP_STATUS_OK;
+}
+
+static inline void
+copy_plane(
+    uint8_t        *dst,
+    uint32_t        dst_stride,
+    const uint8_t  *src,
+    uint32_t        src_stride,
+    uint32_t        width,
+    uint32_t        height
+)
+{
+    unsigned int y;
+    for (y = 0; y < height; y++) {
+        memcpy(dst, src, width);
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+// Transfers a video surface to/from packed or semi-planar layouts
+static VdpStatus
+soft_video_surface_transfer(
+    soft_video_surface_t *obj,
+    VdpYCbCrFormat        format,
+    uint8_t * const      *data,
+    const uint32_t       *pitches,
+    int                   put
+)
+{
+    const uint32_t width  = obj->width;
+    const uint32_t height = obj->height;
+    const uint32_t cw     = obj->chroma_width;
+    const uint32_t ch     = obj->chroma_height;
+    unsigned int x, y;
+
+    switch (format) {
+    case VDP_YCBCR_FORMAT_NV12:
+    case VDP_YCBCR_FORMAT_YV12:
+        if (obj->chroma_type != VDP_CHROMA_TYPE_420)
+            return VDP_STATUS_INVALID_Y_CB_CR_FORMAT;
+        if (put)
+            copy_plane(obj->planes[0], obj->pitches[0],
+                       data[0], pitches[0], width, height);
+        else
+            copy_plane(data[0], pitches[0],
+                       obj->planes[0], obj->pitches[0], width, height);
+
+        if (format == VDP_YCBCR_FORMAT_YV12) {
+            /* YV12 has V (Cr) before U (Cb) */
+            if (put) {
+                copy_plane(obj->planes[2], obj->pitches[2],
+                           data[1], pitches[1], cw, ch);
+                copy_plane(obj->planes[1], obj->pitches[1],
+                           data[2], pitches[2], cw, ch);
+            }
+            else {
+                copy_plane(data[1], pitches[1],
+                           obj->planes[2], obj->pitches[2], cw, ch);
+                copy_plane(data[2], pitches[2],
+                           obj->planes[1], obj->pitches[1], cw, ch);
+            }
+            break;
+        }
+
+        for (y = 0; y < ch; y++) {
+            uint8_t * const uv = data[1] + y * pitches[1];
+            uint8_t * const u  = obj->planes[1] + y * obj->pitches[1];
+            uint8_t * const v  = obj->planes[2] + y * obj->pitches[2];
+            for (x = 0; x < cw; x++) {
+                if (put) {
+                    u[x] = uv[2 * x + 0];
+                    v[x] = uv[2 * x + 1];
+                }
+                else {
+                    uv[2 * x + 0] = u[x];
+                    uv[2 * x + 1] = v[x];
+                }
+            }
+        }
+        break;
+    case VDP_YCBCR_FORMAT_UYVY:
+    case VDP_YCBCR_FORMAT_YUYV: {
+        if (obj->chroma_type != VDP_CHROMA_TYPE_422)
+            return VDP_STATUS_INVALID_Y_CB_CR_FORMAT;
+
+        const unsigned int yo = format == VDP_YCBCR_FORMAT_YUYV ? 0 : 1;
+        const unsigned int co = 1 - yo;
+        for (y = 0; y < height; y++) {
+            uint8_t * const p   = data[0] + y * pitches[0];
+            uint8_t * const luma = obj->planes[0] + y * obj->pitches[0];
+            uint8_t * const u   = obj->planes[1] + y * obj->pitches[1];
+            uint8_t * const v   = obj->planes[2] + y * obj->pitches[2];
+            for (x = 0; x < width; x++) {
+                uint8_t * const c = x & 1 ? &v[x / 2] : &u[x / 2];
+                if (put) {
+                    luma[x] = p[2 * x + yo];
+                    *c      = p[2 * x + co];
+                }
+                else {
+                    p[2 * x + yo] = luma[x];
+                    p[2 * x + co] = *c;
+                }
+            }
+        }
+        break;
+    }
+    case VDP_YCBCR_FORMAT_Y8U8V8A8:
+    case VDP_YCBCR_FORMAT_V8U8Y8A8: {
+        if (obj->chroma_type != VDP_CHROMA_TYPE_444)
+            return VDP_STATUS_INVALID_Y_CB_CR_FORMAT;
+
+        const unsigned int yo = format == VDP_YCBCR_FORMAT_Y8U8V8A8 ? 0 : 2;
+        const unsigned int vo = 2 - yo;
+        for (y = 0; y < height; y++) {
+            uint8_t * const p    = data[0] + y * pitches[0];
+            uint8_t * const luma = obj->planes[0] + y * obj->pitches[0];
+            uint8_t * const u    = obj->planes[1] + y * obj->pitches[1];
+            uint8_t * const v    = obj->planes[2] + y * obj->pitches[2];
+            for (x = 0; x < width; x++) {
+                if (put) {
+                    luma[x] = p[4 * x + yo];
+                    u[x]    = p[4 * x + 1];
+                    v[x]    = p[4 * x + vo];
+                }
+                else {
+                    p[4 * x + yo] = luma[x];
+                    p[4 * x + 1]  = u[x];
+                    p[4 * x + vo] = v[x];
+                    p[4 * x + 3]  = 0xff;
+                }
+            }
+        }
+        break;
+    }
+    default:
+        return VDP_STATUS_INVALID_Y_CB_CR_FORMAT;
+    }
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_video_surface_get_bits_ycbcr(
+    VdpVideoSurface     surface,
+    VdpYCbCrFormat      format,
+    void * const       *data,
+    const uint32_t     *pitches
+)
+{
+    soft_video_surface_t * const obj = SOFT_VIDEO_SURFACE(surface);
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!data || !pitches)
+        return VDP_STATUS_INVALID_POINTER;
+
+    return soft_video_surface_transfer(obj, format,
+                                       (uint8_t * const *)data, pitches, 0);
+}
+
+static VdpStatus
+soft_video_surface_put_bits_ycbcr(
+    VdpVideoSurface     surface,
+    VdpYCbCrFormat      format,
+    const void * const *data,
+    const uint32_t     *pitches
+)
+{
+    soft_video_surface_t * const obj = SOFT_VIDEO_SURFACE(surface);
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!data || !pitches)
+        return VDP_STATUS_INVALID_POINTER;
+
+    return soft_video_surface_transfer(obj, format,
+                                       (uint8_t * const *)data, pitches, 1);
+}
+
+/* ====================================================================== */
+/* === Output & bitmap surfaces                                         === */
+/* ====================================================================== */
+
+static VdpStatus
+soft_rgba_surface_query_caps(
+    VdpDevice           device,
+    VdpRGBAFormat       rgba_format,
+    VdpBool            *is_supported,
+    uint32_t           *max_width,
+    uint32_t           *max_height
+)
+{
+    if (!soft_handle_lookup(device, SOFT_OBJECT_DEVICE))
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!is_supported)
+        return VDP_STATUS_INVALID_POINTER;
+
+    *is_supported = is_supported_rgba_format(rgba_format);
+    if (max_width)
+        *max_width = SOFT_MAX_SIZE;
+    if (max_height)
+        *max_height = SOFT_MAX_SIZE;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_output_surface_query_rgba_caps(
+    VdpDevice           device,
+    VdpRGBAFormat       rgba_format,
+    VdpBool            *is_supported
+)
+{
+    return soft_rgba_surface_query_caps(device, rgba_format, is_supported,
+                                        NULL, NULL);
+}
+
+static VdpStatus
+soft_output_surface_query_put_bits_indexed_capabilities(
+    VdpDevice           device,
+    VdpRGBAFormat       rgba_format,
+    VdpIndexedFormat    indexed_format,
+    VdpColorTableFormat color_table_format,
+    VdpBool            *is_supported
+)
+{
+    VdpStatus status;
+
+    status = soft_rgba_surface_query_caps(device, rgba_format, is_supported,
+                                          NULL, NULL);
+    if (status != VDP_STATUS_OK)
+        return status;
+
+    switch (indexed_format) {
+    case VDP_INDEXED_FORMAT_A4I4:
+    case VDP_INDEXED_FORMAT_I4A4:
+    case VDP_INDEXED_FORMAT_A8I8:
+    case VDP_INDEXED_FORMAT_I8A8:
+        break;
+    default:
+        *is_supported = VDP_FALSE;
+        break;
+    }
+    if (color_table_format != VDP_COLOR_TABLE_FORMAT_B8G8R8X8)
+        *is_supported = VDP_FALSE;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_rgba_surface_create(
+    VdpDevice           device,
+    soft_object_type_t  type,
+    VdpRGBAFormat       rgba_format,
+    uint32_t            width,
+    uint32_t            height,
+    uint32_t           *surface
+)
+{
+    if (!surface)
+        return VDP_STATUS_INVALID_POINTER;
+    if (!is_supported_rgba_format(rgba_format))
+        return VDP_STATUS_INVALID_RGBA_FORMAT;
+    if (width == 0 || height == 0 ||
+        width > SOFT_MAX_SIZE || height > SOFT_MAX_SIZE)
+        return VDP_STATUS_INVALID_SIZE;
+
+    soft_rgba_surface_t * const obj = soft_object_create(
+        device, type, sizeof(*obj), surface);
+    if (!obj)
+        return VDP_STATUS_RESOURCES;
+
+    obj->rgba_format    = rgba_format;
+    obj->width          = width;
+    obj->height         = height;
+    obj->queue          = VDP_INVALID_HANDLE;
+    obj->queue_status   = VDP_PRESENTATION_QUEUE_STATUS_IDLE;
+    obj->pixels         = calloc((size_t)width * height, sizeof(uint32_t));
+    if (!obj->pixels) {
+        soft_handle_destroy(*surface, type);
+        free(obj);
+        *surface = VDP_INVALID_HANDLE;
+        return VDP_STATUS_RESOURCES;
+    }
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_rgba_surface_destroy(uint32_t surface, soft_object_type_t type)
+{
+    soft_rgba_surface_t * const obj = (soft_rgba_surface_t *)
+        soft_handle_destroy(surface, type);
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+
+    free(obj->pixels);
+    free(obj);
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_rgba_surface_put_bits_native(
+    soft_rgba_surface_t *obj,
+    const void * const  *data,
+    const uint32_t      *pitches,
+    const VdpRect       *dst_rect
+)
+{
+    VdpRect rect;
+    unsigned int y;
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!data || !pitches)
+        return VDP_STATUS_INVALID_POINTER;
+    if (!get_rect(dst_rect, obj->width, obj->height, &rect))
+        return VDP_STATUS_OK;
+
+    const uint8_t *src = data[0];
+    for (y = rect.y0; y < rect.y1; y++) {
+        memcpy(&obj->pixels[y * obj->width + rect.x0], src,
+               (rect.x1 - rect.x0) * sizeof(uint32_t));
+        src += pitches[0];
+    }
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_output_surface_create(
+    VdpDevice           device,
+    VdpRGBAFormat       rgba_format,
+    uint32_t            width,
+    uint32_t            height,
+    VdpOutputSurface   *surface
+)
+{
+    return soft_rgba_surface_create(device, SOFT_OBJECT_OUTPUT_SURFACE,
+                                    rgba_format, width, height, surface);
+}
+
+static VdpStatus
+soft_output_surface_destroy(VdpOutputSurface surface)
+{
+    return soft_rgba_surface_destroy(surface, SOFT_OBJECT_OUTPUT_SURFACE);
+}
+
+static VdpStatus
+soft_output_surface_get_bits_native(
+    VdpOutputSurface    surface,
+    const VdpRect      *src_rect,
+    void * const       *data,
+    const uint32_t     *pitches
+)
+{
+    soft_rgba_surface_t * const obj = SOFT_OUTPUT_SURFACE(surface);
+    VdpRect rect;
+    unsigned int y;
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!data || !pitches)
+        return VDP_STATUS_INVALID_POINTER;
+    if (!get_rect(src_rect, obj->width, obj->height, &rect))
+        return VDP_STATUS_OK;
+
+    uint8_t *dst = data[0];
+    for (y = rect.y0; y < rect.y1; y++) {
+        memcpy(dst, &obj->pixels[y * obj->width + rect.x0],
+               (rect.x1 - rect.x0) * sizeof(uint32_t));
+        dst += pitches[0];
+    }
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_output_surface_put_bits_native(
+    VdpOutputSurface    surface,
+    const void * const *data,
+    const uint32_t     *pitches,
+    const VdpRect      *dst_rect
+)
+{
+    return soft_rgba_surface_put_bits_native(SOFT_OUTPUT_SURFACE(surface),
+                                             data, pitches, dst_rect);
+}
+
+static VdpStatus
+soft_output_surface_put_bits_indexed(
+    VdpOutputSurface    surface,
+    VdpIndexedFormat    indexed_format,
+    const void * const *data,
+    const uint32_t     *pitches,
+    const VdpRect      *dst_rect,
+    VdpColorTableFormat color_table_format,
+    const void         *color_table
+)
+{
+    soft_rgba_surface_t * const obj = SOFT_OUTPUT_SURFACE(surface);
+    VdpRect rect;
+    unsigned int x, y, bpp;
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!data || !pitches || !color_table)
+        return VDP_STATUS_INVALID_POINTER;
+    if (color_table_format != VDP_COLOR_TABLE_FORMAT_B8G8R8X8)
+        return VDP_STATUS_INVALID_COLOR_TABLE_FORMAT;
+
+    switch (indexed_format) {
+    case VDP_INDEXED_FORMAT_A4I4:
+    case VDP_INDEXED_FORMAT_I4A4:
+        bpp = 1;
+        break;
+    case VDP_INDEXED_FORMAT_A8I8:
+    case VDP_INDEXED_FORMAT_I8A8:
+        bpp = 2;
+        break;
+    default:
+        return VDP_STATUS_INVALID_INDEXED_FORMAT;
+    }
+    if (!get_rect(dst_rect, obj->width, obj->height, &rect))
+        return VDP_STATUS_OK;
+
+    const uint32_t * const palette = color_table;
+    for (y = rect.y0; y < rect.y1; y++) {
+        const uint8_t *src = (const uint8_t *)data[0] + (y - rect.y0) * pitches[0];
+        uint32_t * const dst = &obj->pixels[y * obj->width];
+        for (x = rect.x0; x < rect.x1; x++, src += bpp) {
+            unsigned int i, a;
+            switch (indexed_format) {
+            case VDP_INDEXED_FORMAT_A4I4:
+                i = src[0] & 0x0f; a = (src[0] >> 4) * 0x11;
+                break;
+            case VDP_INDEXED_FORMAT_I4A4:
+                i = src[0] >> 4;   a = (src[0] & 0x0f) * 0x11;
+                break;
+            case VDP_INDEXED_FORMAT_A8I8:
+                i = src[0];        a = src[1];
+                break;
+            default:
+                i = src[1];        a = src[0];
+                break;
+            }
+            const uint32_t c = palette[i];
+            dst[x] = rgba_pack(obj->rgba_format,
+                               (c >> 16) & 0xff, (c >> 8) & 0xff, c & 0xff, a);
+        }
+    }
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_bitmap_surface_query_capabilities(
+    VdpDevice           device,
+    VdpRGBAFormat       rgba_format,
+    VdpBool            *is_supported,
+    uint32_t           *max_width,
+    uint32_t           *max_height
+)
+{
+    return soft_rgba_surface_query_caps(device, rgba_format, is_supported,
+                                        max_width, max_height);
+}
+
+static VdpStatus
+soft_bitmap_surface_create(
+    VdpDevice           device,
+    VdpRGBAFormat       rgba_format,
+    uint32_t            width,
+    uint32_t            height,
+    VdpBool             frequently_accessed,
+    VdpBitmapSurface   *surface
+)
+{
+    return soft_rgba_surface_create(device, SOFT_OBJECT_BITMAP_SURFACE,
+                                    rgba_format, width, height, surface);
+}
+
+static VdpStatus
+soft_bitmap_surface_destroy(VdpBitmapSurface surface)
+{
+    return soft_rgba_surface_destroy(surface, SOFT_OBJECT_BITMAP_SURFACE);
+}
+
+static VdpStatus
+soft_bitmap_surface_put_bits_native(
+    VdpBitmapSurface    surface,
+    const void * const *data,
+    const uint32_t     *pitches,
+    const VdpRect      *dst_rect
+)
+{
+    return soft_rgba_surface_put_bits_native(SOFT_BITMAP_SURFACE(surface),
+                                             data, pitches, dst_rect);
+}
+
+static inline unsigned int
+blend_factor(
+    VdpOutputSurfaceRenderBlendFactor factor,
+    const unsigned int                src[4],
+    const unsigned int                dst[4],
+    unsigned int                      c
+)
+{
+    switch (factor) {
+    case VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ZERO:
+        return 0;
+    case VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_SRC_COLOR:
+        return src[c];
+    case VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ONE_MINUS_SRC_COLOR:
+        return 255 - src[c];
+    case VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_SRC_ALPHA:
+        return src[3];
+    case VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA:
+        return 255 - src[3];
+    default:
+        break;
+    }
+    return 255;
+}
+
+static inline unsigned int
+blend_equation(
+    VdpOutputSurfaceRenderBlendEquation equation,
+    unsigned int                        src,
+    unsigned int                        dst
+)
+{
+    int v;
+
+    switch (equation) {
+    case VDP_OUTPUT_SURFACE_RENDER_BLEND_EQUATION_SUBTRACT:
+        v = (int)src - (int)dst;
+        break;
+    case VDP_OUTPUT_SURFACE_RENDER_BLEND_EQUATION_REVERSE_SUBTRACT:
+        v = (int)dst - (int)src;
+        break;
+    default:
+        v = src + dst;
+        break;
+    }
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// Renders SRC (or opaque white if NULL) into DST with nearest-neighbour scaling
+static VdpStatus
+soft_render_rgba_surface(
+    soft_rgba_surface_t                    *dst_obj,
+    const VdpRect                          *dst_rect,
+    soft_rgba_surface_t                    *src_obj,
+    const VdpRect                          *src_rect,
+    const VdpColor                         *colors,
+    const VdpOutputSurfaceRenderBlendState *blend_state
+)
+{
+    VdpRect drect, srect;
+    unsigned int x, y, c;
+
+    if (!dst_obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (blend_state &&
+        blend_state->struct_version > VDP_OUTPUT_SURFACE_RENDER_BLEND_STATE_VERSION)
+        return VDP_STATUS_INVALID_STRUCT_VERSION;
+    if (!get_rect(dst_rect, dst_obj->width, dst_obj->height, &drect))
+        return VDP_STATUS_OK;
+    if (src_obj && !get_rect(src_rect, src_obj->width, src_obj->height, &srect))
+        return VDP_STATUS_OK;
+
+    unsigned int modulate[4] = { 255, 255, 255, 255 };
+    if (colors) {
+        modulate[0] = float_to_u8(colors->red);
+        modulate[1] = float_to_u8(colors->green);
+        modulate[2] = float_to_u8(colors->blue);
+        modulate[3] = float_to_u8(colors->alpha);
+    }
+
+    const unsigned int dw = drect.x1 - drect.x0;
+    const unsigned int dh = drect.y1 - drect.y0;
+    for (y = 0; y < dh; y++) {
+        uint32_t * const dst = &dst_obj->pixels[(drect.y0 + y) * dst_obj->width];
+        const uint32_t *src = NULL;
+        if (src_obj) {
+            const unsigned int sy = srect.y0 + y * (srect.y1 - srect.y0) / dh;
+            src = &src_obj->pixels[sy * src_obj->width];
+        }
+        for (x = 0; x < dw; x++) {
+            unsigned int s[4] = { 255, 255, 255, 255 }, d[4], o[4];
+            if (src) {
+                const unsigned int sx = srect.x0 + x * (srect.x1 - srect.x0) / dw;
+                rgba_unpack(src_obj->rgba_format, src[sx], s);
+            }
+            for (c = 0; c < 4; c++)
+                s[c] = s[c] * modulate[c] / 255;
+
+            if (!blend_state) {
+                dst[drect.x0 + x] = rgba_pack(dst_obj->rgba_format,
+                                              s[0], s[1], s[2], s[3]);
+                continue;
+            }
+
+            rgba_unpack(dst_obj->rgba_format, dst[drect.x0 + x], d);
+            for (c = 0; c < 4; c++) {
+                const int is_alpha = c == 3;
+                const unsigned int sf = blend_factor(is_alpha ?
+                    blend_state->blend_factor_source_alpha :
+                    blend_state->blend_factor_source_color, s, d, c);
+                const unsigned int df = blend_factor(is_alpha ?
+                    blend_state->blend_factor_destination_alpha :
+                    blend_state->blend_factor_destination_color, s, d, c);
+                o[c] = blend_equation(is_alpha ?
+                                      blend_state->blend_equation_alpha :
+                                      blend_state->blend_equation_color,
+                                      s[c] * sf / 255, d[c] * df / 255);
+            }
+            dst[drect.x0 + x] = rgba_pack(dst_obj->rgba_format,
+                                          o[0], o[1], o[2], o[3]);
+        }
+    }
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_output_surface_render_output_surface(
+    VdpOutputSurface                        destination_surface,
+    const VdpRect                          *destination_rect,
+    VdpOutputSurface                        source_surface,
+    const VdpRect                          *source_rect,
+    const VdpColor                         *colors,
+    const VdpOutputSurfaceRenderBlendState *blend_state,
+    uint32_t                                flags
+)
+{
+    soft_rgba_surface_t *src_obj = NULL;
+
+    if (source_surface != VDP_INVALID_HANDLE) {
+        src_obj = SOFT_OUTPUT_SURFACE(source_surface);
+        if (!src_obj)
+            return VDP_STATUS_INVALID_HANDLE;
+    }
+    return soft_render_rgba_surface(SOFT_OUTPUT_SURFACE(destination_surface),
+                                    destination_rect, src_obj, source_rect,
+                                    colors, blend_state);
+}
+
+static VdpStatus
+soft_output_surface_render_bitmap_surface(
+    VdpOutputSurface                        destination_surface,
+    const VdpRect                          *destination_rect,
+    VdpBitmapSurface                        source_surface,
+    const VdpRect                          *source_rect,
+    const VdpColor                         *colors,
+    const VdpOutputSurfaceRenderBlendState *blend_state,
+    uint32_t                                flags
+)
+{
+    soft_rgba_surface_t *src_obj = NULL;
+
+    if (source_surface != VDP_INVALID_HANDLE) {
+        src_obj = SOFT_BITMAP_SURFACE(source_surface);
+        if (!src_obj)
+            return VDP_STATUS_INVALID_HANDLE;
+    }
+    return soft_render_rgba_surface(SOFT_OUTPUT_SURFACE(destination_surface),
+                                    destination_rect, src_obj, source_rect,
+                                    colors, blend_state);
+}
+
+/* ====================================================================== */
+/* === Decoder                                                          === */
+/* ====================================================================== */
+
+static VdpStatus
+soft_decoder_query_capabilities(
+    VdpDevice           device,
+    VdpDecoderProfile   profile,
+    VdpBool            *is_supported,
+    uint32_t           *max_level,
+    uint32_t           *max_macroblocks,
+    uint32_t           *max_width,
+    uint32_t           *max_height
+)
+{
+    uint32_t level;
+
+    if (!soft_handle_lookup(device, SOFT_OBJECT_DEVICE))
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!is_supported || !max_level || !max_macroblocks ||
+        !max_width || !max_height)
+        return VDP_STATUS_INVALID_POINTER;
+
+    switch (profile) {
+    case VDP_DECODER_PROFILE_MPEG1:
+        level = 0;
+        break;
+    case VDP_DECODER_PROFILE_MPEG2_SIMPLE:
+    case VDP_DECODER_PROFILE_MPEG2_MAIN:
+        level = 3;  /* High level */
+        break;
+    case VDP_DECODER_PROFILE_H264_BASELINE:
+    case VDP_DECODER_PROFILE_H264_MAIN:
+    case VDP_DECODER_PROFILE_H264_HIGH:
+    case VDP_DECODER_PROFILE_H264_CONSTRAINED_BASELINE:
+        level = 51;
+        break;
+    case VDP_DECODER_PROFILE_VC1_SIMPLE:
+    case VDP_DECODER_PROFILE_VC1_MAIN:
+        level = 2;  /* High level */
+        break;
+    case VDP_DECODER_PROFILE_VC1_ADVANCED:
+        level = 4;
+        break;
+    case VDP_DECODER_PROFILE_MPEG4_PART2_SP:
+        level = 3;
+        break;
+    case VDP_DECODER_PROFILE_MPEG4_PART2_ASP:
+        level = 5;
+        break;
+    case VDP_DECODER_PROFILE_DIVX4_QMOBILE:
+    case VDP_DECODER_PROFILE_DIVX4_MOBILE:
+    case VDP_DECODER_PROFILE_DIVX4_HOME_THEATER:
+    case VDP_DECODER_PROFILE_DIVX4_HD_1080P:
+    case VDP_DECODER_PROFILE_DIVX5_QMOBILE:
+    case VDP_DECODER_PROFILE_DIVX5_MOBILE:
+    case VDP_DECODER_PROFILE_DIVX5_HOME_THEATER:
+    case VDP_DECODER_PROFILE_DIVX5_HD_1080P:
+        level = 0;
+        break;
+    default:
+        *is_supported = VDP_FALSE;
+        return VDP_STATUS_OK;
+    }
+
+    *is_supported    = VDP_TRUE;
+    *max_level       = level;
+    *max_macroblocks = (SOFT_MAX_SIZE / 16) * (SOFT_MAX_SIZE / 16);
+    *max_width       = SOFT_MAX_SIZE;
+    *max_height      = SOFT_MAX_SIZE;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_decoder_create(
+    VdpDevice           device,
+    VdpDecoderProfile   profile,
+    uint32_t            width,
+    uint32_t            height,
+    uint32_t            max_references,
+    VdpDecoder         *decoder
+)
+{
+    VdpBool is_supported = VDP_FALSE;
+    uint32_t max_level, max_macroblocks, max_width, max_height;
+    VdpStatus status;
+
+    if (!decoder)
+        return VDP_STATUS_INVALID_POINTER;
+
+    status = soft_decoder_query_capabilities(device, profile, &is_supported,
+                                             &max_level, &max_macroblocks,
+                                             &max_width, &max_height);
+    if (status != VDP_STATUS_OK)
+        return status;
+    if (!is_supported)
+        return VDP_STATUS_INVALID_DECODER_PROFILE;
+    if (width == 0 || height == 0 || width > max_width || height > max_height)
+        return VDP_STATUS_INVALID_SIZE;
+    if (max_references > 16)
+        return VDP_STATUS_INVALID_VALUE;
+
+    soft_decoder_t * const obj = soft_object_create(
+        device, SOFT_OBJECT_DECODER, sizeof(*obj), decoder);
+    if (!obj)
+        return VDP_STATUS_RESOURCES;
+
+    obj->profile        = profile;
+    obj->width          = width;
+    obj->height         = height;
+    obj->max_references = max_references;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_decoder_destroy(VdpDecoder decoder)
+{
+    soft_object_t * const obj = soft_handle_destroy(decoder, SOFT_OBJECT_DECODER);
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+
+    free(obj);
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_decoder_render(
+    VdpDecoder                  decoder,
+    VdpVideoSurface             target,
+    const VdpPictureInfo       *picture_info,
+    uint32_t                    bitstream_buffers_count,
+    const VdpBitstreamBuffer   *bitstream_buffers
+)
+{
+    soft_decoder_t * const obj = SOFT_DECODER(decoder);
+    unsigned int i;
+
+    if (!obj || !SOFT_VIDEO_SURFACE(target))
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!picture_info || (bitstream_buffers_count > 0 && !bitstream_buffers))
+        return VDP_STATUS_INVALID_POINTER;
+
+    /* No actual decoding: only check the bitstream buffers are sane */
+    for (i = 0; i < bitstream_buffers_count; i++) {
+        const VdpBitstreamBuffer * const buffer = &bitstream_buffers[i];
+        if (buffer->struct_version > VDP_BITSTREAM_BUFFER_VERSION)
+            return VDP_STATUS_INVALID_STRUCT_VERSION;
+        if (buffer->bitstream_bytes > 0 && !buffer->bitstream)
+            return VDP_STATUS_INVALID_POINTER;
+    }
+    return VDP_STATUS_OK;
+}
+
+/* ====================================================================== */
+/* === Video mixer                                                      === */
+/* ====================================================================== */
+
+static VdpStatus
+soft_video_mixer_query_feature_support(
+    VdpDevice            device,
+    VdpVideoMixerFeature feature,
+    VdpBool             *is_supported
+)
+{
+    if (!soft_handle_lookup(device, SOFT_OBJECT_DEVICE))
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!is_supported)
+        return VDP_STATUS_INVALID_POINTER;
+
+    /* Neither deinterlacing nor high-quality scaling is implemented */
+    *is_supported = VDP_FALSE;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_video_mixer_query_attribute_support(
+    VdpDevice              device,
+    VdpVideoMixerAttribute attribute,
+    VdpBool               *is_supported
+)
+{
+    if (!soft_handle_lookup(device, SOFT_OBJECT_DEVICE))
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!is_supported)
+        return VDP_STATUS_INVALID_POINTER;
+
+    *is_supported = (attribute == VDP_VIDEO_MIXER_ATTRIBUTE_BACKGROUND_COLOR ||
+                     attribute == VDP_VIDEO_MIXER_ATTRIBUTE_CSC_MATRIX);
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_video_mixer_create(
+    VdpDevice                     device,
+    uint32_t                      feature_count,
+    const VdpVideoMixerFeature   *features,
+    uint32_t                      parameter_count,
+    const VdpVideoMixerParameter *parameters,
+    const void * const           *parameter_values,
+    VdpVideoMixer                *mixer
+)
+{
+    uint32_t width = 0, height = 0;
+    VdpChromaType chroma_type = VDP_CHROMA_TYPE_420;
+    unsigned int i;
+
+    if (!mixer)
+        return VDP_STATUS_INVALID_POINTER;
+    if (feature_count > 0 && !features)
+        return VDP_STATUS_INVALID_POINTER;
+    if (parameter_count > 0 && (!parameters || !parameter_values))
+        return VDP_STATUS_INVALID_POINTER;
+
+    for (i = 0; i < feature_count; i++) {
+        if (features[i] >= SOFT_MAX_MIXER_FEATURES)
+            return VDP_STATUS_INVALID_VIDEO_MIXER_FEATURE;
+    }
+
+    for (i = 0; i < parameter_count; i++) {
+        const uint32_t * const value = parameter_values[i];
+        switch (parameters[i]) {
+        case VDP_VIDEO_MIXER_PARAMETER_VIDEO_SURFACE_WIDTH:
+            width = *value;
+            break;
+        case VDP_VIDEO_MIXER_PARAMETER_VIDEO_SURFACE_HEIGHT:
+            height = *value;
+            break;
+        case VDP_VIDEO_MIXER_PARAMETER_CHROMA_TYPE:
+            chroma_type = *value;
+            break;
+        case VDP_VIDEO_MIXER_PARAMETER_LAYERS:
+            break;
+        default:
+            return VDP_STATUS_INVALID_VIDEO_MIXER_PARAMETER;
+        }
+    }
+
+    soft_video_mixer_t * const obj = soft_object_create(
+        device, SOFT_OBJECT_VIDEO_MIXER, sizeof(*obj), mixer);
+    if (!obj)
+        return VDP_STATUS_RESOURCES;
+
+    obj->width                  = width;
+    obj->height                 = height;
+    obj->chroma_type            = chroma_type;
+    obj->background_color.alpha = 1.0f;
+    soft_generate_csc_matrix(NULL, VDP_COLOR_STANDARD_ITUR_BT_601,
+                             &obj->csc_matrix);
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_video_mixer_destroy(VdpVideoMixer mixer)
+{
+    soft_object_t * const obj = soft_handle_destroy(mixer, SOFT_OBJECT_VIDEO_MIXER);
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+
+    free(obj);
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_video_mixer_get_feature_enables(
+    VdpVideoMixer               mixer,
+    uint32_t                    feature_count,
+    const VdpVideoMixerFeature *features,
+    VdpBool                    *feature_enables
+)
+{
+    soft_video_mixer_t * const obj = SOFT_VIDEO_MIXER(mixer);
+    unsigned int i;
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!features || !feature_enables)
+        return VDP_STATUS_INVALID_POINTER;
+
+    for (i = 0; i < feature_count; i++) {
+        if (features[i] >= SOFT_MAX_MIXER_FEATURES)
+            return VDP_STATUS_INVALID_VIDEO_MIXER_FEATURE;
+        feature_enables[i] = obj->features[features[i]];
+    }
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_video_mixer_set_feature_enables(
+    VdpVideoMixer               mixer,
+    uint32_t                    feature_count,
+    const VdpVideoMixerFeature *features,
+    const VdpBool              *feature_enables
+)
+{
+    soft_video_mixer_t * const obj = SOFT_VIDEO_MIXER(mixer);
+    unsigned int i;
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!features || !feature_enables)
+        return VDP_STATUS_INVALID_POINTER;
+
+    for (i = 0; i < feature_count; i++) {
+        if (features[i] >= SOFT_MAX_MIXER_FEATURES)
+            return VDP_STATUS_INVALID_VIDEO_MIXER_FEATURE;
+        obj->features[features[i]] = feature_enables[i];
+    }
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_video_mixer_get_attribute_values(
+    VdpVideoMixer                 mixer,
+    uint32_t                      attribute_count,
+    const VdpVideoMixerAttribute *attributes,
+    void * const                 *attribute_values
+)
+{
+    soft_video_mixer_t * const obj = SOFT_VIDEO_MIXER(mixer);
+    unsigned int i;
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!attributes || !attribute_values)
+        return VDP_STATUS_INVALID_POINTER;
+
+    for (i = 0; i < attribute_count; i++) {
+        switch (attributes[i]) {
+        case VDP_VIDEO_MIXER_ATTRIBUTE_BACKGROUND_COLOR:
+            *(VdpColor *)attribute_values[i] = obj->background_color;
+            break;
+        case VDP_VIDEO_MIXER_ATTRIBUTE_CSC_MATRIX:
+            memcpy(attribute_values[i], obj->csc_matrix, sizeof(obj->csc_matrix));
+            break;
+        default:
+            return VDP_STATUS_INVALID_VIDEO_MIXER_ATTRIBUTE;
+        }
+    }
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_video_mixer_set_attribute_values(
+    VdpVideoMixer                 mixer,
+    uint32_t                      attribute_count,
+    const VdpVideoMixerAttribute *attributes,
+    const void * const           *attribute_values
+)
+{
+    soft_video_mixer_t * const obj = SOFT_VIDEO_MIXER(mixer);
+    unsigned int i;
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!attributes || !attribute_values)
+        return VDP_STATUS_INVALID_POINTER;
+
+    for (i = 0; i < attribute_count; i++) {
+        switch (attributes[i]) {
+        case VDP_VIDEO_MIXER_ATTRIBUTE_BACKGROUND_COLOR:
+            obj->background_color = *(const VdpColor *)attribute_values[i];
+            break;
+        case VDP_VIDEO_MIXER_ATTRIBUTE_CSC_MATRIX:
+            if (attribute_values[i])
+                memcpy(obj->csc_matrix, attribute_values[i],
+                       sizeof(obj->csc_matrix));
+            else
+                soft_generate_csc_matrix(NULL, VDP_COLOR_STANDARD_ITUR_BT_601,
+                                         &obj->csc_matrix);
+            break;
+        default:
+            return VDP_STATUS_INVALID_VIDEO_MIXER_ATTRIBUTE;
+        }
+    }
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_video_mixer_render(
+    VdpVideoMixer                 mixer,
+    VdpOutputSurface              background_surface,
+    const VdpRect                *background_source_rect,
+    VdpVideoMixerPictureStructure current_picture_structure,
+    uint32_t                      video_surface_past_count,
+    const VdpVideoSurface        *video_surface_past,
+    VdpVideoSurface               video_surface_current,
+    uint32_t                      video_surface_future_count,
+    const VdpVideoSurface        *video_surface_future,
+    const VdpRect                *video_source_rect,
+    VdpOutputSurface              destination_surface,
+    const VdpRect                *destination_rect,
+    const VdpRect                *destination_video_rect,
+    uint32_t                      layer_count,
+    const VdpLayer               *layers
+)
+{
+    soft_video_mixer_t * const obj = SOFT_VIDEO_MIXER(mixer);
+    soft_video_surface_t * const src_obj = SOFT_VIDEO_SURFACE(video_surface_current);
+    soft_rgba_surface_t * const dst_obj = SOFT_OUTPUT_SURFACE(destination_surface);
+    VdpRect srect, drect, vrect;
+    unsigned int x, y, i;
+    VdpStatus status;
+
+    if (!obj || !src_obj || !dst_obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (layer_count > 0 && !layers)
+        return VDP_STATUS_INVALID_POINTER;
+
+    int field;
+    switch (current_picture_structure) {
+    case VDP_VIDEO_MIXER_PICTURE_STRUCTURE_TOP_FIELD:
+        field = 0;
+        break;
+    case VDP_VIDEO_MIXER_PICTURE_STRUCTURE_BOTTOM_FIELD:
+        field = 1;
+        break;
+    case VDP_VIDEO_MIXER_PICTURE_STRUCTURE_FRAME:
+        field = -1;
+        break;
+    default:
+        return VDP_STATUS_INVALID_VIDEO_MIXER_PICTURE_STRUCTURE;
+    }
+
+    if (!get_rect(destination_rect, dst_obj->width, dst_obj->height, &drect))
+        return VDP_STATUS_OK;
+
+    /* Background */
+    const uint32_t bgcolor = color_pack(dst_obj->rgba_format,
+                                        &obj->background_color);
+    if (background_surface != VDP_INVALID_HANDLE) {
+        status = soft_render_rgba_surface(dst_obj, &drect,
+                                          SOFT_OUTPUT_SURFACE(background_surface),
+                                          background_source_rect, NULL, NULL);
+        if (status != VDP_STATUS_OK)
+            return status;
+    }
+    else {
+        for (y = drect.y0; y < drect.y1; y++) {
+            uint32_t * const dst = &dst_obj->pixels[y * dst_obj->width];
+            for (x = drect.x0; x < drect.x1; x++)
+                dst[x] = bgcolor;
+        }
+    }
+
+    /* Video, nearest-neighbour scaled and converted through the CSC matrix */
+    if (get_rect(video_source_rect, src_obj->width, src_obj->height, &srect) &&
+        get_rect(destination_video_rect ? destination_video_rect : &drect,
+                 dst_obj->width, dst_obj->height, &vrect)) {
+        const float (* const m)[4] = (const float (*)[4])obj->csc_matrix;
+        const unsigned int sw = srect.x1 - srect.x0, sh = srect.y1 - srect.y0;
+        const unsigned int dw = vrect.x1 - vrect.x0, dh = vrect.y1 - vrect.y0;
+        const unsigned int sx_shift = src_obj->chroma_width  < src_obj->width;
+        const unsigned int sy_shift = src_obj->chroma_height < src_obj->height;
+
+        for (y = 0; y < dh; y++) {
+            unsigned int sy = srect.y0 + y * sh / dh;
+            if (field >= 0)
+                sy = MIN((sy & ~1U) | field, src_obj->height - 1);
+            const uint8_t * const luma = src_obj->planes[0] + sy * src_obj->pitches[0];
+            const uint8_t * const u = src_obj->planes[1] +
+                (sy >> sy_shift) * src_obj->pitches[1];
+            const uint8_t * const v = src_obj->planes[2] +
+                (sy >> sy_shift) * src_obj->pitches[2];
+            uint32_t * const dst = &dst_obj->pixels[(vrect.y0 + y) * dst_obj->width];
+
+            for (x = 0; x < dw; x++) {
+                const unsigned int sx = srect.x0 + x * sw / dw;
+                const float Y  = luma[sx] / 255.0f;
+                const float Cb = u[sx >> sx_shift] / 255.0f;
+                const float Cr = v[sx >> sx_shift] / 255.0f;
+                dst[vrect.x0 + x] = rgba_pack(
+                    dst_obj->rgba_format,
+                    float_to_u8(m[0][0] * Y + m[0][1] * Cb + m[0][2] * Cr + m[0][3]),
+                    float_to_u8(m[1][0] * Y + m[1][1] * Cb + m[1][2] * Cr + m[1][3]),
+                    float_to_u8(m[2][0] * Y + m[2][1] * Cb + m[2][2] * Cr + m[2][3]),
+                    0xff);
+            }
+        }
+    }
+
+    /* Layers, composed with source-over alpha blending */
+    static const VdpOutputSurfaceRenderBlendState blend_state = {
+        .struct_version                 = VDP_OUTPUT_SURFACE_RENDER_BLEND_STATE_VERSION,
+        .blend_factor_source_color      = VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_SRC_ALPHA,
+        .blend_factor_source_alpha      = VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_SRC_ALPHA,
+        .blend_factor_destination_color = VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+        .blend_factor_destination_alpha = VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+        .blend_equation_color           = VDP_OUTPUT_SURFACE_RENDER_BLEND_EQUATION_ADD,
+        .blend_equation_alpha           = VDP_OUTPUT_SURFACE_RENDER_BLEND_EQUATION_ADD,
+    };
+    for (i = 0; i < layer_count; i++) {
+        soft_rgba_surface_t * const layer_obj =
+            SOFT_OUTPUT_SURFACE(layers[i].source_surface);
+        if (!layer_obj)
+            return VDP_STATUS_INVALID_HANDLE;
+        status = soft_render_rgba_surface(dst_obj, layers[i].destination_rect,
+                                          layer_obj, layers[i].source_rect,
+                                          NULL, &blend_state);
+        if (status != VDP_STATUS_OK)
+            return status;
+    }
+    return VDP_STATUS_OK;
+}
+
+/* ====================================================================== */
+/* === Presentation queue                                               === */
+/* ====================================================================== */
+
+static VdpStatus
+soft_presentation_queue_target_create_x11(
+    VdpDevice                   device,
+    Drawable                    drawable,
+    VdpPresentationQueueTarget *target
+)
+{
+    if (!target)
+        return VDP_STATUS_INVALID_POINTER;
+
+    soft_presentation_queue_target_t * const obj = soft_object_create(
+        device, SOFT_OBJECT_PRESENTATION_QUEUE_TARGET, sizeof(*obj), target);
+    if (!obj)
+        return VDP_STATUS_RESOURCES;
+
+    obj->drawable = drawable;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_presentation_queue_target_destroy(VdpPresentationQueueTarget target)
+{
+    soft_object_t * const obj = soft_handle_destroy(
+        target, SOFT_OBJECT_PRESENTATION_QUEUE_TARGET);
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+
+    free(obj);
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_presentation_queue_create(
+    VdpDevice                   device,
+    VdpPresentationQueueTarget  target,
+    VdpPresentationQueue       *queue
+)
+{
+    if (!queue)
+        return VDP_STATUS_INVALID_POINTER;
+    if (!SOFT_PRESENTATION_QUEUE_TARGET(target))
+        return VDP_STATUS_INVALID_HANDLE;
+
+    soft_presentation_queue_t * const obj = soft_object_create(
+        device, SOFT_OBJECT_PRESENTATION_QUEUE, sizeof(*obj), queue);
+    if (!obj)
+        return VDP_STATUS_RESOURCES;
+
+    obj->target                 = target;
+    obj->background_color.alpha = 1.0f;
+    obj->clock                  = get_ticks_usec() * 1000;
+    obj->visible_surface        = VDP_INVALID_HANDLE;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_presentation_queue_destroy(VdpPresentationQueue queue)
+{
+    soft_presentation_queue_t * const obj = (soft_presentation_queue_t *)
+        soft_handle_destroy(queue, SOFT_OBJECT_PRESENTATION_QUEUE);
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+
+    soft_rgba_surface_t * const visible_obj =
+        SOFT_OUTPUT_SURFACE(obj->visible_surface);
+    if (visible_obj && visible_obj->queue == queue) {
+        visible_obj->queue        = VDP_INVALID_HANDLE;
+        visible_obj->queue_status = VDP_PRESENTATION_QUEUE_STATUS_IDLE;
+    }
+    free(obj);
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_presentation_queue_set_background_color(
+    VdpPresentationQueue        queue,
+    VdpColor * const            background_color
+)
+{
+    soft_presentation_queue_t * const obj = SOFT_PRESENTATION_QUEUE(queue);
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!background_color)
+        return VDP_STATUS_INVALID_POINTER;
+
+    obj->background_color = *background_color;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_presentation_queue_get_background_color(
+    VdpPresentationQueue        queue,
+    VdpColor                   *background_color
+)
+{
+    soft_presentation_queue_t * const obj = SOFT_PRESENTATION_QUEUE(queue);
+
+    if (!obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!background_color)
+        return VDP_STATUS_INVALID_POINTER;
+
+    *background_color = obj->background_color;
+    return VDP_STATUS_OK;
+}
+
+// Retires the surface currently shown by the queue
+static void
+soft_presentation_queue_retire(soft_presentation_queue_t *obj)
+{
+    soft_rgba_surface_t * const visible_obj =
+        SOFT_OUTPUT_SURFACE(obj->visible_surface);
+
+    if (visible_obj) {
+        visible_obj->queue        = VDP_INVALID_HANDLE;
+        visible_obj->queue_status = VDP_PRESENTATION_QUEUE_STATUS_IDLE;
+    }
+    obj->visible_surface = VDP_INVALID_HANDLE;
+}
+
+static VdpStatus
+soft_presentation_queue_display(
+    VdpPresentationQueue        queue,
+    VdpOutputSurface            surface,
+    uint32_t                    clip_width,
+    uint32_t                    clip_height,
+    VdpTime                     earliest_presentation_time
+)
+{
+    soft_presentation_queue_t * const obj = SOFT_PRESENTATION_QUEUE(queue);
+    soft_rgba_surface_t * const surface_obj = SOFT_OUTPUT_SURFACE(surface);
+
+    if (!obj || !surface_obj)
+        return VDP_STATUS_INVALID_HANDLE;
+
+    /* The simulated clock jumps straight to the next refresh, so that
+       displaying a surface never blocks the caller */
+    obj->clock = MAX(obj->clock + SOFT_REFRESH_PERIOD, earliest_presentation_time);
+
+    soft_presentation_queue_retire(obj);
+    obj->visible_surface            = surface;
+    surface_obj->queue              = queue;
+    surface_obj->queue_status       = VDP_PRESENTATION_QUEUE_STATUS_VISIBLE;
+    surface_obj->presentation_time  = obj->clock;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_presentation_queue_block_until_surface_idle(
+    VdpPresentationQueue        queue,
+    VdpOutputSurface            surface,
+    VdpTime                    *first_presentation_time
+)
+{
+    soft_presentation_queue_t * const obj = SOFT_PRESENTATION_QUEUE(queue);
+    soft_rgba_surface_t * const surface_obj = SOFT_OUTPUT_SURFACE(surface);
+
+    if (!obj || !surface_obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!first_presentation_time)
+        return VDP_STATUS_INVALID_POINTER;
+
+    /* A visible surface is released after one more refresh period */
+    if (surface_obj->queue == queue &&
+        surface_obj->queue_status != VDP_PRESENTATION_QUEUE_STATUS_IDLE) {
+        obj->clock += SOFT_REFRESH_PERIOD;
+        soft_presentation_queue_retire(obj);
+    }
+    *first_presentation_time = surface_obj->presentation_time;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus
+soft_presentation_queue_query_surface_status(
+    VdpPresentationQueue        queue,
+    VdpOutputSurface            surface,
+    VdpPresentationQueueStatus *status,
+    VdpTime                    *first_presentation_time
+)
+{
+    soft_presentation_queue_t * const obj = SOFT_PRESENTATION_QUEUE(queue);
+    soft_rgba_surface_t * const surface_obj = SOFT_OUTPUT_SURFACE(surface);
+
+    if (!obj || !surface_obj)
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!status || !first_presentation_time)
+        return VDP_STATUS_INVALID_POINTER;
+
+    *status = (surface_obj->queue == queue ?
+               surface_obj->queue_status :
+               VDP_PRESENTATION_QUEUE_STATUS_IDLE);
+    *first_presentation_time = surface_obj->presentation_time;
+    return VDP_STATUS_OK;
+}
+
+/* ====================================================================== */
+/* === Device                                                           === */
+/* ====================================================================== */
+
+static VdpStatus
+soft_get_proc_address(VdpDevice device, VdpFuncId func_id, void **func)
+{
+    if (!soft_handle_lookup(device, SOFT_OBJECT_DEVICE))
+        return VDP_STATUS_INVALID_HANDLE;
+    if (!func)
+        return VDP_STATUS_INVALID_POINTER;
+
+    switch (func_id) {
+#define _(FUNC_ID, FUNC)                                \
+    case VDP_FUNC_ID_##FUNC_ID:                         \
+        *func = (void *)soft_##FUNC;                    \
+        break
+        _(GET_ERROR_STRING,             get_error_string);
+        _(GET_PROC_ADDRESS,             get_proc_address);
+        _(GET_API_VERSION,              get_api_version);
+        _(GET_INFORMATION_STRING,       get_information_string);
+        _(DEVICE_DESTROY,               device_destroy);
+        _(GENERATE_CSC_MATRIX,          generate_csc_matrix);
+        _(VIDEO_SURFACE_QUERY_GET_PUT_BITS_Y_CB_CR_CAPABILITIES,
+          video_surface_query_ycbcr_caps);
+        _(VIDEO_SURFACE_CREATE,         video_surface_create);
+        _(VIDEO_SURFACE_DESTROY,        video_surface_destroy);
+        _(VIDEO_SURFACE_GET_BITS_Y_CB_CR,
+          video_surface_get_bits_ycbcr);
+        _(VIDEO_SURFACE_PUT_BITS_Y_CB_CR,
+          video_surface_put_bits_ycbcr);
+        _(OUTPUT_SURFACE_QUERY_GET_PUT_BITS_NATIVE_CAPABILITIES,
+          output_surface_query_rgba_caps);
+        _(OUTPUT_SURFACE_QUERY_PUT_BITS_INDEXED_CAPABILITIES,
+          output_surface_query_put_bits_indexed_capabilities);
+        _(OUTPUT_SURFACE_CREATE,        output_surface_create);
+        _(OUTPUT_SURFACE_DESTROY,       output_surface_destroy);
+        _(OUTPUT_SURFACE_GET_BITS_NATIVE,
+          output_surface_get_bits_native);
+        _(OUTPUT_SURFACE_PUT_BITS_NATIVE,
+          output_surface_put_bits_native);
+        _(OUTPUT_SURFACE_PUT_BITS_INDEXED,
+          output_surface_put_bits_indexed);
+        _(OUTPUT_SURFACE_RENDER_OUTPUT_SURFACE,
+          output_surface_render_output_surface);
+        _(OUTPUT_SURFACE_RENDER_BITMAP_SURFACE,
+          output_surface_render_bitmap_surface);
+        _(BITMAP_SURFACE_QUERY_CAPABILITIES,
+          bitmap_surface_query_capabilities);
+        _(BITMAP_SURFACE_CREATE,        bitmap_surface_create);
+        _(BITMAP_SURFACE_DESTROY,       bitmap_surface_destroy);
+        _(BITMAP_SURFACE_PUT_BITS_NATIVE,
+          bitmap_surface_put_bits_native);
+        _(DECODER_QUERY_CAPABILITIES,   decoder_query_capabilities);
+        _(DECODER_CREATE,               decoder_create);
+        _(DECODER_DESTROY,              decoder_destroy);
+        _(DECODER_RENDER,               decoder_render);
+        _(VIDEO_MIXER_QUERY_FEATURE_SUPPORT,
+          video_mixer_query_feature_support);
+        _(VIDEO_MIXER_QUERY_ATTRIBUTE_SUPPORT,
+          video_mixer_query_attribute_support);
+        _(VIDEO_MIXER_CREATE,           video_mixer_create);
+        _(VIDEO_MIXER_DESTROY,          video_mixer_destroy);
+        _(VIDEO_MIXER_GET_FEATURE_ENABLES,
+          video_mixer_get_feature_enables);
+        _(VIDEO_MIXER_SET_FEATURE_ENABLES,
+          video_mixer_set_feature_enables);
+        _(VIDEO_MIXER_GET_ATTRIBUTE_VALUES,
+          video_mixer_get_attribute_values);
+        _(VIDEO_MIXER_SET_ATTRIBUTE_VALUES,
+          video_mixer_set_attribute_values);
+        _(VIDEO_MIXER_RENDER,           video_mixer_render);
+        _(PRESENTATION_QUEUE_TARGET_CREATE_X11,
+          presentation_queue_target_create_x11);
+        _(PRESENTATION_QUEUE_TARGET_DESTROY,
+          presentation_queue_target_destroy);
+        _(PRESENTATION_QUEUE_CREATE,    presentation_queue_create);
+        _(PRESENTATION_QUEUE_DESTROY,   presentation_queue_destroy);
+        _(PRESENTATION_QUEUE_SET_BACKGROUND_COLOR,
+          presentation_queue_set_background_color);
+        _(PRESENTATION_QUEUE_GET_BACKGROUND_COLOR,
+          presentation_queue_get_background_color);
+        _(PRESENTATION_QUEUE_DISPLAY,   presentation_queue_display);
+        _(PRESENTATION_QUEUE_BLOCK_UNTIL_SURFACE_IDLE,
+          presentation_queue_block_until_surface_idle);
+        _(PRESENTATION_QUEUE_QUERY_SURFACE_STATUS,
+          presentation_queue_query_surface_status);
+#undef _
+    default:
+        *func = NULL;
+        return VDP_STATUS_INVALID_FUNC_ID;
+    }
+    return VDP_STATUS_OK;
+}
+
+// Create a software VDPAU device (same semantics as vdp_device_create_x11())
+VdpStatus
+vdpau_soft_device_create_x11(
+    Display             *display,
+    int                  screen,
+    VdpDevice           *device,
+    VdpGetProcAddress  **get_proc_address
+)
+{
+    if (!device || !get_proc_address)
+        return VDP_STATUS_INVALID_POINTER;
+
+    soft_object_t * const obj = soft_object_create(
+        VDP_INVALID_HANDLE, SOFT_OBJECT_DEVICE, sizeof(*obj), device);
+    if (!obj)
+        return VDP_STATUS_RESOURCES;
+
+    /* Objects are owned by the device they were created on */
+    obj->device = *device;
+
+    *get_proc_address = soft_get_proc_address;
+    vdpau_information_message("using software VDPAU implementation\n");
+    return VDP_STATUS_OK;
+}
@@ -0,0 +1,41 @@
+/*
+ *  vdpau_soft.h - Software VDPAU implementation (host memory)
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#ifndef VDPAU_SOFT_H
+#define VDPAU_SOFT_H
+
+#include <vdpau/vdpau.h>
+#include <vdpau/vdpau_x11.h>
+
+// Returns TRUE if the software VDPAU implementation was requested
+int vdpau_soft_enabled(void)
+    attribute_hidden;
+
+// Create a software VDPAU device (same semantics as vdp_device_create_x11())
+// NOTE: the display is not used and may be NULL
+VdpStatus
+vdpau_soft_device_create_x11(
+    Display             *display,
+    int                  screen,
+    VdpDevice           *device,
+    VdpGetProcAddress  **get_proc_address
+) attribute_hidden;
+
+#endif /* VDPAU_SOFT_H */
@@ -23,6 +23,7 @@
 #include "vdpau_video.h"
 #include "vdpau_image.h"
 #include "vdpau_buffer.h"
+#include "vdpau_caps.h"
 #include "utils.h"
 
 #define DEBUG 1
@@ -97,36 +98,17 @@ is_supported_format(
     vdpau_driver_data_t             *driver_data,
     const vdpau_subpic_format_map_t *format)
 {
-    VdpBool is_supported = VDP_FALSE;
-    VdpStatus vdp_status;
-    uint32_t max_width, max_height;
-
     switch (format->vdp_format_type) {
     case VDP_IMAGE_FORMAT_TYPE_RGBA:
-        vdp_status = vdpau_bitmap_surface_query_capabilities(
-            driver_data,
-            driver_data->vdp_device,
-            format->vdp_format,
-            &is_supported,
-            &max_width,
-            &max_height
-        );
-        break;
+        return vdpau_caps_has_format(driver_data, VDPAU_CAPS_FORMAT_BITMAP,
+                                     format->vdp_format);
     case VDP_IMAGE_FORMAT_TYPE_INDEXED:
-        vdp_status = vdpau_output_surface_query_put_bits_indexed_capabilities(
-            driver_data,
-            driver_data->vdp_device,
-            VDP_RGBA_FORMAT_B8G8R8A8,
-            format->vdp_format,
-            VDP_COLOR_TABLE_FORMAT_B8G8R8X8,
-            &is_supported
-        );
-        break;
+        return vdpau_caps_has_format(driver_data, VDPAU_CAPS_FORMAT_INDEXED,
+                                     format->vdp_format);
     default:
-        vdp_status = VDP_STATUS_ERROR;
         break;
     }
-    return vdp_status == VDP_STATUS_OK && is_supported;
+    return VDP_FALSE;
 }
 
 // Append association to the subpicture
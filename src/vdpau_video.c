@@ -22,19 +22,16 @@
 #include "vdpau_video.h"
 #include "vdpau_video_x11.h"
 #include "vdpau_decode.h"
+#include "vdpau_image.h"
 #include "vdpau_subpic.h"
 #include "vdpau_mixer.h"
 #include "vdpau_buffer.h"
+#include "vdpau_caps.h"
 #include "utils.h"
 
 #define DEBUG 1
 #include "debug.h"
 
-
-/* Define wait delay (in microseconds) for vaSyncSurface() implementation
-   with polling. */
-#define VDPAU_SYNC_DELAY 5000
-
 // Translates VA-API chroma format to VdpChromaType
 static VdpChromaType get_VdpChromaType(int format)
 {
@@ -60,35 +57,21 @@ get_max_surface_size(
     uint32_t            *pmax_height
 )
 {
-    VdpBool is_supported = VDP_FALSE;
-    VdpStatus vdp_status;
-    uint32_t max_level, max_references, max_width, max_height;
+    const vdpau_decoder_caps_t *dc;
 
     if (pmax_width)
         *pmax_width = 0;
     if (pmax_height)
         *pmax_height = 0;
 
-    vdp_status = vdpau_decoder_query_capabilities(
-        driver_data,
-        driver_data->vdp_device,
-        profile,
-        &is_supported,
-        &max_level,
-        &max_references,
-        &max_width,
-        &max_height
-    );
-    if (!VDPAU_CHECK_STATUS(vdp_status, "VdpDecoderQueryCapabilities()"))
-        return VDP_FALSE;
-
-    if (!is_supported)
+    dc = vdpau_caps_get_decoder(driver_data, profile);
+    if (!dc)
         return VDP_FALSE;
 
     if (pmax_width)
-        *pmax_width = max_width;
-    if (max_height)
-        *pmax_height = max_height;
+        *pmax_width = dc->max_width;
+    if (pmax_height)
+        *pmax_height = dc->max_height;
 
     return VDP_TRUE;
 }
@@ -244,9 +227,8 @@ vdpau_QueryConfigAttributes(
     return va_status;
 }
 
-// Add subpicture association to surface
-// NOTE: the subpicture owns the SubpictureAssociation object
-int surface_add_association(
+static int
+surface_add_association_unlocked(
     object_surface_p            obj_surface,
     SubpictureAssociationP      assoc
 )
@@ -285,9 +267,23 @@ int surface_add_association(
     return 0;
 }
 
-// Remove subpicture association from surface
+// Add subpicture association to surface
 // NOTE: the subpicture owns the SubpictureAssociation object
-int surface_remove_association(
+int surface_add_association(
+    object_surface_p            obj_surface,
+    SubpictureAssociationP      assoc
+)
+{
+    int status;
+
+    pthread_mutex_lock(&obj_surface->lock);
+    status = surface_add_association_unlocked(obj_surface, assoc);
+    pthread_mutex_unlock(&obj_surface->lock);
+    return status;
+}
+
+static int
+surface_remove_association_unlocked(
     object_surface_p            obj_surface,
     SubpictureAssociationP      assoc
 )
@@ -309,6 +305,21 @@ int surface_remove_association(
     return -1;
 }
 
+// Remove subpicture association from surface
+// NOTE: the subpicture owns the SubpictureAssociation object
+int surface_remove_association(
+    object_surface_p            obj_surface,
+    SubpictureAssociationP      assoc
+)
+{
+    int status;
+
+    pthread_mutex_lock(&obj_surface->lock);
+    status = surface_remove_association_unlocked(obj_surface, assoc);
+    pthread_mutex_unlock(&obj_surface->lock);
+    return status;
+}
+
 // vaQuerySurfaceAttributes
 VAStatus
 vdpau_QuerySurfaceAttributes(
@@ -374,6 +385,12 @@ vdpau_DestroySurfaces(
         if (!obj_surface)
             continue;
 
+        /* Wait for any vaPutSurface(), vaGetImage() or derived image
+           readback in flight on another thread, and for pending decodes,
+           before the VDPAU surface goes away */
+        pthread_mutex_lock(&obj_surface->lock);
+        surface_fence_wait_decode(obj_surface);
+
         if (obj_surface->vdp_surface != VDP_INVALID_HANDLE) {
             vdpau_video_surface_destroy(driver_data, obj_surface->vdp_surface);
             obj_surface->vdp_surface = VDP_INVALID_HANDLE;
@@ -384,8 +401,12 @@ vdpau_DestroySurfaces(
             obj_surface->output_surfaces[j] = NULL;
         }
         free(obj_surface->output_surfaces);
+        obj_surface->output_surfaces = NULL;
         obj_surface->output_surfaces_count = 0;
         obj_surface->output_surfaces_count_max = 0;
+        surface_staging_destroy(driver_data, obj_surface);
+        derived_image_detach(driver_data, obj_surface);
+        pthread_mutex_unlock(&obj_surface->lock);
 
         if (obj_surface->video_mixer) {
             video_mixer_unref(driver_data, obj_surface->video_mixer);
@@ -420,6 +441,9 @@ vdpau_DestroySurfaces(
         obj_surface->assocs_count = 0;
         obj_surface->assocs_count_max = 0;
 
+        pthread_cond_destroy(&obj_surface->fence_cond);
+        pthread_mutex_destroy(&obj_surface->fence_lock);
+        pthread_mutex_destroy(&obj_surface->lock);
         object_heap_free(&driver_data->surface_heap, (object_base_p)obj_surface);
     }
     return VA_STATUS_SUCCESS;
@@ -480,16 +504,20 @@ vdpau_CreateSurfaces(
         obj_surface->output_surfaces_count      = 0;
         obj_surface->output_surfaces_count_max  = 0;
         obj_surface->video_mixer                = NULL;
+        obj_surface->decode_jobs_pending        = 0;
+        obj_surface->mtime                      = 1;
+        obj_surface->derived_image              = VA_INVALID_ID;
+        obj_surface->staging_block              = NULL;
+        obj_surface->staging_size               = 0;
+        obj_surface->staging_format             = 0;
+        obj_surface->staging_mtime              = 0;
+        pthread_mutex_init(&obj_surface->lock, NULL);
+        pthread_mutex_init(&obj_surface->fence_lock, NULL);
+        pthread_cond_init(&obj_surface->fence_cond, NULL);
         surfaces[i]                             = va_surface;
         vdp_surface                             = VDP_INVALID_HANDLE;
 
-        object_mixer_p obj_mixer;
-        obj_mixer = video_mixer_create_cached(driver_data, obj_surface);
-        if (!obj_mixer) {
-            va_status = VA_STATUS_ERROR_ALLOCATION_FAILED;
-            break;
-        }
-        obj_surface->video_mixer = obj_mixer;
+        /* The video mixer is created on first use, see video_mixer_ensure() */
     }
 
     /* Error recovery */
@@ -501,22 +529,87 @@ vdpau_CreateSurfaces(
     return va_status;
 }
 
+// Releases a reference to the context, freeing it with the last one
+static void
+context_unref(vdpau_driver_data_t *driver_data, object_context_p obj_context)
+{
+    if (__atomic_sub_fetch(&obj_context->refcount, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    pthread_mutex_destroy(&obj_context->lock);
+    object_heap_free(&driver_data->context_heap, (object_base_p)obj_context);
+}
+
+// Takes a reference to the context, if it is still alive
+static object_context_p
+context_ref(vdpau_driver_data_t *driver_data, VAContextID context)
+{
+    object_context_p obj_context = VDPAU_CONTEXT(context);
+    unsigned int refcount;
+
+    if (!obj_context)
+        return NULL;
+
+    /* The slot may be freed, or even reused, after the lookup: only
+       reference live contexts, and check this is still the same one */
+    refcount = __atomic_load_n(&obj_context->refcount, __ATOMIC_RELAXED);
+    do {
+        if (refcount == 0)
+            return NULL;
+    } while (!__atomic_compare_exchange_n(&obj_context->refcount,
+                                          &refcount, refcount + 1, 1,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    if (__atomic_load_n(&obj_context->base.id, __ATOMIC_ACQUIRE) != context) {
+        context_unref(driver_data, obj_context);
+        return NULL;
+    }
+    return obj_context;
+}
+
+// Looks up and locks a context, unless it is being destroyed
+object_context_p
+context_lock(vdpau_driver_data_t *driver_data, VAContextID context)
+{
+    object_context_p obj_context = context_ref(driver_data, context);
+
+    if (!obj_context)
+        return NULL;
+
+    pthread_mutex_lock(&obj_context->lock);
+    if (obj_context->is_dying) {
+        pthread_mutex_unlock(&obj_context->lock);
+        context_unref(driver_data, obj_context);
+        return NULL;
+    }
+    return obj_context;
+}
+
+// Unlocks a context locked with context_lock()
+void
+context_unlock(vdpau_driver_data_t *driver_data, object_context_p obj_context)
+{
+    pthread_mutex_unlock(&obj_context->lock);
+    context_unref(driver_data, obj_context);
+}
+
 // vaDestroyContext
 VAStatus vdpau_DestroyContext(VADriverContextP ctx, VAContextID context)
 {
     VDPAU_DRIVER_DATA_INIT;
     int i;
 
-    object_context_p obj_context = VDPAU_CONTEXT(context);
+    /* Wait for any picture call in flight on another thread. Threads
+       still waiting for the lock bail out once they get it */
+    object_context_p obj_context = context_lock(driver_data, context);
     if (!obj_context)
         return VA_STATUS_ERROR_INVALID_CONTEXT;
+    obj_context->is_dying = 1;
 
-    if (obj_context->gen_slice_data) {
-        free(obj_context->gen_slice_data);
-        obj_context->gen_slice_data = NULL;
-        obj_context->gen_slice_data_size = 0;
-        obj_context->gen_slice_data_size_max = 0;
-    }
+    decode_thread_stop(obj_context);
+    decode_stats_report(obj_context);
+
+    destroy_gen_slice_data(obj_context);
 
     if (obj_context->vdp_bitstream_buffers) {
         free(obj_context->vdp_bitstream_buffers);
@@ -525,10 +618,7 @@ VAStatus vdpau_DestroyContext(VADriverContextP ctx, VAContextID context)
         obj_context->vdp_bitstream_buffers_count_max = 0;
     }
 
-    if (obj_context->vdp_decoder != VDP_INVALID_HANDLE) {
-        vdpau_decoder_destroy(driver_data, obj_context->vdp_decoder);
-        obj_context->vdp_decoder = VDP_INVALID_HANDLE;
-    }
+    release_decoder(driver_data, obj_context);
 
     destroy_dead_va_buffers(driver_data, obj_context);
     if (obj_context->dead_buffers) {
@@ -557,7 +647,10 @@ VAStatus vdpau_DestroyContext(VADriverContextP ctx, VAContextID context)
     obj_context->dead_buffers_count     = 0;
     obj_context->dead_buffers_count_max = 0;
 
-    object_heap_free(&driver_data->context_heap, (object_base_p)obj_context);
+    /* Drop the reference of context_lock(), then the one held since
+       vaCreateContext() */
+    context_unlock(driver_data, obj_context);
+    context_unref(driver_data, obj_context);
     return VA_STATUS_SUCCESS;
 }
 
@@ -620,12 +713,22 @@ vdpau_CreateContext(
     obj_context->vdp_codec              = get_VdpCodec(vdp_profile);
     obj_context->vdp_profile            = vdp_profile;
     obj_context->vdp_decoder            = VDP_INVALID_HANDLE;
+    init_translate_buffer_funcs(obj_context);
     obj_context->gen_slice_data = NULL;
+    obj_context->gen_slice_data_chunk = NULL;
     obj_context->gen_slice_data_size = 0;
     obj_context->gen_slice_data_size_max = 0;
     obj_context->vdp_bitstream_buffers = NULL;
     obj_context->vdp_bitstream_buffers_count = 0;
     obj_context->vdp_bitstream_buffers_count_max = 0;
+    memset(&obj_context->decode_stats, 0, sizeof(obj_context->decode_stats));
+    obj_context->decode_queue = NULL;
+    obj_context->decode_jobs_pending = 0;
+    obj_context->decode_status = VDP_STATUS_OK;
+    obj_context->gen_slice_data_free = NULL;
+    obj_context->is_dying = 0;
+    pthread_mutex_init(&obj_context->lock, NULL);
+    __atomic_store_n(&obj_context->refcount, 1, __ATOMIC_RELEASE);
 
     if (!obj_context->render_targets) {
         vdpau_DestroyContext(ctx, context_id);
@@ -643,9 +746,106 @@ vdpau_CreateContext(
         ASSERT(obj_surface->va_context == VA_INVALID_ID);
         obj_surface->va_context = context_id;
     }
+
+    if (decode_async_enabled() && decode_thread_start(obj_context) < 0) {
+        vdpau_DestroyContext(ctx, context_id);
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
     return VA_STATUS_SUCCESS;
 }
 
+// Records a decode submission to the surface
+void
+surface_fence_begin_decode(object_surface_p obj_surface)
+{
+    pthread_mutex_lock(&obj_surface->fence_lock);
+    obj_surface->decode_jobs_pending++;
+    pthread_mutex_unlock(&obj_surface->fence_lock);
+}
+
+// Signals completion of a decode submission to the surface
+void
+surface_fence_end_decode(object_surface_p obj_surface)
+{
+    pthread_mutex_lock(&obj_surface->fence_lock);
+    ASSERT(obj_surface->decode_jobs_pending > 0);
+    if (--obj_surface->decode_jobs_pending == 0)
+        pthread_cond_broadcast(&obj_surface->fence_cond);
+    pthread_mutex_unlock(&obj_surface->fence_lock);
+}
+
+// Waits for all decode submissions to the surface to complete
+void
+surface_fence_wait_decode(object_surface_p obj_surface)
+{
+    pthread_mutex_lock(&obj_surface->fence_lock);
+    while (obj_surface->decode_jobs_pending > 0)
+        pthread_cond_wait(&obj_surface->fence_cond, &obj_surface->fence_lock);
+    pthread_mutex_unlock(&obj_surface->fence_lock);
+}
+
+// Waits for queued display of the surface to reach the screen. VDPAU can
+// only block until a surface is idle, so wait for the output surface
+// queued before ours: it goes idle once ours is visible
+static VAStatus
+surface_fence_wait_display(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface
+)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&obj_surface->lock);
+    if (obj_surface->va_surface_status != VASurfaceDisplaying) {
+        pthread_mutex_unlock(&obj_surface->lock);
+        return VA_STATUS_SUCCESS;
+    }
+
+    for (i = 0; i < obj_surface->output_surfaces_count; i++) {
+        object_output_p obj_output = obj_surface->output_surfaces[i];
+        if (!obj_output)
+            continue;
+
+        pthread_mutex_lock(&obj_output->vdp_output_surfaces_lock);
+        const unsigned int n = obj_output->num_output_surfaces;
+        const unsigned int displayed = obj_output->displayed_output_surface;
+        const VdpOutputSurface vdp_output_surface =
+            obj_output->vdp_output_surfaces[displayed];
+        const VdpOutputSurface vdp_prev_output_surface =
+            obj_output->vdp_output_surfaces[(displayed + n - 1) % n];
+
+        VdpPresentationQueueStatus vdp_queue_status;
+        VdpTime vdp_dummy_time;
+        VdpStatus vdp_status = VDP_STATUS_ERROR;
+        if (vdp_output_surface != VDP_INVALID_HANDLE)
+            vdp_status = vdpau_presentation_queue_query_surface_status(
+                driver_data,
+                obj_output->vdp_flip_queue,
+                vdp_output_surface,
+                &vdp_queue_status,
+                &vdp_dummy_time
+            );
+
+        /* With nothing queued before it, the surface is shown on the
+           next refresh and there is nothing to wait on */
+        if (vdp_status == VDP_STATUS_OK &&
+            vdp_queue_status == VDP_PRESENTATION_QUEUE_STATUS_QUEUED &&
+            vdp_prev_output_surface != VDP_INVALID_HANDLE &&
+            vdp_prev_output_surface != vdp_output_surface)
+            vdpau_presentation_queue_block_until_surface_idle(
+                driver_data,
+                obj_output->vdp_flip_queue,
+                vdp_prev_output_surface,
+                &vdp_dummy_time
+            );
+        pthread_mutex_unlock(&obj_output->vdp_output_surfaces_lock);
+    }
+    pthread_mutex_unlock(&obj_surface->lock);
+
+    /* Update the surface status */
+    return query_surface_status(driver_data, obj_surface, NULL);
+}
+
 // Query surface status
 VAStatus
 query_surface_status(
@@ -656,12 +856,15 @@ query_surface_status(
 {
     VAStatus va_status = VA_STATUS_SUCCESS;
 
+    pthread_mutex_lock(&obj_surface->lock);
     if (obj_surface->va_surface_status == VASurfaceDisplaying) {
         unsigned int i, num_output_surfaces_displaying = 0;
         for (i = 0; i < obj_surface->output_surfaces_count; i++) {
             object_output_p obj_output = obj_surface->output_surfaces[i];
-            if (!obj_output)
-                return VA_STATUS_ERROR_INVALID_SURFACE;
+            if (!obj_output) {
+                va_status = VA_STATUS_ERROR_INVALID_SURFACE;
+                goto end;
+            }
 
             VdpOutputSurface vdp_output_surface;
             vdp_output_surface = obj_output->vdp_output_surfaces[obj_output->displayed_output_surface];
@@ -688,9 +891,15 @@ query_surface_status(
             obj_surface->va_surface_status = VASurfaceReady;
     }
 
-    if (status)
+    if (status) {
         *status = obj_surface->va_surface_status;
-
+        pthread_mutex_lock(&obj_surface->fence_lock);
+        if (obj_surface->decode_jobs_pending > 0)
+            *status = VASurfaceRendering;
+        pthread_mutex_unlock(&obj_surface->fence_lock);
+    }
+end:
+    pthread_mutex_unlock(&obj_surface->lock);
     return va_status;
 }
 
@@ -718,25 +927,11 @@ sync_surface(
     object_surface_p     obj_surface
 )
 {
-    /* VDPAU only supports status interface for in-progress display */
-    /* XXX: polling is bad but there currently is no alternative */
-    for (;;) {
-        VASurfaceStatus va_surface_status;
-        VAStatus va_status;
+    /* Wait for decode submissions through the surface fence */
+    surface_fence_wait_decode(obj_surface);
 
-        va_status = query_surface_status(
-            driver_data,
-            obj_surface,
-            &va_surface_status
-        );
-        if (va_status != VA_STATUS_SUCCESS)
-            return va_status;
-
-        if (va_surface_status != VASurfaceDisplaying)
-            break;
-        delay_usec(VDPAU_SYNC_DELAY);
-    }
-    return VA_STATUS_SUCCESS;
+    /* Wait for queued display to reach the screen */
+    return surface_fence_wait_display(driver_data, obj_surface);
 }
 
 // vaSyncSurface
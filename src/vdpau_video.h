@@ -23,6 +23,8 @@
 
 #include "vdpau_driver.h"
 #include "vdpau_decode.h"
+#include "uasyncqueue.h"
+#include <pthread.h>
 
 typedef struct SubpictureAssociation *SubpictureAssociationP;
 struct SubpictureAssociation {
@@ -42,9 +44,37 @@ struct object_config {
     int                          attrib_count;
 };
 
+/*
+ * Threading model
+ *
+ * A VADisplay may be used from any number of threads. Objects are
+ * looked up without locking (see object_heap.c) and each object then
+ * carries its own lock, so that independent streams never contend:
+ *
+ * - object_context::lock serializes vaBeginPicture(), vaRenderPicture()
+ *   and vaEndPicture() on a single context, and vaDestroyContext()
+ *   waits for it. It covers the picture info, generated slice data,
+ *   bitstream buffers and dead buffers of that context. Contexts are
+ *   locked through context_lock(), which holds a reference: the lock
+ *   is only destroyed once the last thread waiting on it has seen the
+ *   context is being destroyed;
+ * - object_surface::lock protects the display state of a surface, i.e.
+ *   va_surface_status, output_surfaces[], assocs[] and video_mixer;
+ * - object_output::vdp_output_surfaces_lock protects the flip queue
+ *   state of an output surface, shared by all surfaces put to the same
+ *   Drawable.
+ *
+ * Locks are acquired in the order context, surface, output surface.
+ * The decode thread and the surface fence locks are leaves and never
+ * take any of the above.
+ */
+
 typedef struct object_context object_context_t;
 struct object_context {
     struct object_base           base;
+    pthread_mutex_t              lock;
+    unsigned int                 refcount;
+    unsigned int                 is_dying;
     VAContextID                  context_id;
     VAConfigID                   config_id;
     VASurfaceID                  current_render_target;
@@ -63,26 +93,30 @@ struct object_context {
     VdpCodec                     vdp_codec;
     VdpDecoderProfile            vdp_profile;
     VdpDecoder                   vdp_decoder;
-    uint8_t                     *gen_slice_data;
+    gen_slice_chunk_t           *gen_slice_data;
+    gen_slice_chunk_t           *gen_slice_data_chunk;
     unsigned int                 gen_slice_data_size;
     unsigned int                 gen_slice_data_size_max;
     VdpBitstreamBuffer          *vdp_bitstream_buffers;
     unsigned int                 vdp_bitstream_buffers_count;
     unsigned int                 vdp_bitstream_buffers_count_max;
-    union {
-        VdpPictureInfoMPEG1Or2   mpeg2;
-#if HAVE_VDPAU_MPEG4
-        VdpPictureInfoMPEG4Part2 mpeg4;
-#endif
-        VdpPictureInfoH264       h264;
-        VdpPictureInfoVC1        vc1;
-    }                            vdp_picture_info;
+    vdpau_picture_info_t         vdp_picture_info;
+    translate_buffer_func_t      translate_buffer_funcs[VDPAU_MAX_TRANSLATE_BUFFER_TYPES];
     unsigned int                 vdp_output_surfaces_count;
+    vdpau_decode_stats_t         decode_stats;
+    UAsyncQueue                 *decode_queue;
+    pthread_t                    decode_thread;
+    pthread_mutex_t              decode_lock;
+    pthread_cond_t               decode_cond;
+    unsigned int                 decode_jobs_pending;
+    VdpStatus                    decode_status;
+    gen_slice_chunk_t           *gen_slice_data_free;   /* returned by jobs */
 };
 
 typedef struct object_surface object_surface_t;
 struct object_surface {
     struct object_base           base;
+    pthread_mutex_t              lock;
     VAContextID                  va_context;
     VASurfaceStatus              va_surface_status;
     VdpVideoSurface              vdp_surface;
@@ -96,8 +130,42 @@ struct object_surface {
     SubpictureAssociationP      *assocs;
     unsigned int                 assocs_count;
     unsigned int                 assocs_count_max;
+    pthread_mutex_t              fence_lock;
+    pthread_cond_t               fence_cond;
+    unsigned int                 decode_jobs_pending;
+    uint64_t                     mtime;          /* bumped on content changes */
+    VAImageID                    derived_image;
+    void                        *staging_block;  /* pooled readback buffer */
+    unsigned int                 staging_size;
+    uint32_t                     staging_format;
+    uint64_t                     staging_mtime;  /* surface mtime of the data */
 };
 
+// Looks up and locks a context, unless it is being destroyed
+object_context_p
+context_lock(vdpau_driver_data_t *driver_data, VAContextID context)
+    attribute_hidden;
+
+// Unlocks a context locked with context_lock()
+void
+context_unlock(vdpau_driver_data_t *driver_data, object_context_p obj_context)
+    attribute_hidden;
+
+// Records a decode submission to the surface
+void
+surface_fence_begin_decode(object_surface_p obj_surface)
+    attribute_hidden;
+
+// Signals completion of a decode submission to the surface
+void
+surface_fence_end_decode(object_surface_p obj_surface)
+    attribute_hidden;
+
+// Waits for all decode submissions to the surface to complete
+void
+surface_fence_wait_decode(object_surface_p obj_surface)
+    attribute_hidden;
+
 // Query surface status
 VAStatus
 query_surface_status(
@@ -330,34 +398,4 @@ vdpau_UnlockSurface(
 ) attribute_hidden;
 #endif
 
-static inline VdpStatus
-vdpau_output_surface_create_tracked(
-    vdpau_driver_data_p  driver_data,
-    VdpDevice            device,
-    VdpRGBAFormat        rgba_format,
-    uint32_t             width,
-    uint32_t             height,
-    VdpOutputSurface    *surface,
-    object_context_p     obj_context
-)
-{
-    VdpStatus status = vdpau_output_surface_create(driver_data, device, rgba_format, width, height, surface);
-    if (obj_context && status == VDP_STATUS_OK)
-        ++obj_context->vdp_output_surfaces_count;
-    return status;
-}
-
-static inline VdpStatus
-vdpau_output_surface_destroy_tracked(
-    vdpau_driver_data_p  driver_data,
-    VdpOutputSurface     surface,
-    object_context_p     obj_context
-)
-{
-    VdpStatus status = vdpau_output_surface_destroy(driver_data, surface);
-    if (obj_context && status == VDP_STATUS_OK)
-        --obj_context->vdp_output_surfaces_count;
-    return status;
-}
-
 #endif /* VDPAU_VIDEO_H */
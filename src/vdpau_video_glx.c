@@ -396,12 +396,19 @@ associate_glx_surface(
             if (!obj_glx_surface->gl_surface)
                 return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
+            object_mixer_p obj_mixer;
+            pthread_mutex_lock(&obj_surface->lock);
+            obj_mixer = video_mixer_ensure(driver_data, obj_surface);
+            pthread_mutex_unlock(&obj_surface->lock);
+            if (!obj_mixer)
+                return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
             /* Make sure background color is black with alpha set to 0xff */
             VdpStatus vdp_status;
             static const VdpColor bgcolor = { 0.0f, 0.0f, 0.0f, 1.0f };
             vdp_status = video_mixer_set_background_color(
                 driver_data,
-                obj_surface->video_mixer,
+                obj_mixer,
                 &bgcolor
             );
             if (vdp_status != VDP_STATUS_OK)
@@ -413,6 +420,8 @@ associate_glx_surface(
         dst_rect.width  = obj_surface->width;
         dst_rect.height = obj_surface->height;
 
+        pthread_mutex_lock(&obj_surface->lock);
+
         /* Render the video surface to the output surface */
         va_status = render_surface(
             driver_data,
@@ -422,17 +431,18 @@ associate_glx_surface(
             &dst_rect,
             flags | VA_CLEAR_DRAWABLE
         );
-        if (va_status != VA_STATUS_SUCCESS)
-            return va_status;
 
         /* Render subpictures to the output surface, applying scaling */
-        va_status = render_subpictures(
-            driver_data,
-            obj_surface,
-            obj_glx_surface->gl_output,
-            &src_rect,
-            &dst_rect
-        );
+        if (va_status == VA_STATUS_SUCCESS)
+            va_status = render_subpictures(
+                driver_data,
+                obj_surface,
+                obj_glx_surface->gl_output,
+                &src_rect,
+                &dst_rect
+            );
+
+        pthread_mutex_unlock(&obj_surface->lock);
         if (va_status != VA_STATUS_SUCCESS)
             return va_status;
     }
@@ -460,16 +470,17 @@ associate_glx_surface(
         /* Force rendering of fields now */
         if ((flags ^ (VA_TOP_FIELD|VA_BOTTOM_FIELD)) != 0) {
             object_output_p obj_output;
+            pthread_mutex_lock(&obj_surface->lock);
             obj_output = output_surface_lookup(
                 obj_surface,
                 obj_glx_surface->pixo->pixmap
             );
             ASSERT(obj_output);
-            if (obj_output && obj_output->fields) {
+            if (obj_output && obj_output->fields)
                 va_status = queue_surface(driver_data, obj_surface, obj_output);
-                if (va_status != VA_STATUS_SUCCESS)
-                    return va_status;
-            }
+            pthread_mutex_unlock(&obj_surface->lock);
+            if (va_status != VA_STATUS_SUCCESS)
+                return va_status;
         }
     }
 
@@ -98,23 +98,363 @@ configure_notify_event_pending(
 static inline void
 output_surface_lock(object_output_p obj_output)
 {
+    pthread_mutex_lock(&obj_output->vdp_output_surfaces_lock);
+}
+
+// Tries to lock output surfaces, returns zero on success
+static inline int
+output_surface_trylock(object_output_p obj_output)
+{
+    return pthread_mutex_trylock(&obj_output->vdp_output_surfaces_lock);
 }
 
 // Unlocks output surfaces
 static inline void
 output_surface_unlock(object_output_p obj_output)
 {
+    pthread_mutex_unlock(&obj_output->vdp_output_surfaces_lock);
+}
+
+/* Waits longer than this grow the output surface ring */
+#define OUTPUT_SURFACE_BLOCK_THRESHOLD 2000000 /* ns */
+
+/* Default number of output surfaces kept in the pool */
+#define OUTPUT_POOL_SIZE_MAX_DEFAULT 8
+
+// Output surface kept in the pool
+struct vdpau_output_pool_entry {
+    vdpau_output_pool_entry_t  *next;
+    VdpOutputSurface            vdp_output_surface;
+    VdpRGBAFormat               rgba_format;
+    uint32_t                    width;
+    uint32_t                    height;
+    VdpPresentationQueue        vdp_flip_queue; // queue it may still be in
+};
+
+// Returns the maximum number of output surfaces retained by the pool
+static unsigned int get_output_pool_size_max(void)
+{
+    static int g_output_pool_size = -1;
+    if (g_output_pool_size < 0) {
+        if (getenv_int("VDPAU_VIDEO_OUTPUT_POOL_SIZE", &g_output_pool_size) < 0 ||
+            g_output_pool_size < 0)
+            g_output_pool_size = OUTPUT_POOL_SIZE_MAX_DEFAULT;
+    }
+    return g_output_pool_size;
+}
+
+// Returns the pool bucket for output surfaces of that format and size
+static inline vdpau_output_pool_entry_t **
+output_pool_bucket(
+    vdpau_output_pool_t *pool,
+    VdpRGBAFormat        rgba_format,
+    uint32_t             width,
+    uint32_t             height
+)
+{
+    const uint32_t hash = rgba_format * 31 + (width >> 8) * 7 + (height >> 8);
+
+    return &pool->buckets[hash % VDPAU_OUTPUT_POOL_BUCKETS];
+}
+
+// Initialize the pool of idle output surfaces
+void
+output_pool_init(vdpau_driver_data_t *driver_data)
+{
+    vdpau_output_pool_t * const pool = &driver_data->output_pool;
+
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->size_max = get_output_pool_size_max();
 }
 
+// Destroys a list of pool entries
+static void
+output_pool_destroy_entries(
+    vdpau_driver_data_t        *driver_data,
+    vdpau_output_pool_entry_t  *entry
+)
+{
+    vdpau_output_pool_entry_t *next_entry;
+
+    for (; entry != NULL; entry = next_entry) {
+        next_entry = entry->next;
+        vdpau_output_surface_destroy(driver_data, entry->vdp_output_surface);
+        free(entry);
+    }
+}
+
+// Destroy all output surfaces retained by the pool
+void
+output_pool_destroy(vdpau_driver_data_t *driver_data)
+{
+    vdpau_output_pool_t * const pool = &driver_data->output_pool;
+    unsigned int i;
+
+    if (stats_enabled() && (pool->num_hits || pool->num_misses))
+        vdpau_information_message(
+            "output surface pool: %llu hits, %llu misses\n",
+            (unsigned long long)pool->num_hits,
+            (unsigned long long)pool->num_misses);
+
+    for (i = 0; i < VDPAU_OUTPUT_POOL_BUCKETS; i++) {
+        output_pool_destroy_entries(driver_data, pool->buckets[i]);
+        pool->buckets[i] = NULL;
+    }
+    output_pool_destroy_entries(driver_data, pool->pending);
+    pool->pending = NULL;
+    pool->size    = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
+
+// Moves the pending output surfaces that went off-screen to the idle
+// buckets. If VDP_FLIP_QUEUE is valid, its surfaces are moved as well
+static void
+output_pool_reap_unlocked(
+    vdpau_driver_data_t *driver_data,
+    VdpPresentationQueue vdp_flip_queue
+)
+{
+    vdpau_output_pool_t * const pool = &driver_data->output_pool;
+    vdpau_output_pool_entry_t *entry, **entry_p, **bucket;
+
+    entry_p = &pool->pending;
+    while ((entry = *entry_p) != NULL) {
+        if (entry->vdp_flip_queue != vdp_flip_queue) {
+            VdpPresentationQueueStatus vdp_queue_status;
+            VdpTime vdp_dummy_time;
+            VdpStatus vdp_status;
+            vdp_status = vdpau_presentation_queue_query_surface_status(
+                driver_data,
+                entry->vdp_flip_queue,
+                entry->vdp_output_surface,
+                &vdp_queue_status,
+                &vdp_dummy_time
+            );
+            if (vdp_status == VDP_STATUS_OK &&
+                vdp_queue_status != VDP_PRESENTATION_QUEUE_STATUS_IDLE) {
+                entry_p = &entry->next;
+                continue;
+            }
+        }
+        *entry_p = entry->next;
+        entry->vdp_flip_queue = VDP_INVALID_HANDLE;
+        bucket = output_pool_bucket(pool, entry->rgba_format,
+                                    entry->width, entry->height);
+        entry->next = *bucket;
+        *bucket     = entry;
+    }
+}
+
+// Forgets about VDP_FLIP_QUEUE, which was destroyed
+static void
+output_pool_flush_queue(
+    vdpau_driver_data_t *driver_data,
+    VdpPresentationQueue vdp_flip_queue
+)
+{
+    vdpau_output_pool_t * const pool = &driver_data->output_pool;
+
+    pthread_mutex_lock(&pool->lock);
+    output_pool_reap_unlocked(driver_data, vdp_flip_queue);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Looks up an idle output surface of that format and size, never blocks
 static VdpOutputSurface
-try_acquire_output_surface(vdpau_driver_data_t *driver_data, object_output_p obj_output, object_output_p new_owner, bool waitVisibleSurface)
+output_pool_get(
+    vdpau_driver_data_t *driver_data,
+    VdpRGBAFormat        rgba_format,
+    uint32_t             width,
+    uint32_t             height
+)
+{
+    vdpau_output_pool_t * const pool = &driver_data->output_pool;
+    vdpau_output_pool_entry_t *entry, **entry_p;
+    VdpOutputSurface vdp_output_surface = VDP_INVALID_HANDLE;
+    int reaped = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        entry_p = output_pool_bucket(pool, rgba_format, width, height);
+        for (; (entry = *entry_p) != NULL; entry_p = &entry->next) {
+            if (entry->rgba_format == rgba_format &&
+                entry->width == width && entry->height == height)
+                break;
+        }
+        if (entry || reaped || !pool->pending)
+            break;
+        output_pool_reap_unlocked(driver_data, VDP_INVALID_HANDLE);
+        reaped = 1;
+    }
+    if (entry) {
+        *entry_p = entry->next;
+        pool->size--;
+        pool->num_hits++;
+        vdp_output_surface = entry->vdp_output_surface;
+        free(entry);
+    }
+    else
+        pool->num_misses++;
+    pthread_mutex_unlock(&pool->lock);
+    return vdp_output_surface;
+}
+
+// Keeps an output surface in the pool, or destroys it if the pool is full.
+// The surface becomes available once VDP_FLIP_QUEUE no longer holds it
+static void
+output_pool_put(
+    vdpau_driver_data_t *driver_data,
+    VdpOutputSurface     vdp_output_surface,
+    VdpRGBAFormat        rgba_format,
+    uint32_t             width,
+    uint32_t             height,
+    VdpPresentationQueue vdp_flip_queue
+)
+{
+    vdpau_output_pool_t * const pool = &driver_data->output_pool;
+    vdpau_output_pool_entry_t *entry, **bucket;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->size >= pool->size_max || !(entry = malloc(sizeof(*entry)))) {
+        pthread_mutex_unlock(&pool->lock);
+        vdpau_output_surface_destroy(driver_data, vdp_output_surface);
+        return;
+    }
+    entry->vdp_output_surface = vdp_output_surface;
+    entry->rgba_format        = rgba_format;
+    entry->width              = width;
+    entry->height             = height;
+    entry->vdp_flip_queue     = vdp_flip_queue;
+
+    if (vdp_flip_queue != VDP_INVALID_HANDLE)
+        bucket = &pool->pending;
+    else
+        bucket = output_pool_bucket(pool, rgba_format, width, height);
+    entry->next = *bucket;
+    *bucket     = entry;
+    pool->size++;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Creates an output surface, reusing an idle one from the pool if possible
+static VdpStatus
+vdpau_output_surface_create_tracked(
+    vdpau_driver_data_p  driver_data,
+    VdpDevice            device,
+    VdpRGBAFormat        rgba_format,
+    uint32_t             width,
+    uint32_t             height,
+    VdpOutputSurface    *surface,
+    object_context_p     obj_context
+)
+{
+    VdpStatus status = VDP_STATUS_OK;
+
+    *surface = output_pool_get(driver_data, rgba_format, width, height);
+    if (*surface == VDP_INVALID_HANDLE)
+        status = vdpau_output_surface_create(driver_data, device, rgba_format, width, height, surface);
+    if (obj_context && status == VDP_STATUS_OK)
+        ++obj_context->vdp_output_surfaces_count;
+    return status;
+}
+
+// Releases an output surface to the pool
+static void
+vdpau_output_surface_destroy_tracked(
+    vdpau_driver_data_p  driver_data,
+    VdpOutputSurface     surface,
+    VdpRGBAFormat        rgba_format,
+    uint32_t             width,
+    uint32_t             height,
+    VdpPresentationQueue vdp_flip_queue,
+    object_context_p     obj_context
+)
+{
+    output_pool_put(driver_data, surface, rgba_format, width, height, vdp_flip_queue);
+    if (obj_context)
+        --obj_context->vdp_output_surfaces_count;
+}
+
+// Returns the initial number of output surfaces per drawable
+static unsigned int get_num_output_surfaces(void)
+{
+    static int g_num_output_surfaces = -1;
+    if (g_num_output_surfaces < 0) {
+        if (getenv_int("VDPAU_VIDEO_OUTPUT_SURFACES", &g_num_output_surfaces) < 0)
+            g_num_output_surfaces = 3;
+        g_num_output_surfaces = MAX(g_num_output_surfaces, VDPAU_MIN_OUTPUT_SURFACES);
+        g_num_output_surfaces = MIN(g_num_output_surfaces, VDPAU_MAX_OUTPUT_SURFACES);
+    }
+    return g_num_output_surfaces;
+}
+
+// Blocks until SURFACE is idle, accounting the time to OBJ_OUTPUT
+static VdpStatus
+output_surface_block_until_idle(
+    vdpau_driver_data_t *driver_data,
+    VdpPresentationQueue vdp_flip_queue,
+    VdpOutputSurface     surface,
+    object_output_p      obj_output,
+    uint64_t            *pblock_time
+)
+{
+    VdpTime dummy_time;
+    VdpStatus vdp_status;
+    uint64_t start, block_time;
+
+    start = get_ticks_nsec();
+    vdp_status = vdpau_presentation_queue_block_until_surface_idle(
+        driver_data,
+        vdp_flip_queue,
+        surface,
+        &dummy_time
+    );
+    block_time = get_ticks_nsec() - start;
+
+    obj_output->block_count++;
+    obj_output->block_time += block_time;
+    if (pblock_time)
+        *pblock_time = block_time;
+    return vdp_status;
+}
+
+// Grows the output surface ring by one slot, inserted after the current one
+static int
+output_surface_grow_unlocked(object_output_p obj_output)
+{
+    const unsigned int n   = obj_output->num_output_surfaces;
+    const unsigned int pos = obj_output->current_output_surface + 1;
+    unsigned int i;
+
+    if (n >= VDPAU_MAX_OUTPUT_SURFACES)
+        return 0;
+
+    for (i = n; i > pos; i--) {
+        obj_output->vdp_output_surfaces[i] = obj_output->vdp_output_surfaces[i - 1];
+        obj_output->vdp_output_surfaces_dirty[i] = obj_output->vdp_output_surfaces_dirty[i - 1];
+    }
+    obj_output->vdp_output_surfaces[pos] = VDP_INVALID_HANDLE;
+    obj_output->vdp_output_surfaces_dirty[pos] = 0;
+
+    if (obj_output->displayed_output_surface >= pos)
+        obj_output->displayed_output_surface++;
+    obj_output->num_output_surfaces = n + 1;
+
+    D(bug("output 0x%08x: grew to %u output surfaces\n",
+          obj_output->base.id, obj_output->num_output_surfaces));
+    return 1;
+}
+
+static VdpOutputSurface
+try_acquire_output_surface_unlocked(vdpau_driver_data_t *driver_data, object_output_p obj_output, object_output_p new_owner, bool waitVisibleSurface)
 {
     if (obj_output == new_owner
         || obj_output->max_width != new_owner->max_width
         || obj_output->max_height != new_owner->max_height)
         return VDP_INVALID_HANDLE;
 
-    for (int i = 0; i < VDPAU_MAX_OUTPUT_SURFACES; i++) {
+    for (unsigned int i = 0; i < obj_output->num_output_surfaces; i++) {
         const VdpOutputSurface surface = obj_output->vdp_output_surfaces[i];
         if (surface == VDP_INVALID_HANDLE)
             continue;
@@ -133,20 +473,18 @@ try_acquire_output_surface(vdpau_driver_data_t *driver_data, object_output_p obj
             case VDP_PRESENTATION_QUEUE_STATUS_VISIBLE:
                 if (waitVisibleSurface) {
                     D(bug("Blocking for the visible surface!!!\n"));
-                    VdpTime dummy_time;
-                    vdp_status = vdpau_presentation_queue_block_until_surface_idle(
+                    vdp_status = output_surface_block_until_idle(
                         driver_data,
                         obj_output->vdp_flip_queue,
                         surface,
-                        &dummy_time
+                        new_owner,
+                        NULL
                     );
                 } else
                     break;
             case VDP_PRESENTATION_QUEUE_STATUS_IDLE: {
-                output_surface_lock(obj_output);
                 obj_output->vdp_output_surfaces[i] = VDP_INVALID_HANDLE;
                 obj_output->vdp_output_surfaces_dirty[i] = 0;
-                output_surface_unlock(obj_output);
                 return surface;
             }
         }
@@ -155,6 +493,21 @@ try_acquire_output_surface(vdpau_driver_data_t *driver_data, object_output_p obj
     return VDP_INVALID_HANDLE;
 }
 
+static VdpOutputSurface
+try_acquire_output_surface(vdpau_driver_data_t *driver_data, object_output_p obj_output, object_output_p new_owner, bool waitVisibleSurface)
+{
+    VdpOutputSurface surface;
+
+    /* The caller holds the new_owner lock, so skip output surfaces in
+       use by another thread rather than risk a lock-order inversion */
+    if (obj_output == new_owner || output_surface_trylock(obj_output) != 0)
+        return VDP_INVALID_HANDLE;
+
+    surface = try_acquire_output_surface_unlocked(driver_data, obj_output, new_owner, waitVisibleSurface);
+    output_surface_unlock(obj_output);
+    return surface;
+}
+
 static VdpOutputSurface
 _try_reuse_output_surface(
     vdpau_driver_data_t *driver_data,
@@ -221,21 +574,25 @@ _output_surface_ensure_size(
     const object_context_p obj_context = VDPAU_CONTEXT(obj_output->va_context);
 
     if (width > obj_output->max_width || height > obj_output->max_height) {
-        const unsigned int max_waste = 1U << 8;
-        obj_output->max_width        = (width  + max_waste - 1) & -max_waste;
-        obj_output->max_height       = (height + max_waste - 1) & -max_waste;
-
-        for (i = 0; i < VDPAU_MAX_OUTPUT_SURFACES; i++) {
+        for (i = 0; i < obj_output->num_output_surfaces; i++) {
             if (obj_output->vdp_output_surfaces[i] != VDP_INVALID_HANDLE) {
                 vdpau_output_surface_destroy_tracked(
                     driver_data,
                     obj_output->vdp_output_surfaces[i],
+                    VDP_RGBA_FORMAT_B8G8R8A8,
+                    obj_output->max_width,
+                    obj_output->max_height,
+                    obj_output->vdp_flip_queue,
                     obj_context
                 );
                 obj_output->vdp_output_surfaces[i] = VDP_INVALID_HANDLE;
                 obj_output->vdp_output_surfaces_dirty[i] = 0;
             }
         }
+
+        const unsigned int max_waste = 1U << 8;
+        obj_output->max_width        = (width  + max_waste - 1) & -max_waste;
+        obj_output->max_height       = (height + max_waste - 1) & -max_waste;
     }
 
     obj_output->size_changed = (
@@ -245,31 +602,28 @@ _output_surface_ensure_size(
     if (obj_output->size_changed) {
         obj_output->width  = width;
         obj_output->height = height;
-        for (i = 0; i < VDPAU_MAX_OUTPUT_SURFACES; i++)
+        for (i = 0; i < obj_output->num_output_surfaces; i++)
             obj_output->vdp_output_surfaces_dirty[i] = 0;
     }
 
     if (obj_output->vdp_output_surfaces[obj_output->current_output_surface] == VDP_INVALID_HANDLE) {
-        VdpOutputSurface surface = try_reuse_output_surface(driver_data, obj_surface, obj_output, obj_context && obj_context->vdp_output_surfaces_count > 4);
-        if (surface != VDP_INVALID_HANDLE)
+        VdpStatus vdp_status;
+        vdp_status = vdpau_output_surface_create_tracked(
+            driver_data,
+            driver_data->vdp_device,
+            VDP_RGBA_FORMAT_B8G8R8A8,
+            obj_output->max_width,
+            obj_output->max_height,
+            &obj_output->vdp_output_surfaces[obj_output->current_output_surface],
+            obj_context
+        );
+        /* Out of video memory: steal a surface from another drawable */
+        if (!VDPAU_CHECK_STATUS(vdp_status, "VdpOutputSurfaceCreate()")) {
+            VdpOutputSurface surface;
+            surface = try_reuse_output_surface(driver_data, obj_surface, obj_output, true);
+            if (surface == VDP_INVALID_HANDLE)
+                return -1;
             obj_output->vdp_output_surfaces[obj_output->current_output_surface] = surface;
-        else {
-            VdpStatus vdp_status;
-            vdp_status = vdpau_output_surface_create_tracked(
-                driver_data,
-                driver_data->vdp_device,
-                VDP_RGBA_FORMAT_B8G8R8A8,
-                obj_output->max_width,
-                obj_output->max_height,
-                &obj_output->vdp_output_surfaces[obj_output->current_output_surface],
-                obj_context
-            );
-            if (!VDPAU_CHECK_STATUS(vdp_status, "VdpOutputSurfaceCreate()")) {
-                surface = try_reuse_output_surface(driver_data, obj_surface, obj_output, true);
-                if (surface == VDP_INVALID_HANDLE)
-                    return -1;
-                obj_output->vdp_output_surfaces[obj_output->current_output_surface] = surface;
-            }
         }
     }
     return 0;
@@ -305,6 +659,7 @@ output_surface_create(
     if (!obj_output)
         return NULL;
 
+    pthread_mutex_init(&obj_output->vdp_output_surfaces_lock, NULL);
     obj_output->refcount                 = 1;
     obj_output->drawable                 = drawable;
     obj_output->width                    = width;
@@ -313,10 +668,13 @@ output_surface_create(
     obj_output->max_height               = 0;
     obj_output->vdp_flip_queue           = VDP_INVALID_HANDLE;
     obj_output->vdp_flip_target          = VDP_INVALID_HANDLE;
+    obj_output->num_output_surfaces      = get_num_output_surfaces();
     obj_output->current_output_surface   = 0;
     obj_output->displayed_output_surface = 0;
     obj_output->queued_surfaces          = 0;
     obj_output->fields                   = 0;
+    obj_output->block_count              = 0;
+    obj_output->block_time               = 0;
     obj_output->is_window                = 0;
     obj_output->size_changed             = 0;
     obj_output->va_context               = obj_surface->va_context;
@@ -329,7 +687,6 @@ output_surface_create(
         obj_output->vdp_output_surfaces[i] = VDP_INVALID_HANDLE;
         obj_output->vdp_output_surfaces_dirty[i] = 0;
     }
-    pthread_mutex_init(&obj_output->vdp_output_surfaces_lock, NULL);
 
     if (drawable != None) {
         VdpStatus vdp_status;
@@ -368,11 +725,22 @@ output_surface_destroy(
     if (!obj_output)
         return;
 
+    if (stats_enabled() && obj_output->queued_surfaces > 0)
+        vdpau_information_message(
+            "output 0x%08x: %u output surfaces, %u frames, "
+            "%llu waits, %llu us blocked\n",
+            obj_output->base.id,
+            obj_output->num_output_surfaces,
+            obj_output->queued_surfaces,
+            (unsigned long long)obj_output->block_count,
+            (unsigned long long)(obj_output->block_time / 1000));
+
     if (obj_output->vdp_flip_queue != VDP_INVALID_HANDLE) {
         vdpau_presentation_queue_destroy(
             driver_data,
             obj_output->vdp_flip_queue
         );
+        output_pool_flush_queue(driver_data, obj_output->vdp_flip_queue);
         obj_output->vdp_flip_queue = VDP_INVALID_HANDLE;
     }
 
@@ -385,16 +753,23 @@ output_surface_destroy(
     }
 
     unsigned int i;
-    for (i = 0; i < VDPAU_MAX_OUTPUT_SURFACES; i++) {
+    for (i = 0; i < obj_output->num_output_surfaces; i++) {
         VdpOutputSurface vdp_output_surface;
         vdp_output_surface = obj_output->vdp_output_surfaces[i];
         if (vdp_output_surface != VDP_INVALID_HANDLE) {
-            vdpau_output_surface_destroy_tracked(driver_data, vdp_output_surface, VDPAU_CONTEXT(obj_output->va_context));
+            vdpau_output_surface_destroy_tracked(
+                driver_data,
+                vdp_output_surface,
+                VDP_RGBA_FORMAT_B8G8R8A8,
+                obj_output->max_width,
+                obj_output->max_height,
+                VDP_INVALID_HANDLE,
+                VDPAU_CONTEXT(obj_output->va_context)
+            );
             obj_output->vdp_output_surfaces[i] = VDP_INVALID_HANDLE;
         }
     }
 
-    pthread_mutex_unlock(&obj_output->vdp_output_surfaces_lock);
     pthread_mutex_destroy(&obj_output->vdp_output_surfaces_lock);
     object_heap_free(&driver_data->output_heap, (object_base_p)obj_output);
 }
@@ -425,10 +800,11 @@ output_surface_unref(
     if (!obj_output)
         return;
 
+    unsigned int refcount;
     output_surface_lock(obj_output);
-    --obj_output->refcount;
+    refcount = --obj_output->refcount;
     output_surface_unlock(obj_output);
-    if (obj_output->refcount == 0)
+    if (refcount == 0)
         output_surface_destroy(driver_data, obj_output);
 }
 
@@ -545,10 +921,14 @@ render_surface(
             vdp_background = obj_output->vdp_output_surfaces[background_surface];
     }
 
+    object_mixer_p obj_mixer = video_mixer_ensure(driver_data, obj_surface);
+    if (!obj_mixer)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
     VdpStatus vdp_status;
     vdp_status = video_mixer_render(
         driver_data,
-        obj_surface->video_mixer,
+        obj_mixer,
         obj_surface,
         vdp_background,
         obj_output->vdp_output_surfaces[obj_output->current_output_surface],
@@ -720,7 +1100,8 @@ flip_surface_unlocked(
 
     obj_output->displayed_output_surface = obj_output->current_output_surface;
     obj_output->current_output_surface   =
-        (++obj_output->queued_surfaces) % VDPAU_MAX_OUTPUT_SURFACES;
+        (obj_output->current_output_surface + 1) % obj_output->num_output_surfaces;
+    obj_output->queued_surfaces++;
     return VA_STATUS_SUCCESS;
 }
 
@@ -772,15 +1153,21 @@ put_surface_unlocked(
        i.e. it completed the previous rendering */
     if (obj_output->vdp_output_surfaces[obj_output->current_output_surface] != VDP_INVALID_HANDLE &&
         obj_output->vdp_output_surfaces_dirty[obj_output->current_output_surface]) {
-        VdpTime dummy_time;
-        vdp_status = vdpau_presentation_queue_block_until_surface_idle(
+        uint64_t block_time;
+        vdp_status = output_surface_block_until_idle(
             driver_data,
             obj_output->vdp_flip_queue,
             obj_output->vdp_output_surfaces[obj_output->current_output_surface],
-            &dummy_time
+            obj_output,
+            &block_time
         );
         if (!VDPAU_CHECK_STATUS(vdp_status, "VdpPresentationQueueBlockUntilSurfaceIdle()"))
             return vdpau_get_VAStatus(vdp_status);
+
+        /* The ring is too shallow if we had to wait for the surface
+           to go off-screen: the next frame gets a new output surface */
+        if (block_time > OUTPUT_SURFACE_BLOCK_THRESHOLD)
+            output_surface_grow_unlocked(obj_output);
     }
 
     /* Render the video surface to the output surface */
@@ -820,10 +1207,10 @@ put_surface_unlocked(
     return VA_STATUS_SUCCESS;
 }
 
-VAStatus
-put_surface(
+static VAStatus
+_put_surface(
     vdpau_driver_data_t *driver_data,
-    VASurfaceID          surface,
+    object_surface_p     obj_surface,
     Drawable             drawable,
     unsigned int         drawable_width,
     unsigned int         drawable_height,
@@ -835,10 +1222,6 @@ put_surface(
     VAStatus va_status;
     int status;
 
-    object_surface_p obj_surface = VDPAU_SURFACE(surface);
-    if (!obj_surface)
-        return VA_STATUS_ERROR_INVALID_SURFACE;
-
     object_output_p obj_output;
     obj_output = output_surface_ensure(
         driver_data,
@@ -891,6 +1274,39 @@ put_surface(
     return va_status;
 }
 
+VAStatus
+put_surface(
+    vdpau_driver_data_t *driver_data,
+    VASurfaceID          surface,
+    Drawable             drawable,
+    unsigned int         drawable_width,
+    unsigned int         drawable_height,
+    const VARectangle   *source_rect,
+    const VARectangle   *target_rect,
+    unsigned int         flags
+)
+{
+    VAStatus va_status;
+
+    object_surface_p obj_surface = VDPAU_SURFACE(surface);
+    if (!obj_surface)
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    pthread_mutex_lock(&obj_surface->lock);
+    va_status = _put_surface(
+        driver_data,
+        obj_surface,
+        drawable,
+        drawable_width,
+        drawable_height,
+        source_rect,
+        target_rect,
+        flags
+    );
+    pthread_mutex_unlock(&obj_surface->lock);
+    return va_status;
+}
+
 // vaPutSurface
 VAStatus
 vdpau_PutSurface(
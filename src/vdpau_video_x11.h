@@ -39,15 +39,28 @@ struct object_output {
     VdpOutputSurface            vdp_output_surfaces[VDPAU_MAX_OUTPUT_SURFACES];
     unsigned int                vdp_output_surfaces_dirty[VDPAU_MAX_OUTPUT_SURFACES];
     pthread_mutex_t             vdp_output_surfaces_lock;
+    unsigned int                num_output_surfaces; /* ring depth */
     unsigned int                current_output_surface;
     unsigned int                displayed_output_surface;
     unsigned int                queued_surfaces;
     unsigned int                fields;
+    uint64_t                    block_count;    /* waits for an idle surface */
+    uint64_t                    block_time;     /* time blocked waiting, in ns */
     unsigned int                is_window    : 1; /* drawable is a window */
     unsigned int                size_changed : 1; /* size changed since previous vaPutSurface() and user noticed the change */
     VAContextID                 va_context;
 };
 
+// Initialize the pool of idle output surfaces
+void
+output_pool_init(vdpau_driver_data_t *driver_data)
+    attribute_hidden;
+
+// Destroy all output surfaces retained by the pool
+void
+output_pool_destroy(vdpau_driver_data_t *driver_data)
+    attribute_hidden;
+
 // Create output surface
 object_output_p
 output_surface_create(
@@ -0,0 +1,286 @@
+/*
+ *  bench_convert.c - Pixel format conversion throughput
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+/*
+ * Usage: bench_convert [megapixels] [num_threads]
+ *
+ * Runs each conversion kernel over MEGAPIXELS million pixels per frame
+ * size, and reports the throughput in pixels per second. NUM_THREADS is
+ * the number of copy engine threads, the caller included. Conversions
+ * from NV12 and back must give the NV12 frame back.
+ */
+
+#include "sysdeps.h"
+#include "test_common.h"
+#include "image_convert.h"
+
+#define MEGAPIXELS_DEFAULT      16
+#define NUM_THREADS_DEFAULT     1
+#define STRIDE_ALIGN            64
+
+static const struct {
+    unsigned int        width;
+    unsigned int        height;
+} frame_sizes[] = {
+    {  720,  480 },
+    { 1280,  720 },
+    { 1920, 1080 },
+    { 3840, 2160 },
+};
+
+// Source and destination buffers for a frame size
+typedef struct {
+    unsigned int        width;
+    unsigned int        height;
+    unsigned int        nv12_stride;
+    uint8_t            *nv12;
+    uint8_t            *nv12_out;
+    unsigned int        image_stride;
+    uint8_t            *image;
+    unsigned int        rgb_stride;
+    uint8_t            *rgb;
+} frame_t;
+
+typedef struct {
+    const char         *name;
+    ImageConvert        convert;
+    void              (*run)(ImageCopyPool *pool, frame_t *frame,
+                             ImageConvert convert);
+} kernel_t;
+
+// Returns the chroma plane of an NV12-like buffer
+static inline uint8_t *
+get_chroma(uint8_t *buf, unsigned int stride, const frame_t *frame)
+{
+    return buf + stride * frame->height;
+}
+
+static void
+run_copy(ImageCopyPool *pool, frame_t *frame, ImageConvert convert)
+{
+    image_copy_plane(pool, frame->nv12_out, frame->nv12_stride,
+                     frame->nv12, frame->nv12_stride,
+                     frame->width, frame->height);
+    image_copy_plane(pool,
+                     get_chroma(frame->nv12_out, frame->nv12_stride, frame),
+                     frame->nv12_stride,
+                     get_chroma(frame->nv12, frame->nv12_stride, frame),
+                     frame->nv12_stride,
+                     frame->width, frame->height / 2);
+}
+
+static void
+run_from_nv12(ImageCopyPool *pool, frame_t *frame, ImageConvert convert)
+{
+    image_convert_from_nv12(pool, convert, 0,
+                            frame->image, frame->image_stride,
+                            frame->nv12, frame->nv12_stride,
+                            frame->width, frame->height);
+    image_convert_from_nv12(pool, convert, 1,
+                            get_chroma(frame->image, frame->image_stride, frame),
+                            frame->image_stride,
+                            get_chroma(frame->nv12, frame->nv12_stride, frame),
+                            frame->nv12_stride,
+                            frame->width, frame->height / 2);
+}
+
+static void
+run_to_nv12(ImageCopyPool *pool, frame_t *frame, ImageConvert convert)
+{
+    image_convert_to_nv12(pool, convert, 0,
+                          frame->nv12_out, frame->nv12_stride,
+                          frame->image, frame->image_stride,
+                          frame->width, frame->height);
+    image_convert_to_nv12(pool, convert, 1,
+                          get_chroma(frame->nv12_out, frame->nv12_stride, frame),
+                          frame->nv12_stride,
+                          get_chroma(frame->image, frame->image_stride, frame),
+                          frame->image_stride,
+                          frame->width, frame->height / 2);
+}
+
+static void
+run_rgb32_to_yuv420(ImageCopyPool *pool, frame_t *frame, unsigned int chroma_step)
+{
+    static const uint8_t rgb_offsets[3] = { 2, 1, 0 }; /* BGRA */
+    uint8_t * const dst_c = get_chroma(frame->image, frame->image_stride, frame);
+    const unsigned int dst_c_stride = chroma_step == 2 ?
+        frame->image_stride : frame->image_stride / 2;
+
+    image_rgb32_to_yuv420(pool, frame->image, frame->image_stride,
+                          dst_c, chroma_step == 2 ? dst_c + 1 :
+                          dst_c + dst_c_stride * (frame->height / 2),
+                          dst_c_stride, chroma_step,
+                          frame->rgb, frame->rgb_stride, rgb_offsets,
+                          frame->width, frame->height,
+                          IMAGE_COLORSPACE_BT709);
+}
+
+static void
+run_rgb32_to_nv12(ImageCopyPool *pool, frame_t *frame, ImageConvert convert)
+{
+    run_rgb32_to_yuv420(pool, frame, 2);
+}
+
+static void
+run_rgb32_to_i420(ImageCopyPool *pool, frame_t *frame, ImageConvert convert)
+{
+    run_rgb32_to_yuv420(pool, frame, 1);
+}
+
+// Kernels converting to NV12 run after the matching conversion from NV12
+static const kernel_t kernels[] = {
+    { "copy NV12",    IMAGE_CONVERT_NONE, run_copy            },
+    { "NV12 to NV21", IMAGE_CONVERT_NV21, run_from_nv12       },
+    { "NV21 to NV12", IMAGE_CONVERT_NV21, run_to_nv12         },
+    { "NV12 to P010", IMAGE_CONVERT_P010, run_from_nv12       },
+    { "P010 to NV12", IMAGE_CONVERT_P010, run_to_nv12         },
+    { "NV12 to P016", IMAGE_CONVERT_P016, run_from_nv12       },
+    { "P016 to NV12", IMAGE_CONVERT_P016, run_to_nv12         },
+    { "BGRA to NV12", IMAGE_CONVERT_NONE, run_rgb32_to_nv12   },
+    { "BGRA to I420", IMAGE_CONVERT_NONE, run_rgb32_to_i420   },
+};
+
+static uint8_t *
+alloc_buffer(unsigned int size)
+{
+    void *buf;
+
+    TEST_CHECK(posix_memalign(&buf, STRIDE_ALIGN, size) == 0);
+    return buf;
+}
+
+static void
+init_frame(frame_t *frame, unsigned int width, unsigned int height)
+{
+    unsigned int i;
+
+    frame->width        = width;
+    frame->height       = height;
+    frame->nv12_stride  = (width + STRIDE_ALIGN - 1) & -STRIDE_ALIGN;
+    frame->image_stride = (2 * width + STRIDE_ALIGN - 1) & -STRIDE_ALIGN;
+    frame->rgb_stride   = (4 * width + STRIDE_ALIGN - 1) & -STRIDE_ALIGN;
+
+    const unsigned int nv12_size = frame->nv12_stride * (height + height / 2);
+    frame->nv12     = alloc_buffer(nv12_size);
+    frame->nv12_out = alloc_buffer(nv12_size);
+    frame->image    = alloc_buffer(frame->image_stride * (height + height / 2));
+    frame->rgb      = alloc_buffer(frame->rgb_stride * height);
+
+    for (i = 0; i < nv12_size; i++)
+        frame->nv12[i] = (i * 2654435761U) >> 24;
+    for (i = 0; i < frame->rgb_stride * height; i++)
+        frame->rgb[i] = (i * 2246822519U) >> 24;
+}
+
+static void
+fini_frame(frame_t *frame)
+{
+    free(frame->nv12);
+    free(frame->nv12_out);
+    free(frame->image);
+    free(frame->rgb);
+}
+
+// Checks the NV12 frame went through the conversion and back unchanged
+static void
+check_round_trip(const frame_t *frame)
+{
+    unsigned int y;
+
+    for (y = 0; y < frame->height + frame->height / 2; y++)
+        TEST_CHECK(memcmp(&frame->nv12[y * frame->nv12_stride],
+                          &frame->nv12_out[y * frame->nv12_stride],
+                          frame->width) == 0);
+}
+
+// Runs KERNEL over NUM_FRAMES frames, returns the pixels per second
+static double
+run_kernel(
+    ImageCopyPool      *pool,
+    const kernel_t     *kernel,
+    frame_t            *frame,
+    unsigned int        num_frames
+)
+{
+    unsigned int i;
+
+    memset(frame->nv12_out, 0, frame->nv12_stride * (frame->height + frame->height / 2));
+
+    /* Warm up the caches and the copy engine */
+    kernel->run(pool, frame, kernel->convert);
+
+    const uint64_t start_time = test_get_ticks();
+    for (i = 0; i < num_frames; i++)
+        kernel->run(pool, frame, kernel->convert);
+    const uint64_t elapsed = test_get_ticks() - start_time;
+
+    if (kernel->run == run_copy || kernel->run == run_to_nv12)
+        check_round_trip(frame);
+    return (double)frame->width * frame->height * num_frames * 1e9 /
+        (elapsed ? elapsed : 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    ImageCopyPool *pool = NULL;
+    frame_t frames[ARRAY_ELEMS(frame_sizes)];
+    double rates[ARRAY_ELEMS(frame_sizes)];
+    char size_name[32];
+    unsigned int i, j;
+
+    const unsigned int megapixels  = test_get_arg(argc, argv, 1, MEGAPIXELS_DEFAULT);
+    const unsigned int num_threads = test_get_arg(argc, argv, 2, NUM_THREADS_DEFAULT);
+
+    if (num_threads > 1) {
+        pool = image_copy_pool_new(num_threads, 0);
+        TEST_CHECK(pool != NULL);
+    }
+
+    printf("%u megapixels per kernel and frame size, %u thread(s)\n",
+           megapixels, num_threads);
+    printf("%-12s", "Mpixels/s");
+    for (j = 0; j < ARRAY_ELEMS(frame_sizes); j++) {
+        init_frame(&frames[j], frame_sizes[j].width, frame_sizes[j].height);
+        snprintf(size_name, sizeof(size_name), "%ux%u",
+                 frame_sizes[j].width, frame_sizes[j].height);
+        printf(" %10s", size_name);
+    }
+    printf("\n");
+
+    for (i = 0; i < ARRAY_ELEMS(kernels); i++) {
+        for (j = 0; j < ARRAY_ELEMS(frame_sizes); j++) {
+            const unsigned int frame_size = frames[j].width * frames[j].height;
+            const unsigned int num_frames =
+                MAX(1, (uint64_t)megapixels * 1000000 / frame_size);
+            rates[j] = run_kernel(pool, &kernels[i], &frames[j], num_frames);
+        }
+        printf("%-12s", kernels[i].name);
+        for (j = 0; j < ARRAY_ELEMS(frame_sizes); j++)
+            printf(" %10.0f", rates[j] / 1e6);
+        printf("\n");
+    }
+
+    for (j = 0; j < ARRAY_ELEMS(frame_sizes); j++)
+        fini_frame(&frames[j]);
+    image_copy_pool_free(pool);
+    return 0;
+}
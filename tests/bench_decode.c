@@ -0,0 +1,420 @@
+/*
+ *  bench_decode.c - Decode path, vaBeginPicture() to vaEndPicture()
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+/*
+ * Usage: bench_decode [num_pictures] [num_slices] [slice_size]
+ *
+ * Replays a stream of intra pictures per codec, the way a player submits
+ * them: the buffers are created for each picture, then rendered between
+ * vaBeginPicture() and vaEndPicture(). The software VDPAU implementation
+ * does not decode, so this measures the driver alone. Allocations come
+ * from the context statistics, see VDPAU_VIDEO_STATS.
+ */
+
+#include "sysdeps.h"
+#include "test_common.h"
+#include "vdpau_video.h"
+
+#define NUM_PICTURES_DEFAULT    500
+#define NUM_SLICES_DEFAULT      16
+#define SLICE_SIZE_DEFAULT      512
+#define MAX_SLICES              68      /* 1088 / 16 */
+#define NUM_SURFACES            4
+#define PICTURE_WIDTH           1920
+#define PICTURE_HEIGHT          1088
+
+// A VA buffer to replay
+typedef struct {
+    VABufferType        type;
+    unsigned int        size;
+    unsigned int        num_elements;
+    const void         *data;
+} replay_buffer_t;
+
+// The buffers of a picture to replay
+typedef struct {
+    union {
+        VAPictureParameterBufferMPEG2   mpeg2;
+#if USE_VDPAU_MPEG4
+        VAPictureParameterBufferMPEG4   mpeg4;
+#endif
+        VAPictureParameterBufferH264    h264;
+        VAPictureParameterBufferVC1     vc1;
+    }                   pic_param;
+    union {
+        VAIQMatrixBufferMPEG2           mpeg2;
+#if USE_VDPAU_MPEG4
+        VAIQMatrixBufferMPEG4           mpeg4;
+#endif
+        VAIQMatrixBufferH264            h264;
+    }                   iq_matrix;
+    union {
+        VASliceParameterBufferMPEG2     mpeg2[MAX_SLICES];
+#if USE_VDPAU_MPEG4
+        VASliceParameterBufferMPEG4     mpeg4[MAX_SLICES];
+#endif
+        VASliceParameterBufferH264      h264[MAX_SLICES];
+        VASliceParameterBufferVC1       vc1[MAX_SLICES];
+    }                   slice_params;
+    uint8_t            *slice_data;
+    replay_buffer_t     buffers[4];
+    unsigned int        num_buffers;
+} replay_picture_t;
+
+typedef struct {
+    const char         *name;
+    VAProfile           profile;
+    void              (*init)(replay_picture_t *picture,
+                              unsigned int num_slices, unsigned int slice_size);
+} replay_codec_t;
+
+static void
+add_buffer(
+    replay_picture_t   *picture,
+    VABufferType        type,
+    unsigned int        size,
+    unsigned int        num_elements,
+    const void         *data
+)
+{
+    replay_buffer_t * const buffer = &picture->buffers[picture->num_buffers++];
+
+    TEST_CHECK(picture->num_buffers <= ARRAY_ELEMS(picture->buffers));
+    buffer->type         = type;
+    buffer->size         = size;
+    buffer->num_elements = num_elements;
+    buffer->data         = data;
+}
+
+// Adds the slice parameters and the slice data, SLICE_SIZE bytes each
+#define add_slices(picture, codec, num_slices, slice_size) do {         \
+        add_buffer(picture, VASliceParameterBufferType,                 \
+                   sizeof((picture)->slice_params.codec[0]),            \
+                   num_slices, (picture)->slice_params.codec);          \
+        add_buffer(picture, VASliceDataBufferType,                      \
+                   (num_slices) * (slice_size), 1,                      \
+                   (picture)->slice_data);                              \
+    } while (0)
+
+// Fills the slice data, with no start code emulation in it
+static void
+init_slice_data(uint8_t *buf, unsigned int slice, unsigned int slice_size)
+{
+    memset(buf, 0x5a + slice, slice_size);
+}
+
+// MPEG-2: slices without a start code, the driver generates it
+static void
+init_mpeg2_picture(
+    replay_picture_t   *picture,
+    unsigned int        num_slices,
+    unsigned int        slice_size
+)
+{
+    VAPictureParameterBufferMPEG2 * const pic_param = &picture->pic_param.mpeg2;
+    VAIQMatrixBufferMPEG2 * const iq_matrix = &picture->iq_matrix.mpeg2;
+    unsigned int i;
+
+    pic_param->horizontal_size            = PICTURE_WIDTH;
+    pic_param->vertical_size              = PICTURE_HEIGHT;
+    pic_param->forward_reference_picture  = VA_INVALID_SURFACE;
+    pic_param->backward_reference_picture = VA_INVALID_SURFACE;
+    pic_param->picture_coding_type        = 1; /* I picture */
+    pic_param->f_code                     = 0xffff;
+    pic_param->picture_coding_extension.bits.picture_structure    = 3;
+    pic_param->picture_coding_extension.bits.frame_pred_frame_dct = 1;
+    pic_param->picture_coding_extension.bits.progressive_frame    = 1;
+    add_buffer(picture, VAPictureParameterBufferType,
+               sizeof(*pic_param), 1, pic_param);
+
+    iq_matrix->load_intra_quantiser_matrix     = 1;
+    iq_matrix->load_non_intra_quantiser_matrix = 1;
+    for (i = 0; i < 64; i++) {
+        iq_matrix->intra_quantiser_matrix[i]     = 8 + i / 4;
+        iq_matrix->non_intra_quantiser_matrix[i] = 16;
+    }
+    add_buffer(picture, VAIQMatrixBufferType,
+               sizeof(*iq_matrix), 1, iq_matrix);
+
+    for (i = 0; i < num_slices; i++) {
+        VASliceParameterBufferMPEG2 * const slice_param =
+            &picture->slice_params.mpeg2[i];
+        slice_param->slice_data_size         = slice_size;
+        slice_param->slice_data_offset       = i * slice_size;
+        slice_param->slice_vertical_position = i;
+        slice_param->quantiser_scale_code    = 8;
+        init_slice_data(&picture->slice_data[i * slice_size], i, slice_size);
+    }
+    add_slices(picture, mpeg2, num_slices, slice_size);
+}
+
+#if USE_VDPAU_MPEG4
+// MPEG-4: an I-VOP, the driver reconstructs the VOP header
+static void
+init_mpeg4_picture(
+    replay_picture_t   *picture,
+    unsigned int        num_slices,
+    unsigned int        slice_size
+)
+{
+    VAPictureParameterBufferMPEG4 * const pic_param = &picture->pic_param.mpeg4;
+    VAIQMatrixBufferMPEG4 * const iq_matrix = &picture->iq_matrix.mpeg4;
+    unsigned int i;
+
+    pic_param->vop_width                     = PICTURE_WIDTH;
+    pic_param->vop_height                    = PICTURE_HEIGHT;
+    pic_param->forward_reference_picture     = VA_INVALID_SURFACE;
+    pic_param->backward_reference_picture    = VA_INVALID_SURFACE;
+    pic_param->vol_fields.bits.chroma_format = 1;
+    pic_param->vop_time_increment_resolution = 30;
+    add_buffer(picture, VAPictureParameterBufferType,
+               sizeof(*pic_param), 1, pic_param);
+
+    add_buffer(picture, VAIQMatrixBufferType,
+               sizeof(*iq_matrix), 1, iq_matrix);
+
+    /* The VOP header of an I-VOP at 30 Hz ends 51 bits into the data */
+    for (i = 0; i < num_slices; i++) {
+        VASliceParameterBufferMPEG4 * const slice_param =
+            &picture->slice_params.mpeg4[i];
+        slice_param->slice_data_size    = slice_size;
+        slice_param->slice_data_offset  = i * slice_size;
+        slice_param->macroblock_offset  = 3;
+        slice_param->macroblock_number  = i * (PICTURE_WIDTH / 16);
+        slice_param->quant_scale        = 8;
+        init_slice_data(&picture->slice_data[i * slice_size], i, slice_size);
+    }
+    add_slices(picture, mpeg4, num_slices, slice_size);
+}
+#endif
+
+// H.264: IDR slices, each with its Annex-B start code
+static void
+init_h264_picture(
+    replay_picture_t   *picture,
+    unsigned int        num_slices,
+    unsigned int        slice_size
+)
+{
+    VAPictureParameterBufferH264 * const pic_param = &picture->pic_param.h264;
+    VAIQMatrixBufferH264 * const iq_matrix = &picture->iq_matrix.h264;
+    unsigned int i;
+
+    pic_param->CurrPic.picture_id              = VA_INVALID_SURFACE;
+    for (i = 0; i < ARRAY_ELEMS(pic_param->ReferenceFrames); i++) {
+        pic_param->ReferenceFrames[i].picture_id = VA_INVALID_SURFACE;
+        pic_param->ReferenceFrames[i].flags      = VA_PICTURE_H264_INVALID;
+    }
+    pic_param->picture_width_in_mbs_minus1     = PICTURE_WIDTH / 16 - 1;
+    pic_param->picture_height_in_mbs_minus1    = PICTURE_HEIGHT / 16 - 1;
+    pic_param->num_ref_frames                  = 1;
+    pic_param->seq_fields.bits.chroma_format_idc   = 1;
+    pic_param->seq_fields.bits.frame_mbs_only_flag = 1;
+    pic_param->pic_fields.bits.reference_pic_flag  = 1;
+    add_buffer(picture, VAPictureParameterBufferType,
+               sizeof(*pic_param), 1, pic_param);
+
+    memset(iq_matrix, 16, sizeof(*iq_matrix));
+    add_buffer(picture, VAIQMatrixBufferType,
+               sizeof(*iq_matrix), 1, iq_matrix);
+
+    for (i = 0; i < num_slices; i++) {
+        VASliceParameterBufferH264 * const slice_param =
+            &picture->slice_params.h264[i];
+        uint8_t * const buf = &picture->slice_data[i * slice_size];
+        slice_param->slice_data_size   = slice_size;
+        slice_param->slice_data_offset = i * slice_size;
+        slice_param->first_mb_in_slice = i * (PICTURE_WIDTH / 16);
+        slice_param->slice_type        = 2; /* I slice */
+        init_slice_data(buf, i, slice_size);
+        buf[0] = 0x00; buf[1] = 0x00; buf[2] = 0x01;
+        buf[3] = 0x65; /* IDR picture */
+    }
+    add_slices(picture, h264, num_slices, slice_size);
+}
+
+// VC-1: raw slice data, without bitplanes
+static void
+init_vc1_picture(
+    replay_picture_t   *picture,
+    unsigned int        num_slices,
+    unsigned int        slice_size
+)
+{
+    VAPictureParameterBufferVC1 * const pic_param = &picture->pic_param.vc1;
+    unsigned int i;
+
+    pic_param->forward_reference_picture  = VA_INVALID_SURFACE;
+    pic_param->backward_reference_picture = VA_INVALID_SURFACE;
+    pic_param->inloop_decoded_picture     = VA_INVALID_SURFACE;
+    pic_param->coded_width                = PICTURE_WIDTH;
+    pic_param->coded_height               = PICTURE_HEIGHT;
+    pic_param->sequence_fields.bits.profile = 1; /* Main */
+    pic_param->picture_fields.bits.picture_type = 0; /* I picture */
+    pic_param->pic_quantizer_fields.bits.pic_quantizer_scale = 8;
+    add_buffer(picture, VAPictureParameterBufferType,
+               sizeof(*pic_param), 1, pic_param);
+
+    for (i = 0; i < num_slices; i++) {
+        VASliceParameterBufferVC1 * const slice_param =
+            &picture->slice_params.vc1[i];
+        slice_param->slice_data_size         = slice_size;
+        slice_param->slice_data_offset       = i * slice_size;
+        slice_param->slice_vertical_position = i;
+        init_slice_data(&picture->slice_data[i * slice_size], i, slice_size);
+    }
+    add_slices(picture, vc1, num_slices, slice_size);
+}
+
+static const replay_codec_t replay_codecs[] = {
+    { "MPEG-2", VAProfileMPEG2Main,             init_mpeg2_picture },
+#if USE_VDPAU_MPEG4
+    { "MPEG-4", VAProfileMPEG4AdvancedSimple,   init_mpeg4_picture },
+#endif
+    { "H.264",  VAProfileH264High,              init_h264_picture  },
+    { "VC-1",   VAProfileVC1Main,               init_vc1_picture   },
+};
+
+// Submits the buffers of PICTURE, then decodes them to SURFACE
+static void
+replay_picture(
+    test_display_t             *display,
+    VAContextID                 context,
+    VASurfaceID                 surface,
+    const replay_picture_t     *picture
+)
+{
+    VABufferID buffers[ARRAY_ELEMS(picture->buffers)];
+    unsigned int i;
+
+    for (i = 0; i < picture->num_buffers; i++) {
+        const replay_buffer_t * const buffer = &picture->buffers[i];
+        TEST_CHECK_STATUS(VA_CALL(display, vaCreateBuffer, context,
+                                  buffer->type, buffer->size,
+                                  buffer->num_elements, (void *)buffer->data,
+                                  &buffers[i]));
+    }
+    TEST_CHECK_STATUS(VA_CALL(display, vaBeginPicture, context, surface));
+    TEST_CHECK_STATUS(VA_CALL(display, vaRenderPicture, context,
+                              buffers, picture->num_buffers));
+    TEST_CHECK_STATUS(VA_CALL(display, vaEndPicture, context));
+
+    /* The driver takes ownership of the buffers it rendered */
+    for (i = 0; i < picture->num_buffers; i++)
+        TEST_CHECK(buffers[i] == VA_INVALID_BUFFER);
+}
+
+// Replays NUM_PICTURES pictures of CODEC and reports the decode rates.
+// Returns FALSE if the codec is not supported
+static int
+run_codec(
+    test_display_t             *display,
+    const replay_codec_t       *codec,
+    unsigned int                num_pictures,
+    unsigned int                num_slices,
+    unsigned int                slice_size
+)
+{
+    vdpau_driver_data_t * const driver_data = display->context.pDriverData;
+    VASurfaceID surfaces[NUM_SURFACES];
+    VAConfigID config;
+    VAContextID context;
+    replay_picture_t picture;
+    unsigned int i;
+
+    if (VA_CALL(display, vaCreateConfig, codec->profile, VAEntrypointVLD,
+                NULL, 0, &config) != VA_STATUS_SUCCESS) {
+        printf("%-8s unsupported\n", codec->name);
+        return 0;
+    }
+    TEST_CHECK_STATUS(VA_CALL(display, vaCreateSurfaces,
+                              PICTURE_WIDTH, PICTURE_HEIGHT, VA_RT_FORMAT_YUV420,
+                              NUM_SURFACES, surfaces));
+    TEST_CHECK_STATUS(VA_CALL(display, vaCreateContext, config,
+                              PICTURE_WIDTH, PICTURE_HEIGHT, VA_PROGRESSIVE,
+                              surfaces, NUM_SURFACES, &context));
+
+    memset(&picture, 0, sizeof(picture));
+    picture.slice_data = malloc(num_slices * slice_size);
+    TEST_CHECK(picture.slice_data != NULL);
+    codec->init(&picture, num_slices, slice_size);
+
+    /* The first pictures warm up the buffer pool and the slice chunks */
+    for (i = 0; i < NUM_SURFACES; i++)
+        replay_picture(display, context, surfaces[i], &picture);
+    TEST_CHECK_STATUS(VA_CALL(display, vaSyncSurface, surfaces[0]));
+
+    object_context_p const obj_context = VDPAU_CONTEXT(context);
+    TEST_CHECK(obj_context != NULL);
+    const vdpau_decode_stats_t stats = obj_context->decode_stats;
+
+    const uint64_t start_time = test_get_ticks();
+    for (i = 0; i < num_pictures; i++)
+        replay_picture(display, context, surfaces[i % NUM_SURFACES], &picture);
+    TEST_CHECK_STATUS(VA_CALL(display, vaSyncSurface,
+                              surfaces[(num_pictures - 1) % NUM_SURFACES]));
+    const uint64_t elapsed = test_get_ticks() - start_time;
+
+    /* Every slice reached the decoder */
+    const vdpau_decode_stats_t * const end_stats = &obj_context->decode_stats;
+    const uint64_t num_decoded = end_stats->num_pictures - stats.num_pictures;
+    TEST_CHECK(num_decoded == num_pictures);
+    TEST_CHECK(end_stats->num_slices - stats.num_slices ==
+               (uint64_t)num_pictures * num_slices);
+
+    printf("%-8s %8.0f pictures/s, %6.0f ns/slice, %5.2f allocations/picture\n",
+           codec->name,
+           (double)num_pictures * 1e9 / (elapsed ? elapsed : 1),
+           (double)elapsed / ((uint64_t)num_pictures * num_slices),
+           (double)(end_stats->num_allocations - stats.num_allocations) /
+           num_pictures);
+
+    free(picture.slice_data);
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyContext, context));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroySurfaces, surfaces, NUM_SURFACES));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyConfig, config));
+    return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_display_t display;
+    unsigned int i, num_codecs = 0;
+
+    const unsigned int num_pictures = test_get_arg(argc, argv, 1, NUM_PICTURES_DEFAULT);
+    const unsigned int num_slices   = MIN(test_get_arg(argc, argv, 2, NUM_SLICES_DEFAULT),
+                                          MAX_SLICES);
+    const unsigned int slice_size   = MAX(test_get_arg(argc, argv, 3, SLICE_SIZE_DEFAULT),
+                                          8);
+
+    /* Allocations are only counted with the statistics enabled */
+    setenv("VDPAU_VIDEO_STATS", "yes", 1);
+    test_display_init(&display);
+
+    printf("%u pictures of %u slices, %u bytes each\n",
+           num_pictures, num_slices, slice_size);
+    for (i = 0; i < ARRAY_ELEMS(replay_codecs); i++)
+        num_codecs += run_codec(&display, &replay_codecs[i],
+                                num_pictures, num_slices, slice_size);
+
+    test_display_fini(&display);
+    return num_codecs > 0 ? 0 : TEST_SKIP;
+}
@@ -0,0 +1,171 @@
+/*
+ *  bench_heap.c - Object heap allocation, lookup and iteration
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+/*
+ * Usage: bench_heap [num_objects] [num_iterations]
+ *
+ * Allocates NUM_OBJECTS objects, looks them up in random order, iterates
+ * over them, then frees every other one and iterates over the survivors,
+ * which must only cost the live objects. Stale IDs must not resolve.
+ */
+
+#include "sysdeps.h"
+#include "test_common.h"
+#include "object_heap.h"
+
+#define NUM_OBJECTS_DEFAULT     10000
+#define NUM_ITERATIONS_DEFAULT  10
+#define HEAP_ID_OFFSET          0x02000000
+
+typedef struct {
+    struct object_base  base;
+    unsigned int        value;
+} test_object_t;
+
+// Time spent in each operation, in nanoseconds
+typedef struct {
+    uint64_t            alloc_time;
+    uint64_t            lookup_time;
+    uint64_t            iterate_time;
+    uint64_t            iterate_sparse_time;
+    uint64_t            free_time;
+} heap_times_t;
+
+// Iterates over the heap, returns the number of objects visited
+static unsigned int
+iterate_objects(object_heap_p heap)
+{
+    object_heap_iterator iter;
+    object_base_p obj;
+    unsigned int n = 0;
+
+    for (obj = object_heap_first(heap, &iter); obj;
+         obj = object_heap_next(heap, &iter)) {
+        TEST_CHECK(((test_object_t *)obj)->value == (unsigned int)obj->id);
+        n++;
+    }
+    return n;
+}
+
+static void
+run_iteration(
+    object_heap_p       heap,
+    int                *ids,
+    unsigned int       *order,
+    unsigned int        num_objects,
+    heap_times_t       *times
+)
+{
+    uint64_t start_time;
+    unsigned int i;
+
+    start_time = test_get_ticks();
+    for (i = 0; i < num_objects; i++) {
+        ids[i] = object_heap_allocate(heap);
+        TEST_CHECK(ids[i] != -1);
+    }
+    times->alloc_time += test_get_ticks() - start_time;
+
+    for (i = 0; i < num_objects; i++) {
+        test_object_t * const obj =
+            (test_object_t *)object_heap_lookup(heap, ids[i]);
+        TEST_CHECK(obj != NULL);
+        obj->value = ids[i];
+    }
+
+    start_time = test_get_ticks();
+    for (i = 0; i < num_objects; i++)
+        TEST_CHECK(object_heap_lookup(heap, ids[order[i]]) != NULL);
+    times->lookup_time += test_get_ticks() - start_time;
+
+    start_time = test_get_ticks();
+    TEST_CHECK(iterate_objects(heap) == num_objects);
+    times->iterate_time += test_get_ticks() - start_time;
+
+    /* Half of the slots are free now, iteration skips them */
+    start_time = test_get_ticks();
+    for (i = 0; i < num_objects; i += 2)
+        object_heap_free(heap, object_heap_lookup(heap, ids[i]));
+    times->free_time += test_get_ticks() - start_time;
+
+    start_time = test_get_ticks();
+    TEST_CHECK(iterate_objects(heap) == num_objects / 2);
+    times->iterate_sparse_time += test_get_ticks() - start_time;
+
+    start_time = test_get_ticks();
+    for (i = 1; i < num_objects; i += 2)
+        object_heap_free(heap, object_heap_lookup(heap, ids[i]));
+    times->free_time += test_get_ticks() - start_time;
+
+    /* Freed IDs are stale, even once their slots are reused */
+    TEST_CHECK(iterate_objects(heap) == 0);
+    const int id = object_heap_allocate(heap);
+    TEST_CHECK(id != -1);
+    for (i = 0; i < num_objects; i++)
+        TEST_CHECK(object_heap_lookup(heap, ids[i]) == NULL);
+    object_heap_free(heap, object_heap_lookup(heap, id));
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct object_heap heap;
+    heap_times_t times;
+    unsigned int i;
+
+    const unsigned int num_objects    = MIN(test_get_arg(argc, argv, 1, NUM_OBJECTS_DEFAULT),
+                                            OBJECT_HEAP_INDEX_MASK);
+    const unsigned int num_iterations = test_get_arg(argc, argv, 2, NUM_ITERATIONS_DEFAULT);
+
+    int * const ids = malloc(num_objects * sizeof(*ids));
+    unsigned int * const order = malloc(num_objects * sizeof(*order));
+    TEST_CHECK(ids != NULL && order != NULL);
+
+    /* Random lookup order, a Fisher-Yates shuffle with a fixed seed */
+    for (i = 0; i < num_objects; i++)
+        order[i] = i;
+    uint32_t seed = 12345;
+    for (i = num_objects - 1; i > 0; i--) {
+        seed = seed * 1103515245 + 12345;
+        const unsigned int j = (seed >> 8) % (i + 1);
+        const unsigned int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    memset(&times, 0, sizeof(times));
+    TEST_CHECK(object_heap_init(&heap, sizeof(test_object_t), HEAP_ID_OFFSET) == 0);
+    for (i = 0; i < num_iterations; i++)
+        run_iteration(&heap, ids, order, num_objects, &times);
+    object_heap_destroy(&heap);
+
+    const double n = (double)num_objects * num_iterations;
+    printf("%u objects, %u iterations\n", num_objects, num_iterations);
+    printf("alloc:   %6.1f ns/object\n", times.alloc_time / n);
+    printf("lookup:  %6.1f ns/object\n", times.lookup_time / n);
+    printf("free:    %6.1f ns/object\n", times.free_time / n);
+    printf("iterate: %6.1f ns/object, all live\n", times.iterate_time / n);
+    printf("iterate: %6.1f ns/object, half live\n",
+           times.iterate_sparse_time / (n / 2));
+
+    free(ids);
+    free(order);
+    return 0;
+}
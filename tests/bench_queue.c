@@ -0,0 +1,299 @@
+/*
+ *  bench_queue.c - Asynchronous queue throughput and latency
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+/*
+ * Usage: bench_queue [num_producers] [num_items] [num_round_trips]
+ *
+ * 1) Throughput: producers push NUM_ITEMS items each to one consumer,
+ *    which pops them one at a time, then in batches. Each producer's
+ *    items must come out in order, and none may be lost.
+ * 2) Latency: an item goes to an echo thread and back through a pair of
+ *    queues, so that a pop has to wake up a sleeping thread.
+ *
+ * The UAsyncQueue ring is compared to a UQueue list under a mutex and a
+ * condition variable, the way the asynchronous queue used to work.
+ */
+
+#include "sysdeps.h"
+#include "test_common.h"
+#include "uasyncqueue.h"
+#include "uqueue.h"
+#include <pthread.h>
+
+#define NUM_PRODUCERS_DEFAULT   4
+#define NUM_ITEMS_DEFAULT       100000
+#define NUM_ROUND_TRIPS_DEFAULT 10000
+#define MAX_PRODUCERS           64
+#define POP_BATCH_SIZE          32
+
+// Queue implementation under test
+typedef struct {
+    const char         *name;
+    void             *(*create)(void);
+    void              (*destroy)(void *queue);
+    void              (*push)(void *queue, void *data);
+    unsigned int      (*pop_many)(void *queue, void **data, unsigned int count);
+} queue_ops_t;
+
+static void *
+ring_create(void)
+{
+    return async_queue_new();
+}
+
+static void
+ring_destroy(void *queue)
+{
+    async_queue_free(queue);
+}
+
+static void
+ring_push(void *queue, void *data)
+{
+    TEST_CHECK(async_queue_push(queue, data) != NULL);
+}
+
+static unsigned int
+ring_pop_many(void *queue, void **data, unsigned int count)
+{
+    return async_queue_pop_many(queue, data, count);
+}
+
+// UQueue under a lock, unbounded
+typedef struct {
+    UQueue             *queue;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+} locked_queue_t;
+
+static void *
+locked_create(void)
+{
+    locked_queue_t * const queue = calloc(1, sizeof(*queue));
+
+    TEST_CHECK(queue != NULL);
+    queue->queue = queue_new();
+    TEST_CHECK(queue->queue != NULL);
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    return queue;
+}
+
+static void
+locked_destroy(void *arg)
+{
+    locked_queue_t * const queue = arg;
+
+    queue_free(queue->queue);
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue);
+}
+
+static void
+locked_push(void *arg, void *data)
+{
+    locked_queue_t * const queue = arg;
+
+    pthread_mutex_lock(&queue->mutex);
+    TEST_CHECK(queue_push(queue->queue, data) != NULL);
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static unsigned int
+locked_pop_many(void *arg, void **data, unsigned int count)
+{
+    locked_queue_t * const queue = arg;
+    unsigned int n = 0;
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue_is_empty(queue->queue))
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    while (n < count && !queue_is_empty(queue->queue))
+        data[n++] = queue_pop(queue->queue);
+    pthread_mutex_unlock(&queue->mutex);
+    return n;
+}
+
+static const queue_ops_t queue_ops[] = {
+    { "ring",   ring_create,   ring_destroy,   ring_push,   ring_pop_many   },
+    { "locked", locked_create, locked_destroy, locked_push, locked_pop_many },
+};
+
+// Items are never NULL, and tell their producer and sequence number
+#define ITEM(producer, seq) \
+    ((void *)(uintptr_t)((uintptr_t)(seq) * MAX_PRODUCERS + (producer) + 1))
+#define ITEM_PRODUCER(item) (((uintptr_t)(item) - 1) % MAX_PRODUCERS)
+#define ITEM_SEQ(item)      (((uintptr_t)(item) - 1) / MAX_PRODUCERS)
+
+typedef struct {
+    const queue_ops_t  *ops;
+    void               *queue;
+    void               *reply_queue;
+    pthread_t           thread;
+    unsigned int        id;
+    unsigned int        num_items;
+} queue_thread_t;
+
+static void *
+producer_thread(void *arg)
+{
+    queue_thread_t * const t = arg;
+    unsigned int i;
+
+    for (i = 0; i < t->num_items; i++)
+        t->ops->push(t->queue, ITEM(t->id, i));
+    return NULL;
+}
+
+// Pushes NUM_ITEMS items from each of NUM_PRODUCERS threads, pops them
+// BATCH_SIZE at most at a time. Returns the items per second
+static double
+run_throughput(
+    const queue_ops_t  *ops,
+    unsigned int        num_producers,
+    unsigned int        num_items,
+    unsigned int        batch_size
+)
+{
+    queue_thread_t producers[num_producers];
+    unsigned int next_seq[num_producers];
+    void *items[POP_BATCH_SIZE];
+    unsigned int i, n;
+    uint64_t num_popped = 0;
+
+    void * const queue = ops->create();
+    memset(next_seq, 0, sizeof(next_seq));
+
+    const uint64_t start_time = test_get_ticks();
+    for (i = 0; i < num_producers; i++) {
+        producers[i].ops       = ops;
+        producers[i].queue     = queue;
+        producers[i].id        = i;
+        producers[i].num_items = num_items;
+        TEST_CHECK(pthread_create(&producers[i].thread, NULL,
+                                  producer_thread, &producers[i]) == 0);
+    }
+
+    const uint64_t num_total = (uint64_t)num_producers * num_items;
+    while (num_popped < num_total) {
+        n = ops->pop_many(queue, items, batch_size);
+        TEST_CHECK(n > 0 && n <= batch_size);
+        for (i = 0; i < n; i++) {
+            const unsigned int producer = ITEM_PRODUCER(items[i]);
+            TEST_CHECK(producer < num_producers);
+            TEST_CHECK(ITEM_SEQ(items[i]) == next_seq[producer]);
+            next_seq[producer]++;
+        }
+        num_popped += n;
+    }
+    const uint64_t elapsed = test_get_ticks() - start_time;
+
+    for (i = 0; i < num_producers; i++)
+        pthread_join(producers[i].thread, NULL);
+    ops->destroy(queue);
+    return (double)num_total * 1e9 / (elapsed ? elapsed : 1);
+}
+
+static void *
+echo_thread(void *arg)
+{
+    queue_thread_t * const t = arg;
+    void *item;
+    unsigned int i;
+
+    for (i = 0; i < t->num_items; i++) {
+        TEST_CHECK(t->ops->pop_many(t->queue, &item, 1) == 1);
+        t->ops->push(t->reply_queue, item);
+    }
+    return NULL;
+}
+
+static int
+compare_ticks(const void *a, const void *b)
+{
+    const uint64_t ta = *(const uint64_t *)a;
+    const uint64_t tb = *(const uint64_t *)b;
+
+    return ta < tb ? -1 : ta > tb;
+}
+
+// Sends NUM_ROUND_TRIPS items to an echo thread and back, one at a time.
+// Reports the median and 99th percentile of the one-way latency
+static void
+run_latency(const queue_ops_t *ops, unsigned int num_round_trips)
+{
+    queue_thread_t echo;
+    void *item;
+    unsigned int i;
+
+    uint64_t * const samples = malloc(num_round_trips * sizeof(*samples));
+    TEST_CHECK(samples != NULL);
+
+    echo.ops         = ops;
+    echo.queue       = ops->create();
+    echo.reply_queue = ops->create();
+    echo.num_items   = num_round_trips;
+    TEST_CHECK(pthread_create(&echo.thread, NULL, echo_thread, &echo) == 0);
+
+    for (i = 0; i < num_round_trips; i++) {
+        const uint64_t start_time = test_get_ticks();
+        ops->push(echo.queue, ITEM(0, i));
+        TEST_CHECK(ops->pop_many(echo.reply_queue, &item, 1) == 1);
+        samples[i] = (test_get_ticks() - start_time) / 2;
+        TEST_CHECK(item == ITEM(0, i));
+    }
+    pthread_join(echo.thread, NULL);
+    ops->destroy(echo.queue);
+    ops->destroy(echo.reply_queue);
+
+    qsort(samples, num_round_trips, sizeof(*samples), compare_ticks);
+    printf("%-6s latency: %7.0f ns median, %7.0f ns 99th percentile\n",
+           ops->name, (double)samples[num_round_trips / 2],
+           (double)samples[num_round_trips * 99 / 100]);
+    free(samples);
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned int i;
+
+    const unsigned int num_producers   = MIN(test_get_arg(argc, argv, 1, NUM_PRODUCERS_DEFAULT),
+                                             MAX_PRODUCERS);
+    const unsigned int num_items       = test_get_arg(argc, argv, 2, NUM_ITEMS_DEFAULT);
+    const unsigned int num_round_trips = test_get_arg(argc, argv, 3, NUM_ROUND_TRIPS_DEFAULT);
+
+    printf("%u items per producer, %u round trips\n", num_items, num_round_trips);
+    for (i = 0; i < ARRAY_ELEMS(queue_ops); i++) {
+        const queue_ops_t * const ops = &queue_ops[i];
+        printf("%-6s 1 producer:  %6.2f Mitems/s, %6.2f Mitems/s batched\n",
+               ops->name,
+               run_throughput(ops, 1, num_items, 1) / 1e6,
+               run_throughput(ops, 1, num_items, POP_BATCH_SIZE) / 1e6);
+        printf("%-6s %u producers: %6.2f Mitems/s, %6.2f Mitems/s batched\n",
+               ops->name, num_producers,
+               run_throughput(ops, num_producers, num_items, 1) / 1e6,
+               run_throughput(ops, num_producers, num_items, POP_BATCH_SIZE) / 1e6);
+        run_latency(ops, num_round_trips);
+    }
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ *  bench_translate.c - VA buffer translate function lookup
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+/*
+ * Usage: bench_translate [num_pictures] [num_slices]
+ *
+ * Dispatches the buffers of a picture of NUM_SLICES slices to their
+ * translate function, once through a scan of the codec and buffer type
+ * table, the way translate_buffer() used to work, then through the
+ * per-context array that vaCreateContext() resolves. The translate
+ * functions do nothing here, so that only the lookup is measured. Both
+ * lookups must agree on which buffer types each codec supports.
+ */
+
+#include "sysdeps.h"
+#include "test_common.h"
+#include "vdpau_video.h"
+#include "vdpau_buffer.h"
+
+#define NUM_PICTURES_DEFAULT    20000
+#define NUM_SLICES_DEFAULT      70
+#define MAX_BUFFERS             (3 + 2 * 256)
+
+static unsigned int g_num_translated;
+
+static int __attribute__((noinline))
+translate_dummy(
+    vdpau_driver_data_t *driver_data,
+    object_context_p     obj_context,
+    object_buffer_p      obj_buffer
+)
+{
+    g_num_translated++;
+    return 1;
+}
+
+typedef struct {
+    VdpCodec                    codec;
+    VABufferType                type;
+    translate_buffer_func_t     func;
+} translate_buffer_info_t;
+
+// The table scanned for every buffer before the per-context array, with
+// the same entries in the same order, see init_translate_buffer_funcs()
+static const translate_buffer_info_t translate_info[] = {
+#define _(CODEC, TYPE) \
+    { VDP_CODEC_##CODEC, VA##TYPE##BufferType, translate_dummy }
+    _(MPEG2, PictureParameter),
+    _(MPEG2, IQMatrix),
+    _(MPEG2, SliceParameter),
+#if USE_VDPAU_MPEG4
+    _(MPEG4, PictureParameter),
+    _(MPEG4, IQMatrix),
+    _(MPEG4, SliceParameter),
+#endif
+    _(H264, PictureParameter),
+    _(H264, IQMatrix),
+    _(H264, SliceParameter),
+    _(VC1, PictureParameter),
+    _(VC1, SliceParameter),
+#undef _
+    { VDP_CODEC_VC1, VABitPlaneBufferType, translate_dummy },
+    { 0, VASliceDataBufferType, translate_dummy },
+    { 0, 0, NULL }
+};
+
+static int
+translate_buffer_scan(object_context_p obj_context, object_buffer_p obj_buffer)
+{
+    const translate_buffer_info_t *tbip;
+
+    for (tbip = translate_info; tbip->func != NULL; tbip++) {
+        if (tbip->codec && tbip->codec != obj_context->vdp_codec)
+            continue;
+        if (tbip->type != obj_buffer->type)
+            continue;
+        return tbip->func(NULL, obj_context, obj_buffer);
+    }
+    return 0;
+}
+
+static int
+translate_buffer_lookup(object_context_p obj_context, object_buffer_p obj_buffer)
+{
+    if (!is_supported_buffer_type(obj_context, obj_buffer->type))
+        return 0;
+    return translate_dummy(NULL, obj_context, obj_buffer);
+}
+
+static const struct {
+    const char         *name;
+    VdpCodec            codec;
+    VABufferType        extra_type; /* after the picture parameters */
+} codecs[] = {
+    { "MPEG-2", VDP_CODEC_MPEG2, VAIQMatrixBufferType   },
+#if USE_VDPAU_MPEG4
+    { "MPEG-4", VDP_CODEC_MPEG4, VAIQMatrixBufferType   },
+#endif
+    { "H.264",  VDP_CODEC_H264,  VAIQMatrixBufferType   },
+    { "VC-1",   VDP_CODEC_VC1,   VABitPlaneBufferType   },
+};
+
+// Dispatches NUM_PICTURES times the buffers, returns the time in ns
+static uint64_t
+run_picture(
+    object_context_p    obj_context,
+    object_buffer_p     buffers,
+    unsigned int        num_buffers,
+    unsigned int        num_pictures,
+    int               (*translate)(object_context_p, object_buffer_p)
+)
+{
+    unsigned int i, j;
+
+    g_num_translated = 0;
+    const uint64_t start_time = test_get_ticks();
+    for (i = 0; i < num_pictures; i++) {
+        for (j = 0; j < num_buffers; j++)
+            TEST_CHECK(translate(obj_context, &buffers[j]));
+    }
+    const uint64_t elapsed = test_get_ticks() - start_time;
+
+    TEST_CHECK(g_num_translated == num_pictures * num_buffers);
+    return elapsed;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct object_context context;
+    struct object_buffer buffers[MAX_BUFFERS];
+    struct object_buffer buffer;
+    unsigned int i, j, num_buffers;
+
+    const unsigned int num_pictures = test_get_arg(argc, argv, 1, NUM_PICTURES_DEFAULT);
+    const unsigned int num_slices   = MIN(test_get_arg(argc, argv, 2, NUM_SLICES_DEFAULT),
+                                          (MAX_BUFFERS - 2) / 2);
+
+    printf("%u pictures of %u slices\n", num_pictures, num_slices);
+    memset(&buffer, 0, sizeof(buffer));
+    memset(buffers, 0, sizeof(buffers));
+    for (i = 0; i < ARRAY_ELEMS(codecs); i++) {
+        memset(&context, 0, sizeof(context));
+        context.vdp_codec = codecs[i].codec;
+        init_translate_buffer_funcs(&context);
+
+        /* Both lookups support the same buffer types */
+        for (j = 0; j < VDPAU_MAX_TRANSLATE_BUFFER_TYPES; j++) {
+            buffer.type = j;
+            TEST_CHECK(translate_buffer_scan(&context, &buffer) ==
+                       is_supported_buffer_type(&context, j));
+        }
+
+        /* A picture as players submit it */
+        num_buffers = 0;
+        buffers[num_buffers++].type = VAPictureParameterBufferType;
+        buffers[num_buffers++].type = codecs[i].extra_type;
+        for (j = 0; j < num_slices; j++) {
+            buffers[num_buffers++].type = VASliceParameterBufferType;
+            buffers[num_buffers++].type = VASliceDataBufferType;
+        }
+
+        const uint64_t scan_time = run_picture(&context, buffers, num_buffers,
+                                               num_pictures, translate_buffer_scan);
+        const uint64_t lookup_time = run_picture(&context, buffers, num_buffers,
+                                                 num_pictures, translate_buffer_lookup);
+        const double n = (double)num_pictures * num_buffers;
+        printf("%-8s scan %5.2f ns/buffer, %6.0f ns/picture; "
+               "lookup %5.2f ns/buffer, %6.0f ns/picture (x%.1f)\n",
+               codecs[i].name,
+               scan_time / n, (double)scan_time / num_pictures,
+               lookup_time / n, (double)lookup_time / num_pictures,
+               (double)scan_time / (lookup_time ? lookup_time : 1));
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ *  test_common.c - Helpers for the driver tests and benchmarks
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#include "sysdeps.h"
+#include "test_common.h"
+#include <time.h>
+
+// Driver entry point, see vdpau_driver.c
+VAStatus VA_DRIVER_INIT_FUNC(void *ctx);
+
+// Initializes the driver on the software VDPAU implementation
+void
+test_display_init(test_display_t *display)
+{
+    memset(display, 0, sizeof(*display));
+
+    /* The software implementation does not need an X display */
+    setenv("VDPAU_VIDEO_SOFTWARE", "yes", 1);
+    display->context.vtable = &display->vtable;
+    TEST_CHECK_STATUS(VA_DRIVER_INIT_FUNC(&display->context));
+}
+
+// Terminates the driver
+void
+test_display_fini(test_display_t *display)
+{
+    TEST_CHECK_STATUS(display->vtable.vaTerminate(&display->context));
+}
+
+// Returns the time in nanoseconds, from a monotonic clock
+uint64_t
+test_get_ticks(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Returns a positive integer from the command line, or DEFAULT_VALUE
+unsigned int
+test_get_arg(int argc, char *argv[], int index, unsigned int default_value)
+{
+    if (index >= argc)
+        return default_value;
+
+    const int value = atoi(argv[index]);
+    return value > 0 ? value : default_value;
+}
+
+// Destroys the buffers the driver did not take ownership of
+static void
+destroy_buffers(test_display_t *display, VABufferID *buffers, int num_buffers)
+{
+    int i;
+
+    for (i = 0; i < num_buffers; i++) {
+        if (buffers[i] != VA_INVALID_BUFFER)
+            VA_CALL(display, vaDestroyBuffer, buffers[i]);
+    }
+}
+
+// Decodes an MPEG-2 intra picture of NUM_SLICES slices to SURFACE. The
+// status of the first call that failed is returned
+VAStatus
+test_decode_mpeg2_picture(
+    test_display_t     *display,
+    VAContextID         context,
+    VASurfaceID         surface,
+    unsigned int        width,
+    unsigned int        num_slices
+)
+{
+    VAPictureParameterBufferMPEG2 pic_param;
+    VASliceParameterBufferMPEG2 slice_params[64];
+    uint8_t slice_data[64 * 32];
+    const unsigned int slice_size = sizeof(slice_data) / ARRAY_ELEMS(slice_params);
+    VABufferID buffers[3];
+    VAStatus status;
+    unsigned int i;
+
+    if (num_slices > ARRAY_ELEMS(slice_params))
+        num_slices = ARRAY_ELEMS(slice_params);
+
+    memset(&pic_param, 0, sizeof(pic_param));
+    pic_param.horizontal_size            = width;
+    pic_param.forward_reference_picture  = VA_INVALID_SURFACE;
+    pic_param.backward_reference_picture = VA_INVALID_SURFACE;
+    pic_param.picture_coding_type        = 1; /* I picture */
+    pic_param.f_code                     = 0xffff;
+    pic_param.picture_coding_extension.bits.picture_structure    = 3;
+    pic_param.picture_coding_extension.bits.frame_pred_frame_dct = 1;
+    pic_param.picture_coding_extension.bits.progressive_frame    = 1;
+
+    /* Slices without a start code, the driver generates it */
+    memset(slice_params, 0, sizeof(slice_params));
+    for (i = 0; i < num_slices; i++) {
+        slice_params[i].slice_data_size         = slice_size;
+        slice_params[i].slice_data_offset       = i * slice_size;
+        slice_params[i].slice_vertical_position = i;
+        slice_params[i].quantiser_scale_code    = 8;
+        memset(&slice_data[i * slice_size], 0x5a + i, slice_size);
+    }
+
+    buffers[0] = buffers[1] = buffers[2] = VA_INVALID_BUFFER;
+    status = VA_CALL(display, vaCreateBuffer, context,
+                     VAPictureParameterBufferType, sizeof(pic_param), 1,
+                     &pic_param, &buffers[0]);
+    if (status == VA_STATUS_SUCCESS)
+        status = VA_CALL(display, vaCreateBuffer, context,
+                         VASliceParameterBufferType, sizeof(slice_params[0]),
+                         num_slices, slice_params, &buffers[1]);
+    if (status == VA_STATUS_SUCCESS)
+        status = VA_CALL(display, vaCreateBuffer, context,
+                         VASliceDataBufferType, num_slices * slice_size, 1,
+                         slice_data, &buffers[2]);
+    if (status == VA_STATUS_SUCCESS)
+        status = VA_CALL(display, vaBeginPicture, context, surface);
+    if (status == VA_STATUS_SUCCESS)
+        status = VA_CALL(display, vaRenderPicture, context,
+                         buffers, ARRAY_ELEMS(buffers));
+    if (status == VA_STATUS_SUCCESS)
+        status = VA_CALL(display, vaEndPicture, context);
+
+    /* The driver takes ownership of the buffers it rendered */
+    destroy_buffers(display, buffers, ARRAY_ELEMS(buffers));
+    return status;
+}
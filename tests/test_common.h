@@ -0,0 +1,87 @@
+/*
+ *  test_common.h - Helpers for the driver tests and benchmarks
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <va/va_backend.h>
+#include "vaapi_compat.h"
+
+// Exit status of a test that cannot run here, see automake "TESTS"
+#define TEST_SKIP 77
+
+// The driver, brought up on the software VDPAU implementation
+typedef struct test_display test_display_t;
+struct test_display {
+    struct VADriverContext      context;
+    struct VADriverVTable       vtable;
+};
+
+// Calls the driver entry point FUNC, e.g. VA_CALL(display, vaEndPicture, ctx)
+#define VA_CALL(display, func, ...) \
+    (display)->context.vtable->func(&(display)->context, __VA_ARGS__)
+
+// Reports a failed check and exits
+#define TEST_CHECK(expr) do {                                           \
+        if (!(expr)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                    __FILE__, __LINE__, #expr);                         \
+            exit(1);                                                    \
+        }                                                               \
+    } while (0)
+
+// Reports a failed VA-API call and exits
+#define TEST_CHECK_STATUS(status) do {                                  \
+        const VAStatus status_ = (status);                              \
+        if (status_ != VA_STATUS_SUCCESS) {                             \
+            fprintf(stderr, "%s:%d: %s failed with status 0x%x\n",      \
+                    __FILE__, __LINE__, #status, status_);              \
+            exit(1);                                                    \
+        }                                                               \
+    } while (0)
+
+// Initializes the driver on the software VDPAU implementation
+void
+test_display_init(test_display_t *display);
+
+// Terminates the driver
+void
+test_display_fini(test_display_t *display);
+
+// Returns the time in nanoseconds, from a monotonic clock
+uint64_t
+test_get_ticks(void);
+
+// Returns a positive integer from the command line, or DEFAULT_VALUE
+unsigned int
+test_get_arg(int argc, char *argv[], int index, unsigned int default_value);
+
+// Decodes an MPEG-2 intra picture of NUM_SLICES slices to SURFACE. The
+// status of the first call that failed is returned
+VAStatus
+test_decode_mpeg2_picture(
+    test_display_t     *display,
+    VAContextID         context,
+    VASurfaceID         surface,
+    unsigned int        width,
+    unsigned int        num_slices
+);
+
+#endif /* TEST_COMMON_H */
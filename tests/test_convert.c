@@ -0,0 +1,124 @@
+/*
+ *  test_convert.c - Pixel format conversions
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#include "sysdeps.h"
+#include "test_common.h"
+#include "image_convert.h"
+
+#define MAX_WIDTH       48
+#define MAX_HEIGHT      7
+
+// Reference RGB to YCbCr coefficients, 8-bit fixed point
+static const int ref_coeffs[2][3][3] = {
+    [IMAGE_COLORSPACE_BT601] = {
+        {  66, 129,  25 }, { -38, -74, 112 }, { 112, -94, -18 }
+    },
+    [IMAGE_COLORSPACE_BT709] = {
+        {  47, 157,  16 }, { -26, -87, 112 }, { 112, -102, -10 }
+    },
+};
+
+// Reference conversion of a pixel, or of the average of a 2x2 block
+static int
+ref_convert(const int c[3], const int rgb[3], int offset)
+{
+    return ((c[0] * rgb[0] + c[1] * rgb[1] + c[2] * rgb[2] + 128) >> 8) + offset;
+}
+
+static void
+check_rgb32_to_yuv420(
+    const uint8_t      *src,
+    unsigned int        src_stride,
+    const uint8_t       rgb_offsets[3],
+    unsigned int        width,
+    unsigned int        height,
+    unsigned int        chroma_step,
+    ImageColorspace     colorspace
+)
+{
+    uint8_t dst_y[MAX_HEIGHT][MAX_WIDTH];
+    uint8_t dst_c[2][(MAX_HEIGHT + 1) / 2][MAX_WIDTH + 1];
+    const int (* const c)[3] = ref_coeffs[colorspace];
+    unsigned int x, y, i, n;
+    int rgb[3];
+
+    memset(dst_y, 0, sizeof(dst_y));
+    memset(dst_c, 0, sizeof(dst_c));
+    uint8_t * const dst_cb = &dst_c[0][0][0];
+    uint8_t * const dst_cr = chroma_step == 2 ? dst_cb + 1 : &dst_c[1][0][0];
+    image_rgb32_to_yuv420(NULL, &dst_y[0][0], MAX_WIDTH,
+                          dst_cb, dst_cr, MAX_WIDTH + 1, chroma_step,
+                          src, src_stride, rgb_offsets, width, height,
+                          colorspace);
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            for (i = 0; i < 3; i++)
+                rgb[i] = src[y * src_stride + 4 * x + rgb_offsets[i]];
+            TEST_CHECK(dst_y[y][x] == ref_convert(c[0], rgb, 16));
+        }
+    }
+
+    for (y = 0; y < height; y += 2) {
+        const unsigned int y1 = y + 1 < height ? y + 1 : y;
+        for (x = 0; x < width; x += 2) {
+            const unsigned int x1 = x + 1 < width ? x + 1 : x;
+            for (i = 0; i < 3; i++) {
+                n = rgb_offsets[i];
+                rgb[i] = (src[y  * src_stride + 4 * x  + n] +
+                          src[y  * src_stride + 4 * x1 + n] +
+                          src[y1 * src_stride + 4 * x  + n] +
+                          src[y1 * src_stride + 4 * x1 + n] + 2) >> 2;
+            }
+            const unsigned int offset = (y / 2) * (MAX_WIDTH + 1) +
+                (x / 2) * chroma_step;
+            TEST_CHECK(dst_cb[offset] == ref_convert(c[1], rgb, 128));
+            TEST_CHECK(dst_cr[offset] == ref_convert(c[2], rgb, 128));
+        }
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const uint8_t rgb_offsets[2][3] = { { 2, 1, 0 }, { 0, 1, 2 } };
+    const unsigned int src_stride = 4 * MAX_WIDTH + 12;
+    uint8_t src[MAX_HEIGHT * (4 * MAX_WIDTH + 12)];
+    unsigned int i, width, height, order, step, colorspace;
+
+    /* Extreme values first, then noise */
+    for (i = 0; i < sizeof(src); i++)
+        src[i] = i < 64 ? (i & 4 ? 0xff : 0x00) : (i * 2654435761U) >> 24;
+
+    for (colorspace = 0; colorspace < 2; colorspace++) {
+        for (order = 0; order < 2; order++) {
+            for (step = 1; step <= 2; step++) {
+                for (height = 1; height <= MAX_HEIGHT; height++) {
+                    for (width = 1; width <= MAX_WIDTH; width++)
+                        check_rgb32_to_yuv420(src, src_stride,
+                                              rgb_offsets[order],
+                                              width, height, step,
+                                              colorspace);
+                }
+            }
+        }
+    }
+    return 0;
+}
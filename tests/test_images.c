@@ -0,0 +1,282 @@
+/*
+ *  test_images.c - Derived images, vaPutImage() and the copy engine
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#include "sysdeps.h"
+#include "test_common.h"
+#include <dirent.h>
+
+#define SURFACE_WIDTH   64
+#define SURFACE_HEIGHT  32
+
+// Copy engine threads, the caller included. This is more than the
+// default maximum, which only applies when the CPU count is used
+#define COPY_THREADS    8
+
+static VASurfaceID
+create_surface(test_display_t *display)
+{
+    VASurfaceID surface;
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaCreateSurfaces,
+                              SURFACE_WIDTH, SURFACE_HEIGHT,
+                              VA_RT_FORMAT_YUV420, 1, &surface));
+    return surface;
+}
+
+// Fills the luma plane of IMAGE with VALUE, through its mapped buffer
+static void
+fill_luma(test_display_t *display, const VAImage *image, uint8_t value)
+{
+    uint8_t *data;
+    unsigned int y;
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaMapBuffer, image->buf, (void **)&data));
+    for (y = 0; y < image->height; y++)
+        memset(&data[image->offsets[0] + y * image->pitches[0]], value,
+               image->width);
+    TEST_CHECK_STATUS(VA_CALL(display, vaUnmapBuffer, image->buf));
+}
+
+// Checks that the luma plane of the surface is VALUE
+static void
+check_luma(test_display_t *display, VASurfaceID surface, uint8_t value)
+{
+    VAImage image;
+    uint8_t *data;
+    unsigned int x, y;
+
+    /* A separate image, read back through vaGetImage() */
+    TEST_CHECK_STATUS(VA_CALL(display, vaDeriveImage, surface, &image));
+    VAImageFormat format = image.format;
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image.image_id));
+    TEST_CHECK_STATUS(VA_CALL(display, vaCreateImage, &format,
+                              SURFACE_WIDTH, SURFACE_HEIGHT, &image));
+    TEST_CHECK_STATUS(VA_CALL(display, vaGetImage, surface, 0, 0,
+                              SURFACE_WIDTH, SURFACE_HEIGHT, image.image_id));
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaMapBuffer, image.buf, (void **)&data));
+    for (y = 0; y < image.height; y++) {
+        for (x = 0; x < image.width; x++)
+            TEST_CHECK(data[image.offsets[0] + y * image.pitches[0] + x] == value);
+    }
+    TEST_CHECK_STATUS(VA_CALL(display, vaUnmapBuffer, image.buf));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image.image_id));
+}
+
+// Each vaDeriveImage() takes a reference, released by vaDestroyImage()
+static void
+test_derive_refcount(test_display_t *display)
+{
+    VAImage image1, image2;
+
+    VASurfaceID surface = create_surface(display);
+    TEST_CHECK_STATUS(VA_CALL(display, vaDeriveImage, surface, &image1));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDeriveImage, surface, &image2));
+    TEST_CHECK(image1.image_id == image2.image_id);
+    TEST_CHECK(image1.buf == image2.buf);
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image1.image_id));
+    fill_luma(display, &image2, 0x40);
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image2.image_id));
+    TEST_CHECK(VA_CALL(display, vaDestroyImage, image2.image_id) ==
+               VA_STATUS_ERROR_INVALID_IMAGE);
+
+    /* A new image is derived once the last reference is gone */
+    TEST_CHECK_STATUS(VA_CALL(display, vaDeriveImage, surface, &image1));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image1.image_id));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroySurfaces, &surface, 1));
+}
+
+// The client still owns a derived image after the surface is destroyed
+static void
+test_derive_detach(test_display_t *display)
+{
+    VASurfaceID surface = create_surface(display);
+    VAImage image;
+    void *data;
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaDeriveImage, surface, &image));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroySurfaces, &surface, 1));
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaMapBuffer, image.buf, &data));
+    TEST_CHECK_STATUS(VA_CALL(display, vaUnmapBuffer, image.buf));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image.image_id));
+    TEST_CHECK(VA_CALL(display, vaDestroyImage, image.image_id) ==
+               VA_STATUS_ERROR_INVALID_IMAGE);
+}
+
+// Client writes reach the surface, reads leave it alone
+// (VDPAU_VIDEO_DERIVE_IMAGE_WRITEBACK=yes)
+static void
+test_derive_writeback(test_display_t *display)
+{
+    VASurfaceID surface = create_surface(display);
+    VAImage image;
+    void *data;
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaDeriveImage, surface, &image));
+    fill_luma(display, &image, 0x80);
+    check_luma(display, surface, 0x80);
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaMapBuffer, image.buf, &data));
+    TEST_CHECK_STATUS(VA_CALL(display, vaUnmapBuffer, image.buf));
+    check_luma(display, surface, 0x80);
+
+    fill_luma(display, &image, 0x20);
+    check_luma(display, surface, 0x20);
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image.image_id));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroySurfaces, &surface, 1));
+}
+
+// Subsampled planes cannot be put at an odd offset
+static void
+test_put_image_alignment(test_display_t *display)
+{
+    VASurfaceID surface = create_surface(display);
+    VAImage image;
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaDeriveImage, surface, &image));
+    VAImageFormat format = image.format;
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image.image_id));
+    TEST_CHECK_STATUS(VA_CALL(display, vaCreateImage, &format,
+                              SURFACE_WIDTH, SURFACE_HEIGHT, &image));
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaPutImage, surface, image.image_id,
+                              0, 0, 16, 16, 2, 4, 16, 16));
+    TEST_CHECK(VA_CALL(display, vaPutImage, surface, image.image_id,
+                       0, 0, 16, 16, 1, 4, 16, 16) ==
+               VA_STATUS_ERROR_INVALID_PARAMETER);
+    TEST_CHECK(VA_CALL(display, vaPutImage, surface, image.image_id,
+                       0, 0, 16, 16, 2, 3, 16, 16) ==
+               VA_STATUS_ERROR_INVALID_PARAMETER);
+    TEST_CHECK(VA_CALL(display, vaPutImage, surface, image.image_id,
+                       1, 0, 16, 16, 2, 4, 16, 16) ==
+               VA_STATUS_ERROR_INVALID_PARAMETER);
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image.image_id));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroySurfaces, &surface, 1));
+}
+
+// Subsampled planes cannot be read back from an odd offset either
+static void
+test_get_image_alignment(test_display_t *display)
+{
+    VASurfaceID surface;
+    VAImage image;
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaCreateSurfaces,
+                              2 * SURFACE_WIDTH, 2 * SURFACE_WIDTH,
+                              VA_RT_FORMAT_YUV420, 1, &surface));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDeriveImage, surface, &image));
+    VAImageFormat format = image.format;
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image.image_id));
+    TEST_CHECK_STATUS(VA_CALL(display, vaCreateImage, &format,
+                              SURFACE_WIDTH, SURFACE_WIDTH, &image));
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaGetImage, surface, 2, 2,
+                              SURFACE_WIDTH, SURFACE_WIDTH, image.image_id));
+    TEST_CHECK(VA_CALL(display, vaGetImage, surface, 1, 1,
+                       SURFACE_WIDTH, SURFACE_WIDTH, image.image_id) ==
+               VA_STATUS_ERROR_INVALID_PARAMETER);
+    TEST_CHECK(VA_CALL(display, vaGetImage, surface, 1, 0,
+                       SURFACE_WIDTH, SURFACE_WIDTH, image.image_id) ==
+               VA_STATUS_ERROR_INVALID_PARAMETER);
+    TEST_CHECK(VA_CALL(display, vaGetImage, surface, 0, 1,
+                       SURFACE_WIDTH, SURFACE_WIDTH, image.image_id) ==
+               VA_STATUS_ERROR_INVALID_PARAMETER);
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image.image_id));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroySurfaces, &surface, 1));
+}
+
+// Returns the number of threads of the process, or -1 if unknown
+static int
+get_num_threads(void)
+{
+    struct dirent *entry;
+    int num_threads = 0;
+
+    DIR * const dir = opendir("/proc/self/task");
+    if (!dir)
+        return -1;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.')
+            num_threads++;
+    }
+    closedir(dir);
+    return num_threads;
+}
+
+// Reads back a WIDTH x HEIGHT surface, but its first rows, through the
+// staging buffer and the copy engine
+static void
+get_image(test_display_t *display, unsigned int width, unsigned int height)
+{
+    VASurfaceID surface;
+    VAImage image;
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaCreateSurfaces, width, height,
+                              VA_RT_FORMAT_YUV420, 1, &surface));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDeriveImage, surface, &image));
+    VAImageFormat format = image.format;
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image.image_id));
+    TEST_CHECK_STATUS(VA_CALL(display, vaCreateImage, &format,
+                              width, height - 2, &image));
+    TEST_CHECK_STATUS(VA_CALL(display, vaGetImage, surface, 0, 2,
+                              width, height - 2, image.image_id));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyImage, image.image_id));
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroySurfaces, &surface, 1));
+}
+
+// Copy engine workers start on the first large copy, as many as requested
+static void
+test_copy_threads(test_display_t *display)
+{
+    const int num_threads = get_num_threads();
+    if (num_threads < 0)
+        return;
+
+    get_image(display, SURFACE_WIDTH, SURFACE_HEIGHT);
+    TEST_CHECK(get_num_threads() == num_threads);
+
+    get_image(display, 1920, 1088);
+    TEST_CHECK(get_num_threads() == num_threads + COPY_THREADS - 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_display_t display;
+    char copy_threads[16];
+
+    snprintf(copy_threads, sizeof(copy_threads), "%d", COPY_THREADS);
+    setenv("VDPAU_VIDEO_COPY_THREADS", copy_threads, 1);
+    setenv("VDPAU_VIDEO_DERIVE_IMAGE_WRITEBACK", "yes", 1);
+    test_display_init(&display);
+    test_copy_threads(&display);
+    test_derive_refcount(&display);
+    test_derive_detach(&display);
+    test_derive_writeback(&display);
+    test_put_image_alignment(&display);
+    test_get_image_alignment(&display);
+    test_display_fini(&display);
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ *  test_start_code.c - Start code scanner
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+/*
+ * Usage: test_start_code [num_iterations]
+ *
+ * 1) Checks find_start_code() against a byte by byte scan, for 3-byte
+ *    and 4-byte start codes at every position and buffer alignment, from
+ *    the vector loop down to the scalar tail, and with near misses.
+ * 2) Reports the scan throughput over buffers with no start code, from
+ *    no zero byte at all to a zero byte every other byte.
+ */
+
+#include "sysdeps.h"
+#include "test_common.h"
+#include "utils.h"
+
+#define NUM_ITERATIONS_DEFAULT  200
+#define MAX_LENGTH              80
+#define MAX_ALIGN               16
+#define BENCH_SIZE              (1 << 20)
+
+static const uint8_t *
+ref_find_start_code(const uint8_t *buf, const uint8_t *end)
+{
+    const uint8_t *p;
+
+    for (p = buf; end - p >= 3; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+            return p;
+    }
+    return end;
+}
+
+// Fills BUF with noise holding zero bytes and near misses, 00 00 02 and
+// 00 01, but no start code
+static void
+fill_noise(uint8_t *buf, unsigned int size, uint32_t seed)
+{
+    unsigned int i;
+
+    for (i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        const unsigned int r = seed >> 24;
+        buf[i] = r < 64 ? 0 : r < 80 ? 1 : r < 96 ? 2 : r;
+        if (i >= 2 && buf[i] == 1 && buf[i - 1] == 0 && buf[i - 2] == 0)
+            buf[i] = 2;
+    }
+}
+
+static void
+check_find_start_code(const uint8_t *buf, unsigned int length)
+{
+    TEST_CHECK(find_start_code(buf, buf + length) ==
+               ref_find_start_code(buf, buf + length));
+}
+
+static void
+test_start_codes(void)
+{
+    static const uint8_t start_codes[2][4] = {
+        { 0x00, 0x00, 0x01 }, { 0x00, 0x00, 0x00, 0x01 }
+    };
+    uint8_t storage[MAX_ALIGN + MAX_LENGTH];
+    unsigned int align, length, pos, i, seed;
+
+    for (align = 0; align < MAX_ALIGN; align++) {
+        uint8_t * const buf = storage + align;
+        for (length = 0; length <= MAX_LENGTH; length++) {
+            for (seed = 0; seed < 4; seed++) {
+                /* No start code, or only part of one at the end */
+                fill_noise(buf, length, seed);
+                check_find_start_code(buf, length);
+                for (i = 1; i < 3 && i <= length; i++) {
+                    memcpy(buf + length - i, start_codes[0], i);
+                    check_find_start_code(buf, length);
+                }
+
+                /* A start code at every position */
+                for (i = 0; i < ARRAY_ELEMS(start_codes); i++) {
+                    const unsigned int size = 3 + i;
+                    for (pos = 0; pos + size <= length; pos++) {
+                        fill_noise(buf, length, seed);
+                        memcpy(buf + pos, start_codes[i], size);
+                        check_find_start_code(buf, length);
+                        TEST_CHECK(find_start_code(buf, buf + length) <= buf + pos + i);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void
+bench_start_codes(unsigned int num_iterations)
+{
+    static const char * const names[] = {
+        "no zeros", "noise", "zero every other byte"
+    };
+    unsigned int i, j;
+
+    uint8_t * const buf = malloc(BENCH_SIZE);
+    TEST_CHECK(buf != NULL);
+
+    for (i = 0; i < ARRAY_ELEMS(names); i++) {
+        switch (i) {
+        case 0: memset(buf, 0x5a, BENCH_SIZE); break;
+        case 1: fill_noise(buf, BENCH_SIZE, 1); break;
+        case 2:
+            for (j = 0; j < BENCH_SIZE; j++)
+                buf[j] = j & 1 ? 0xff : 0x00;
+            break;
+        }
+
+        const uint64_t start_time = test_get_ticks();
+        for (j = 0; j < num_iterations; j++)
+            TEST_CHECK(find_start_code(buf, buf + BENCH_SIZE) == buf + BENCH_SIZE);
+        const uint64_t elapsed = test_get_ticks() - start_time;
+
+        printf("%-22s %6.2f GB/s\n", names[i],
+               (double)BENCH_SIZE * num_iterations / (elapsed ? elapsed : 1));
+    }
+    free(buf);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const unsigned int num_iterations = test_get_arg(argc, argv, 1, NUM_ITERATIONS_DEFAULT);
+
+    test_start_codes();
+    bench_start_codes(num_iterations);
+    return 0;
+}
@@ -0,0 +1,210 @@
+/*
+ *  test_threads.c - Concurrent decoding and context teardown
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+/*
+ * Usage: test_threads [num_threads] [num_pictures] [num_iterations]
+ *
+ * 1) Throughput: each thread decodes to its own context and surfaces,
+ *    first with one thread, then with all of them.
+ * 2) Teardown: all threads decode to a shared context while the main
+ *    thread destroys it. Every call must either succeed or report the
+ *    context as invalid, and the context must stay invalid afterwards.
+ */
+
+#include "sysdeps.h"
+#include "test_common.h"
+#include <pthread.h>
+#include <sched.h>
+
+#define NUM_THREADS_DEFAULT     4
+#define NUM_PICTURES_DEFAULT    2000
+#define NUM_ITERATIONS_DEFAULT  50
+#define NUM_SURFACES            4
+#define NUM_SLICES              8
+#define PICTURE_WIDTH           352
+#define PICTURE_HEIGHT          288
+
+typedef struct {
+    test_display_t     *display;
+    pthread_t           thread;
+    VAContextID         context;
+    VASurfaceID         surface;
+    unsigned int        num_pictures;   /* 0: until the context is gone */
+    unsigned int        num_decoded;
+    volatile int       *started;
+    VAStatus            status;
+} decode_thread_t;
+
+static VAConfigID
+create_config(test_display_t *display)
+{
+    VAConfigID config;
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaCreateConfig, VAProfileMPEG2Main,
+                              VAEntrypointVLD, NULL, 0, &config));
+    return config;
+}
+
+static VAContextID
+create_context(test_display_t *display, VAConfigID config, VASurfaceID *surfaces)
+{
+    VAContextID context;
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaCreateSurfaces,
+                              PICTURE_WIDTH, PICTURE_HEIGHT, VA_RT_FORMAT_YUV420,
+                              NUM_SURFACES, surfaces));
+    TEST_CHECK_STATUS(VA_CALL(display, vaCreateContext, config,
+                              PICTURE_WIDTH, PICTURE_HEIGHT, VA_PROGRESSIVE,
+                              surfaces, NUM_SURFACES, &context));
+    return context;
+}
+
+static void *
+decode_thread(void *arg)
+{
+    decode_thread_t * const t = arg;
+
+    __atomic_add_fetch(t->started, 1, __ATOMIC_RELEASE);
+
+    while (t->num_pictures == 0 || t->num_decoded < t->num_pictures) {
+        t->status = test_decode_mpeg2_picture(t->display, t->context,
+                                              t->surface, PICTURE_WIDTH,
+                                              NUM_SLICES);
+        /* With a shared context, another thread may end the picture
+           first, so that there is no current render target left */
+        if (t->status == VA_STATUS_ERROR_INVALID_SURFACE &&
+            t->num_pictures == 0)
+            continue;
+        if (t->status != VA_STATUS_SUCCESS)
+            break;
+        t->num_decoded++;
+    }
+    return NULL;
+}
+
+// Decodes NUM_PICTURES pictures in each of NUM_THREADS threads, returns
+// the pictures decoded per second
+static double
+run_throughput(test_display_t *display, VAConfigID config,
+               unsigned int num_threads, unsigned int num_pictures)
+{
+    decode_thread_t threads[num_threads];
+    VASurfaceID surfaces[num_threads][NUM_SURFACES];
+    volatile int started = 0;
+    unsigned int i;
+
+    for (i = 0; i < num_threads; i++) {
+        threads[i].display      = display;
+        threads[i].context      = create_context(display, config, surfaces[i]);
+        threads[i].surface      = surfaces[i][0];
+        threads[i].num_pictures = num_pictures;
+        threads[i].num_decoded  = 0;
+        threads[i].started      = &started;
+        threads[i].status       = VA_STATUS_SUCCESS;
+    }
+
+    const uint64_t start_time = test_get_ticks();
+    for (i = 0; i < num_threads; i++)
+        TEST_CHECK(pthread_create(&threads[i].thread, NULL,
+                                  decode_thread, &threads[i]) == 0);
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i].thread, NULL);
+    const uint64_t elapsed = test_get_ticks() - start_time;
+
+    for (i = 0; i < num_threads; i++) {
+        TEST_CHECK_STATUS(threads[i].status);
+        TEST_CHECK(threads[i].num_decoded == num_pictures);
+        TEST_CHECK_STATUS(VA_CALL(display, vaSyncSurface, threads[i].surface));
+        TEST_CHECK_STATUS(VA_CALL(display, vaDestroyContext, threads[i].context));
+        TEST_CHECK_STATUS(VA_CALL(display, vaDestroySurfaces,
+                                  surfaces[i], NUM_SURFACES));
+    }
+    return (double)num_threads * num_pictures * 1e9 / (elapsed ? elapsed : 1);
+}
+
+// Destroys a context while NUM_THREADS threads decode to it
+static void
+run_teardown(test_display_t *display, VAConfigID config, unsigned int num_threads)
+{
+    decode_thread_t threads[num_threads];
+    VASurfaceID surfaces[NUM_SURFACES];
+    volatile int started = 0;
+    unsigned int i;
+
+    const VAContextID context = create_context(display, config, surfaces);
+    for (i = 0; i < num_threads; i++) {
+        threads[i].display      = display;
+        threads[i].context      = context;
+        threads[i].surface      = surfaces[i % NUM_SURFACES];
+        threads[i].num_pictures = 0;
+        threads[i].num_decoded  = 0;
+        threads[i].started      = &started;
+        threads[i].status       = VA_STATUS_SUCCESS;
+        TEST_CHECK(pthread_create(&threads[i].thread, NULL,
+                                  decode_thread, &threads[i]) == 0);
+    }
+
+    /* Let the threads contend for the context lock */
+    while (__atomic_load_n(&started, __ATOMIC_ACQUIRE) < (int)num_threads)
+        sched_yield();
+    for (i = 0; i < 16; i++)
+        sched_yield();
+
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroyContext, context));
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        TEST_CHECK(threads[i].status == VA_STATUS_ERROR_INVALID_CONTEXT);
+    }
+
+    TEST_CHECK(VA_CALL(display, vaDestroyContext, context) ==
+               VA_STATUS_ERROR_INVALID_CONTEXT);
+    TEST_CHECK(VA_CALL(display, vaBeginPicture, context, surfaces[0]) ==
+               VA_STATUS_ERROR_INVALID_CONTEXT);
+    TEST_CHECK_STATUS(VA_CALL(display, vaDestroySurfaces,
+                              surfaces, NUM_SURFACES));
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_display_t display;
+    unsigned int i;
+
+    const unsigned int num_threads    = test_get_arg(argc, argv, 1, NUM_THREADS_DEFAULT);
+    const unsigned int num_pictures   = test_get_arg(argc, argv, 2, NUM_PICTURES_DEFAULT);
+    const unsigned int num_iterations = test_get_arg(argc, argv, 3, NUM_ITERATIONS_DEFAULT);
+
+    test_display_init(&display);
+    const VAConfigID config = create_config(&display);
+
+    const double rate_1 = run_throughput(&display, config, 1, num_pictures);
+    const double rate_n = run_throughput(&display, config, num_threads, num_pictures);
+    printf("throughput: 1 thread %.0f pictures/s, %u threads %.0f pictures/s "
+           "(x%.2f)\n", rate_1, num_threads, rate_n, rate_n / rate_1);
+
+    for (i = 0; i < num_iterations; i++)
+        run_teardown(&display, config, num_threads);
+    printf("teardown: %u contexts destroyed under %u threads\n",
+           num_iterations, num_threads);
+
+    TEST_CHECK_STATUS(VA_CALL(&display, vaDestroyConfig, config));
+    test_display_fini(&display);
+    return 0;
+}